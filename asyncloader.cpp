@@ -0,0 +1,221 @@
+#include "asyncloader.h"
+#include "meshoptimize.h"
+#include "simplify.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+    unique_ptr<LoadBatch> makeBatch(LoadBatch::Kind kind, size_t first = 0, size_t count = 0)
+    {
+        unique_ptr<LoadBatch> batch(new LoadBatch());
+        batch->kind = kind;
+        batch->first = first;
+        batch->count = count;
+        return batch;
+    }
+}
+
+AsyncMeshLoader::~AsyncMeshLoader()
+{
+    // a load still running gives up at its next batch, window or submesh
+    stopping = true;
+    if (worker.joinable())
+        worker.join();
+}
+
+void AsyncMeshLoader::start(const string &objFilename, size_t streamBudget)
+{
+    worker = thread(&AsyncMeshLoader::run, this, objFilename, streamBudget);
+}
+
+bool AsyncMeshLoader::poll(unique_ptr<LoadBatch> &batch)
+{
+    if (previewTaken)
+        previewShown = true;
+    if (!queue.pop(batch))
+        return false;
+    previewTaken = previewTaken || batch->kind == LoadBatch::PREVIEW;
+    return true;
+}
+
+void AsyncMeshLoader::run(const string &objFilename, size_t streamBudget)
+{
+    bool ok;
+    if (streamBudget > 0)
+    {
+        StreamedMesh streamed;
+        ok = streamObj(objFilename, streamBudget, *this, streamed);
+        if (ok)
+            buffers.assign(std::move(streamed));
+    }
+    else if (buffers.mapCache(meshCacheFilename(objFilename), objFilename))
+        ok = handOver();
+    else
+    {
+        Mesh mesh;
+        ok = loadPreview(objFilename, mesh) && refine(objFilename, mesh);
+    }
+    // buffers is complete before the queue publishes this
+    unique_ptr<LoadBatch> batch = makeBatch(ok ? LoadBatch::FINISHED : LoadBatch::FAILED);
+    batch->replaces = replaced;
+    send(std::move(batch));
+}
+
+bool AsyncMeshLoader::loadPreview(const string &objFilename, Mesh &mesh)
+{
+    // Streamed windows repeat the vertices at their borders, so the refined
+    // mesh is parsed again rather than put together from them; the cache and
+    // the LODs are then the same as a synchronous load's.
+    StreamedMesh streamed;
+    if (!streamObj(objFilename, PREVIEW_STREAM_BUDGET, *this, streamed))
+    {
+        if (stopping || reserved)
+            return false;
+        // nothing was sent but the materials, e.g. because there was no room
+        // for the spill file in $TMPDIR: parse it whole, then hand it over
+        ObjLoadOptions objOptions;
+        objOptions.cancel = &stopping;
+        mesh = loadObj(objFilename, objOptions);
+        if (stopping)
+            return false;
+        if (mesh.indices.empty())
+        {
+            cerr << "No triangles in " << objFilename << endl;
+            return false;
+        }
+        Mesh preview = mesh;
+        buffers.assign(std::move(preview));
+        if (!handOver())
+            return false;
+    }
+
+    // the GL thread polls again only after drawing what it has
+    if (!send(makeBatch(LoadBatch::PREVIEW)))
+        return false;
+    while (!previewShown)
+    {
+        if (stopping)
+            return false;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+}
+
+bool AsyncMeshLoader::refine(const string &objFilename, Mesh &mesh)
+{
+    if (mesh.indices.empty())
+    {
+        ObjLoadOptions objOptions;
+        objOptions.cancel = &stopping;
+        mesh = loadObj(objFilename, objOptions);
+        if (stopping)
+            return false;
+        if (mesh.indices.empty())
+        {
+            cerr << "No triangles in " << objFilename << endl;
+            return false;
+        }
+    }
+    LodOptions lodOptions;
+    lodOptions.cancel = &stopping;
+    generateLods(mesh, lodOptions);
+    if (stopping)
+        return false;
+    optimizeMesh(mesh, &stopping);
+    if (stopping)
+        return false;
+    writeMeshCache(meshCacheFilename(objFilename), objFilename, mesh);
+    buffers.assign(std::move(mesh));
+    replaced = true;
+    return true;
+}
+
+bool AsyncMeshLoader::handOver()
+{
+    setMaterials(buffers.materials);
+    if (!reserve(buffers.numVertices(), buffers.numIndices()) || !writeVertices(0, buffers.vertices(), buffers.numVertices()))
+        return false;
+
+    // full-detail submeshes, drawable as they arrive, then the LOD ranges
+    // that follow them in the index buffer
+    vector<unsigned int> indices;
+    auto sendIndices = [&](size_t first, size_t count, const SubMesh &submesh) {
+        indices.resize(count);
+        if (buffers.shortIndices())
+            copy_n((const unsigned short *)buffers.indices() + first, count, indices.begin());
+        else
+            copy_n((const unsigned int *)buffers.indices() + first, count, indices.begin());
+        return writeIndices(first, indices.data(), count, submesh);
+    };
+    size_t fullDetailEnd = 0;
+    for (const SubMesh &submesh : buffers.submeshes)
+    {
+        if (!sendIndices(submesh.first, submesh.count, submesh))
+            return false;
+        fullDetailEnd = max<size_t>(fullDetailEnd, submesh.first + submesh.count);
+    }
+    return sendIndices(fullDetailEnd, buffers.numIndices() - fullDetailEnd, SubMesh());
+}
+
+bool AsyncMeshLoader::send(unique_ptr<LoadBatch> batch)
+{
+    // the GL thread drains the queue once per frame
+    while (!queue.push(batch))
+    {
+        if (stopping)
+            return false;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return !stopping;
+}
+
+void AsyncMeshLoader::setMaterials(const vector<Material> &materials)
+{
+    unique_ptr<LoadBatch> batch = makeBatch(LoadBatch::MATERIALS);
+    batch->materials = materials;
+    send(std::move(batch));
+}
+
+bool AsyncMeshLoader::reserve(size_t estimatedVertices, size_t numIndices)
+{
+    reserved = true;
+    return send(makeBatch(LoadBatch::RESERVE, estimatedVertices, numIndices));
+}
+
+// streamObj writes whole windows; they go out in batches of at most
+// BATCH_ELEMENTS, so the queue never holds more than QUEUE_BATCHES of those
+
+bool AsyncMeshLoader::writeVertices(size_t first, const float *vertices, size_t count)
+{
+    for (size_t offset = 0; offset < count; offset += BATCH_ELEMENTS)
+    {
+        size_t batchCount = min(BATCH_ELEMENTS, count - offset);
+        unique_ptr<LoadBatch> batch = makeBatch(LoadBatch::VERTICES, first + offset, batchCount);
+        batch->vertices.assign(vertices + offset * 6, vertices + (offset + batchCount) * 6);
+        if (!send(std::move(batch)))
+            return false;
+    }
+    return true;
+}
+
+bool AsyncMeshLoader::writeIndices(size_t first, const unsigned int *indices, size_t count, const SubMesh &submesh)
+{
+    for (size_t offset = 0; offset < count; offset += BATCH_ELEMENTS)
+    {
+        size_t batchCount = min(BATCH_ELEMENTS, count - offset);
+        unique_ptr<LoadBatch> batch = makeBatch(LoadBatch::INDICES, first + offset, batchCount);
+        batch->indices.assign(indices + offset, indices + offset + batchCount);
+        // the submesh as far as this batch takes it
+        batch->submesh = submesh;
+        if (submesh.count > 0)
+            batch->submesh.count = (unsigned int)(submesh.count - (count - offset - batchCount));
+        if (!send(std::move(batch)))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,105 @@
+#ifndef ASYNCLOADER_H
+#define ASYNCLOADER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "meshcache.h"
+#include "objloader.h"
+#include "spscqueue.h"
+
+// One piece of a mesh on its way from the loader thread to the GL thread
+struct LoadBatch
+{
+    enum Kind
+    {
+        MATERIALS, // materials, the default one included
+        RESERVE,   // first = estimated vertices, count = indices
+        VERTICES,  // vertices [first, first + count)
+        INDICES,   // indices [first, first + count), extending submesh; count 0 if not drawn yet
+        PREVIEW,   // the whole model is in at full detail; a refined version follows
+        FINISHED,  // everything is in, and mesh() holds the result
+        FAILED
+    };
+
+    Kind kind;
+    size_t first = 0, count = 0;
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    SubMesh submesh = SubMesh();
+    std::vector<Material> materials;
+    bool replaces = false; // FINISHED: mesh() is not what the batches held, upload it whole
+};
+
+// Loads a mesh on a worker thread and hands it over in batches through a
+// lock-free queue, so the thread that owns the GL context can upload a
+// little every frame and draw what has arrived. With a stream budget the
+// OBJ goes through streamObj and arrives window by window. Without one, a
+// current .meshbin follows in fixed-size batches, full-detail submeshes
+// first; on a cache miss the OBJ is streamed the same way as it is parsed,
+// and only once that preview has been drawn is it loaded again the way
+// loadMesh does, LODs, optimization and cache included, the result
+// replacing the preview whole. The cache is the same whichever wrote it.
+// Indices always arrive as 32 bits. Every step gives up soon after the
+// loader is destroyed.
+class AsyncMeshLoader : private MeshSink
+{
+public:
+    AsyncMeshLoader() : queue(QUEUE_BATCHES) {}
+    ~AsyncMeshLoader();
+
+    AsyncMeshLoader(const AsyncMeshLoader &) = delete;
+    AsyncMeshLoader &operator=(const AsyncMeshLoader &) = delete;
+
+    void start(const std::string &objFilename, size_t streamBudget);
+    // The next batch, if one has arrived; GL thread only. The caller draws
+    // a frame after PREVIEW before it polls again, which lets the loader go on.
+    bool poll(std::unique_ptr<LoadBatch> &batch);
+    // after FINISHED: the mapped cache, the refined mesh or what streamObj
+    // left, vertex data included
+    MeshBuffers &mesh() { return buffers; }
+
+private:
+    // most vertices or indices per batch; a multiple of 3 so index batches
+    // hold whole triangles
+    static constexpr size_t BATCH_ELEMENTS = 3 << 14;
+    // batches in flight; the loader waits while the queue is full, which
+    // bounds the memory they take
+    static constexpr size_t QUEUE_BATCHES = 16;
+
+    // loader memory for streaming the preview of an uncached OBJ
+    static constexpr size_t PREVIEW_STREAM_BUDGET = 256 << 20;
+
+    void run(const std::string &objFilename, size_t streamBudget);
+    bool handOver();
+    // streams the OBJ to the GL thread; mesh is only filled when the OBJ had
+    // to be parsed whole instead
+    bool loadPreview(const std::string &objFilename, Mesh &mesh);
+    // what loadMesh does on a cache miss, once the preview has been drawn
+    bool refine(const std::string &objFilename, Mesh &mesh);
+    // queues batch, waiting for room; false if the load was cancelled
+    bool send(std::unique_ptr<LoadBatch> batch);
+
+    // MeshSink, called from streamObj on the worker thread
+    void setMaterials(const std::vector<Material> &materials) override;
+    bool reserve(size_t estimatedVertices, size_t numIndices) override;
+    bool writeVertices(size_t first, const float *vertices, size_t count) override;
+    bool writeIndices(size_t first, const unsigned int *indices, size_t count, const SubMesh &submesh) override;
+    bool cancelled() const override { return stopping; }
+
+    SpscQueue<std::unique_ptr<LoadBatch>> queue;
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+    // PREVIEW was polled; GL thread only
+    bool previewTaken = false;
+    // the GL thread polled again after PREVIEW, so it has drawn the preview
+    std::atomic<bool> previewShown{false};
+    bool reserved = false;
+    bool replaced = false;
+    MeshBuffers buffers;
+};
+
+#endif
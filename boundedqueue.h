@@ -0,0 +1,105 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Queue of at most capacity elements between any number of producer and
+// consumer threads, for handing work from one pipeline stage to the next.
+// push waits for room and pop for an element, so a slow stage holds back
+// the ones before it instead of letting work pile up in memory. Time spent
+// waiting is summed per side, to tell which neighbor a stage waited for.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    // false, leaving value alone, once the queue is closed
+    bool push(T &value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!closed && elements.size() >= capacity)
+        {
+            auto start = std::chrono::steady_clock::now();
+            notFull.wait(lock, [this] { return closed || elements.size() < capacity; });
+            pushWait += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        if (closed)
+            return false;
+        elements.push_back(std::move(value));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // waits for an element; false once the queue is closed and drained
+    bool pop(T &value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!closed && elements.empty())
+        {
+            auto start = std::chrono::steady_clock::now();
+            notEmpty.wait(lock, [this] { return closed || !elements.empty(); });
+            popWait += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        return take(lock, value);
+    }
+
+    // false right away when the queue is empty
+    bool tryPop(T &value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return take(lock, value);
+    }
+
+    // no more pushes; consumers drain what is queued, then pop fails
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    double pushWaitSeconds() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pushWait;
+    }
+    double popWaitSeconds() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return popWait;
+    }
+
+private:
+    bool take(std::unique_lock<std::mutex> &lock, T &value)
+    {
+        if (elements.empty())
+            return false;
+        value = std::move(elements.front());
+        elements.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+    std::deque<T> elements;
+    size_t capacity;
+    bool closed = false;
+    double pushWait = 0.0, popWait = 0.0;
+};
+
+#endif
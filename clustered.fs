@@ -0,0 +1,85 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec4 Tint; // rgb, a = how much of the material color it replaces
+in vec3 LightPos;
+in vec3 ViewPos;
+
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPosition;
+    vec4 lightColor; // rgb, w = intensity
+    vec4 viewPosition;
+};
+
+struct MaterialData
+{
+    vec4 color;        // rgb
+    vec4 coefficients; // ka, kd, ks, ns
+};
+
+#define MAX_MATERIALS 512
+layout (std140) uniform Materials
+{
+    MaterialData materials[MAX_MATERIALS];
+};
+flat in int MaterialIndex; // from the draw, see source.vs
+
+// Point lights, assigned to a grid of view-space clusters on the CPU each
+// frame (lightclusters.h); a fragment only visits its own cluster's list.
+layout (std140) uniform Clusters
+{
+    uvec4 clusterCounts; // x, y, depth slices; w = number of lights
+    vec4 clusterParams;  // pixels per cluster in x and y; log(depth) scale and bias
+};
+uniform samplerBuffer lights;         // per light: position, radius; color * intensity
+uniform usamplerBuffer clusterLights; // per cluster: first entry of lightIndices, count
+uniform usamplerBuffer lightIndices;
+
+// diffuse and specular of one light with the given radiance
+vec3 shade(vec3 norm, vec3 viewDir, vec3 lightDir, vec3 radiance, vec4 k)
+{
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), k.w);
+    return (k.y * diff + k.z * spec) * radiance;
+}
+
+void main()
+{
+    MaterialData material = materials[MaterialIndex];
+    vec3 objColor = mix(material.color.rgb, Tint.rgb, Tint.a);
+    vec4 k = material.coefficients; // ka, kd, ks, ns
+    vec3 norm = normalize(Normal);
+    vec3 viewDir = normalize(ViewPos - FragPos);
+
+    // the key light, as in source.fs
+    vec3 keyLight = lightColor.w * lightColor.rgb;
+    vec3 result = k.x * keyLight + shade(norm, viewDir, normalize(LightPos - FragPos), keyLight, k);
+
+    if (clusterCounts.w > 0u)
+    {
+        float depth = -(view * vec4(FragPos, 1.0)).z;
+        uvec3 cluster = uvec3(uvec2(gl_FragCoord.xy / clusterParams.xy), uint(max(log(depth) * clusterParams.z + clusterParams.w, 0.0)));
+        cluster = min(cluster, clusterCounts.xyz - 1u);
+        int index = int((cluster.z * clusterCounts.y + cluster.y) * clusterCounts.x + cluster.x);
+        uvec2 range = texelFetch(clusterLights, index).xy;
+        for (uint i = range.x; i < range.x + range.y; i++)
+        {
+            int light = int(texelFetch(lightIndices, int(i)).x);
+            vec4 positionRadius = texelFetch(lights, 2 * light);
+            vec3 toLight = positionRadius.xyz - FragPos;
+            float distance = length(toLight);
+            // falls smoothly to zero at the radius the clusters were built for
+            float falloff = clamp(1.0 - distance * distance / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+            vec3 radiance = texelFetch(lights, 2 * light + 1).rgb * falloff * falloff;
+            result += shade(norm, viewDir, toLight / max(distance, 1e-4), radiance, k);
+        }
+    }
+
+    FragColor = vec4(result * objColor, 1.0);
+}
@@ -0,0 +1,41 @@
+#version 330 core
+
+// clip-space position from the CPU transform; the object-space position
+// only feeds the lighting
+layout (location = 0) in vec4 aClipPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec3 aPos;
+layout (location = 10) in int aMaterialIndex; // constant per draw
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec3 LightPos;
+out vec3 ViewPos;
+out vec3 vertexColor;
+out vec4 Tint;
+flat out int MaterialIndex;
+// the depth pre-pass and the shaded pass must agree on every depth
+invariant gl_Position;
+
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPosition;
+    vec4 lightColor; // rgb, w = intensity
+    vec4 viewPosition;
+};
+
+uniform mat4 model;
+uniform mat3 normalMatrix; // transpose(inverse(mat3(model)))
+
+void main()
+{
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = normalMatrix * aNormal;
+    LightPos = lightPosition.xyz; // Light position in world space
+    ViewPos = viewPosition.xyz; // Camera position in world space
+    Tint = vec4(0.0); // instancing is a GPU-side feature
+    MaterialIndex = aMaterialIndex;
+    gl_Position = aClipPos;
+}
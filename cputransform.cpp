@@ -0,0 +1,161 @@
+#include "cputransform.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPUTRANSFORM_X86 1
+#endif
+
+using namespace std;
+
+namespace
+{
+    // vertices per task; a multiple of every batch width
+    const size_t TRANSFORM_BLOCK = 16384;
+    // SoA arrays are padded to whole batches
+    const size_t BATCH = 8;
+
+    typedef void (*TransformKernel)(const float *x, const float *y, const float *z, size_t begin, size_t end, const float *m, float *out);
+
+    void transformScalar(const float *x, const float *y, const float *z, size_t begin, size_t end, const float *m, float *out)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            float *o = out + i * 4;
+            o[0] = m[0] * x[i] + m[4] * y[i] + m[8] * z[i] + m[12];
+            o[1] = m[1] * x[i] + m[5] * y[i] + m[9] * z[i] + m[13];
+            o[2] = m[2] * x[i] + m[6] * y[i] + m[10] * z[i] + m[14];
+            o[3] = m[3] * x[i] + m[7] * y[i] + m[11] * z[i] + m[15];
+        }
+    }
+
+#ifdef CPUTRANSFORM_X86
+    // The output is written once and read by the GL, so stores bypass the
+    // cache when the destination allows it; mapped buffers are often
+    // write-combined memory where that matters most.
+    void transformSse(const float *x, const float *y, const float *z, size_t begin, size_t end, const float *m, float *out)
+    {
+        __m128 c[16];
+        for (int i = 0; i < 16; i++)
+            c[i] = _mm_set1_ps(m[i]);
+        bool aligned = ((uintptr_t)(out + begin * 4) & 15) == 0;
+        for (size_t i = begin; i < end; i += 4)
+        {
+            __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+            __m128 r[4];
+            for (int row = 0; row < 4; row++)
+            {
+                r[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[row], px), _mm_mul_ps(c[4 + row], py)),
+                                    _mm_add_ps(_mm_mul_ps(c[8 + row], pz), c[12 + row]));
+            }
+            // x x x x / y y y y / ... -> one vec4 per vertex
+            _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+            float *o = out + i * 4;
+            for (int v = 0; v < 4; v++)
+            {
+                if (aligned)
+                    _mm_stream_ps(o + v * 4, r[v]);
+                else
+                    _mm_storeu_ps(o + v * 4, r[v]);
+            }
+        }
+        _mm_sfence();
+    }
+
+    __attribute__((target("avx2,fma"))) void transformAvx2(const float *x, const float *y, const float *z, size_t begin, size_t end, const float *m, float *out)
+    {
+        __m256 c[16];
+        for (int i = 0; i < 16; i++)
+            c[i] = _mm256_set1_ps(m[i]);
+        bool aligned = ((uintptr_t)(out + begin * 4) & 31) == 0;
+        for (size_t i = begin; i < end; i += 8)
+        {
+            __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+            __m256 r[4];
+            for (int row = 0; row < 4; row++)
+                r[row] = _mm256_fmadd_ps(c[row], px, _mm256_fmadd_ps(c[4 + row], py, _mm256_fmadd_ps(c[8 + row], pz, c[12 + row])));
+
+            // 8 x, y, z, w -> 8 vec4s: transpose 4x4 within each 128-bit
+            // half, then put vertices 0-3 before vertices 4-7
+            __m256 xy0 = _mm256_unpacklo_ps(r[0], r[1]);
+            __m256 xy1 = _mm256_unpackhi_ps(r[0], r[1]);
+            __m256 zw0 = _mm256_unpacklo_ps(r[2], r[3]);
+            __m256 zw1 = _mm256_unpackhi_ps(r[2], r[3]);
+            __m256 v0 = _mm256_shuffle_ps(xy0, zw0, _MM_SHUFFLE(1, 0, 1, 0)); // vertices 0, 4
+            __m256 v1 = _mm256_shuffle_ps(xy0, zw0, _MM_SHUFFLE(3, 2, 3, 2)); // 1, 5
+            __m256 v2 = _mm256_shuffle_ps(xy1, zw1, _MM_SHUFFLE(1, 0, 1, 0)); // 2, 6
+            __m256 v3 = _mm256_shuffle_ps(xy1, zw1, _MM_SHUFFLE(3, 2, 3, 2)); // 3, 7
+            __m256 o[4] = {
+                _mm256_permute2f128_ps(v0, v1, 0x20),
+                _mm256_permute2f128_ps(v2, v3, 0x20),
+                _mm256_permute2f128_ps(v0, v1, 0x31),
+                _mm256_permute2f128_ps(v2, v3, 0x31)};
+            float *dst = out + i * 4;
+            for (int k = 0; k < 4; k++)
+            {
+                if (aligned)
+                    _mm256_stream_ps(dst + k * 8, o[k]);
+                else
+                    _mm256_storeu_ps(dst + k * 8, o[k]);
+            }
+        }
+        _mm_sfence();
+    }
+#endif
+
+    const TransformKernel kernels[3] = {
+        transformScalar,
+#ifdef CPUTRANSFORM_X86
+        transformSse,
+        transformAvx2,
+#endif
+    };
+}
+
+CpuTransform::CpuTransform(unsigned int numThreads)
+    : pool(numThreads)
+{
+#ifdef CPUTRANSFORM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        level = 2;
+    else if (__builtin_cpu_supports("sse2"))
+        level = 1;
+#endif
+}
+
+void CpuTransform::setPositions(const float *vertices, size_t numVertices, size_t stride)
+{
+    count = numVertices;
+    size_t padded = (numVertices + BATCH - 1) / BATCH * BATCH;
+    xs.assign(padded, 0.0f);
+    ys.assign(padded, 0.0f);
+    zs.assign(padded, 0.0f);
+    for (size_t i = 0; i < numVertices; i++)
+    {
+        const float *v = vertices + i * stride;
+        xs[i] = v[0];
+        ys[i] = v[1];
+        zs[i] = v[2];
+    }
+}
+
+void CpuTransform::transform(const glm::mat4 &mvp, float *out)
+{
+    TransformKernel kernel = kernels[level];
+    const float *m = &mvp[0][0];
+    size_t padded = xs.size();
+    pool.parallelFor((padded + TRANSFORM_BLOCK - 1) / TRANSFORM_BLOCK, [&](size_t block) {
+        size_t begin = block * TRANSFORM_BLOCK;
+        size_t end = min(padded, begin + TRANSFORM_BLOCK);
+        kernel(xs.data(), ys.data(), zs.data(), begin, end, m, out);
+    });
+}
+
+const char *CpuTransform::instructionSet() const
+{
+    const char *const names[3] = {"scalar", "SSE", "AVX2"};
+    return names[level];
+}
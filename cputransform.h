@@ -0,0 +1,44 @@
+#ifndef CPUTRANSFORM_H
+#define CPUTRANSFORM_H
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "threadpool.h"
+
+// Transforms mesh positions to clip space on the CPU. Positions are kept as
+// separate x, y and z arrays so a batch of 8 (AVX2) or 4 (SSE) vertices
+// loads with one instruction per component. The batches are spread over a
+// thread pool and written out as vec4s, ready to be streamed into a mapped
+// vertex buffer. The instruction set is picked at run time.
+class CpuTransform
+{
+public:
+    // numThreads == 0 uses one thread per hardware thread
+    explicit CpuTransform(unsigned int numThreads = 0);
+
+    CpuTransform(const CpuTransform &) = delete;
+    CpuTransform &operator=(const CpuTransform &) = delete;
+
+    // copies the positions out of interleaved vertices, stride in floats
+    void setPositions(const float *vertices, size_t numVertices, size_t stride);
+
+    size_t numVertices() const { return count; }
+    // the output holds this many vec4s; the tail past numVertices is padding
+    size_t paddedVertices() const { return xs.size(); }
+
+    // out[i] = mvp * vec4(position[i], 1) for every padded vertex
+    void transform(const glm::mat4 &mvp, float *out);
+
+    const char *instructionSet() const;
+    unsigned int numThreads() const { return pool.size(); }
+
+private:
+    ThreadPool pool;
+    std::vector<float> xs, ys, zs;
+    size_t count = 0;
+    int level = 0; // 0 scalar, 1 SSE, 2 AVX2
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "culling.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+    // items per leaf; small leaves cull tighter, large ones walk faster
+    const uint32_t LEAF_SIZE = 4;
+    // subtrees handed to the pool per thread, so uneven subtrees even out
+    const size_t TASKS_PER_THREAD = 4;
+}
+
+Aabb transformBox(const glm::mat4 &transform, const Aabb &box)
+{
+    // center and extent form: the new extent is |M| * extent
+    glm::vec3 center = glm::vec3(transform * glm::vec4(box.center(), 1.0f));
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+    glm::vec3 newExtent(0.0f);
+    for (int column = 0; column < 3; column++)
+        newExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+    return Aabb(center - newExtent, center + newExtent);
+}
+
+Frustum extractFrustum(const glm::mat4 &m)
+{
+    // rows of the matrix; a clip-space point is inside when -w <= x, y, z <= w
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0]; // left
+    frustum.planes[1] = row[3] - row[0]; // right
+    frustum.planes[2] = row[3] + row[1]; // bottom
+    frustum.planes[3] = row[3] - row[1]; // top
+    frustum.planes[4] = row[3] + row[2]; // near
+    frustum.planes[5] = row[3] - row[2]; // far
+    return frustum;
+}
+
+Containment classify(const Frustum &frustum, const Aabb &box)
+{
+    // the planes are not normalized: only the signs matter
+    glm::vec3 center = box.center();
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+    Containment result = INSIDE;
+    for (const glm::vec4 &plane : frustum.planes)
+    {
+        glm::vec3 normal(plane);
+        float distance = glm::dot(normal, center) + plane.w;
+        float radius = glm::dot(glm::abs(normal), extent);
+        if (distance + radius < 0.0f)
+            return OUTSIDE;
+        if (distance - radius < 0.0f)
+            result = INTERSECTING;
+    }
+    return result;
+}
+
+void Bvh::build(const vector<Aabb> &boxes)
+{
+    clear();
+    if (boxes.empty())
+        return;
+    items.resize(boxes.size());
+    for (size_t i = 0; i < items.size(); i++)
+        items[i] = (uint32_t)i;
+    nodes.reserve(2 * boxes.size() / LEAF_SIZE + 1);
+    buildNode(boxes, 0, (uint32_t)items.size());
+    itemBoxes.resize(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+        itemBoxes[i] = boxes[items[i]];
+}
+
+void Bvh::clear()
+{
+    nodes.clear();
+    items.clear();
+    itemBoxes.clear();
+}
+
+uint32_t Bvh::buildNode(const vector<Aabb> &boxes, uint32_t first, uint32_t count)
+{
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back(Node());
+    Aabb bounds = boxes[items[first]];
+    Aabb centers(bounds.center(), bounds.center());
+    for (uint32_t i = first + 1; i < first + count; i++)
+    {
+        const Aabb &box = boxes[items[i]];
+        bounds.grow(box);
+        centers.grow(Aabb(box.center(), box.center()));
+    }
+
+    Node node;
+    node.bounds = bounds;
+    node.first = first;
+    node.count = count;
+    node.secondChild = 0;
+    glm::vec3 spread = centers.max - centers.min;
+    if (count > LEAF_SIZE && (spread.x > 0.0f || spread.y > 0.0f || spread.z > 0.0f))
+    {
+        // split at the median center along the axis the centers spread most
+        int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : (spread.y >= spread.z ? 1 : 2);
+        uint32_t half = count / 2;
+        nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+                    [&](uint32_t a, uint32_t b) { return boxes[a].center()[axis] < boxes[b].center()[axis]; });
+        buildNode(boxes, first, half);
+        node.secondChild = buildNode(boxes, first + half, count - half);
+    }
+    nodes[index] = node;
+    return index;
+}
+
+size_t Bvh::cullNode(uint32_t index, const Frustum &frustum, vector<uint32_t> &visible) const
+{
+    const Node &node = nodes[index];
+    Containment containment = classify(frustum, node.bounds);
+    if (containment == OUTSIDE)
+        return 1;
+    if (containment == INSIDE)
+    {
+        visible.insert(visible.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+        return 1;
+    }
+    if (node.secondChild == 0)
+    {
+        // a leaf on the boundary: test its items one by one
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            if (classify(frustum, itemBoxes[i]) != OUTSIDE)
+                visible.push_back(items[i]);
+        }
+        return 1 + node.count;
+    }
+    return 1 + cullNode(index + 1, frustum, visible) + cullNode(node.secondChild, frustum, visible);
+}
+
+size_t Bvh::cull(const Frustum &frustum, ThreadPool &pool, vector<uint32_t> &visible) const
+{
+    visible.clear();
+    if (nodes.empty())
+        return 0;
+
+    // Open up the top of the tree until there are enough subtrees to spread
+    // out. The frontier stays in tree order, so the output order is fixed.
+    // Nodes above it are not tested; that costs a few box tests per frame.
+    size_t wanted = pool.size() > 1 ? pool.size() * TASKS_PER_THREAD : 1;
+    vector<uint32_t> frontier(1, 0);
+    while (frontier.size() < wanted)
+    {
+        vector<uint32_t> next;
+        for (uint32_t node : frontier)
+        {
+            if (nodes[node].secondChild != 0)
+            {
+                next.push_back(node + 1);
+                next.push_back(nodes[node].secondChild);
+            }
+            else
+                next.push_back(node);
+        }
+        if (next.size() == frontier.size())
+            break;
+        frontier.swap(next);
+    }
+
+    vector<vector<uint32_t>> results(frontier.size());
+    vector<size_t> tested(frontier.size(), 0);
+    pool.parallelFor(frontier.size(), [&](size_t task) {
+        tested[task] = cullNode(frontier[task], frustum, results[task]);
+    });
+
+    size_t totalTested = 0, total = 0;
+    for (size_t task = 0; task < frontier.size(); task++)
+    {
+        totalTested += tested[task];
+        total += results[task].size();
+    }
+    visible.reserve(total);
+    for (const vector<uint32_t> &result : results)
+        visible.insert(visible.end(), result.begin(), result.end());
+    return totalTested;
+}
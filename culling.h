@@ -0,0 +1,95 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "threadpool.h"
+
+struct Aabb
+{
+    glm::vec3 min = glm::vec3(0.0f), max = glm::vec3(0.0f);
+
+    Aabb() {}
+    Aabb(const glm::vec3 &a, const glm::vec3 &b) : min(a), max(b) {}
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    void grow(const Aabb &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+};
+
+// box around box after transform, from its eight corners
+Aabb transformBox(const glm::mat4 &transform, const Aabb &box);
+
+// The six planes (a, b, c, d) of the clip volume of a matrix, with
+// a * x + b * y + c * z + d >= 0 inside. Taken from projection * view *
+// model, they are in the space of whatever that model matrix transforms.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+Frustum extractFrustum(const glm::mat4 &clipFromObject);
+
+enum Containment
+{
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE
+};
+
+Containment classify(const Frustum &frustum, const Aabb &box);
+
+// what the last cull did; triangles are weighted by the caller's counts
+struct CullStats
+{
+    size_t objects = 0, culledObjects = 0;
+    size_t triangles = 0, culledTriangles = 0; // at full detail
+    size_t drawnTriangles = 0;                 // after LOD selection
+    size_t boxesTested = 0;
+};
+
+// Bounding volume hierarchy over a fixed set of boxes (items), built once by
+// median splits along the widest axis. Culling walks it top-down: subtrees
+// outside the frustum are skipped, subtrees inside it are taken whole, and
+// the upper levels are split into tasks so the rest of the walk runs on a
+// thread pool.
+class Bvh
+{
+public:
+    void build(const std::vector<Aabb> &boxes);
+    void clear();
+
+    size_t numItems() const { return items.size(); }
+    size_t numNodes() const { return nodes.size(); }
+
+    // Writes the indices of the items whose boxes touch the frustum to
+    // visible, in a fixed order for a given frustum. Returns the number of
+    // boxes tested.
+    size_t cull(const Frustum &frustum, ThreadPool &pool, std::vector<uint32_t> &visible) const;
+
+private:
+    // A subtree's items are items[first, first + count). Inner nodes have
+    // their children at this node + 1 and at secondChild; leaves have
+    // secondChild 0, which no child can be.
+    struct Node
+    {
+        Aabb bounds;
+        uint32_t first, count;
+        uint32_t secondChild;
+    };
+
+    uint32_t buildNode(const std::vector<Aabb> &boxes, uint32_t first, uint32_t count);
+    size_t cullNode(uint32_t node, const Frustum &frustum, std::vector<uint32_t> &visible) const;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> items; // item indices in leaf order
+    std::vector<Aabb> itemBoxes; // their boxes, in the same order
+};
+
+#endif
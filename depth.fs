@@ -0,0 +1,7 @@
+#version 330 core
+
+// Depth pre-pass: color writes are off, so only the depth test matters.
+// Paired with source.vs or cpu.vs, whose other outputs go unused.
+void main()
+{
+}
@@ -0,0 +1,89 @@
+#include "directorywatcher.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+DirectoryWatcher::DirectoryWatcher(function<void()> onChange) : onChange(std::move(onChange))
+{
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+        return;
+    if (pipe2(stopPipe, O_CLOEXEC) != 0)
+    {
+        ::close(inotifyFd);
+        inotifyFd = -1;
+        return;
+    }
+    thread = std::thread(&DirectoryWatcher::run, this);
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+    if (inotifyFd < 0)
+        return;
+    char stop = 0;
+    if (write(stopPipe[1], &stop, 1) != 1)
+    {
+        // a closed pipe wakes the thread as well
+        ::close(stopPipe[1]);
+        stopPipe[1] = -1;
+    }
+    thread.join();
+    ::close(inotifyFd);
+    ::close(stopPipe[0]);
+    ::close(stopPipe[1]);
+}
+
+bool DirectoryWatcher::watchFileDirectory(const string &filename)
+{
+    if (inotifyFd < 0)
+        return false;
+    // saving in place closes the file, saving through a rename moves it in,
+    // and touch only changes its attributes; all three change the mtime
+    auto watchDirectory = [this](const string &path) {
+        size_t slash = path.find_last_of('/');
+        string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        return inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB) >= 0;
+    };
+    if (!watchDirectory(filename))
+        return false;
+    // a symlinked file is edited where it points to
+    char *target = realpath(filename.c_str(), NULL);
+    if (target == NULL)
+        return true;
+    bool ok = watchDirectory(target);
+    free(target);
+    return ok;
+}
+
+void DirectoryWatcher::run()
+{
+    alignas(inotify_event) char events[4096];
+    pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents != 0)
+            return;
+        // what changed is for the owner to find out; one call per batch
+        bool any = false;
+        while (read(inotifyFd, events, sizeof(events)) > 0)
+            any = true;
+        if (any)
+        {
+            changed = true;
+            onChange();
+        }
+    }
+}
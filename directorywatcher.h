@@ -0,0 +1,40 @@
+#ifndef DIRECTORYWATCHER_H
+#define DIRECTORYWATCHER_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Reports, through inotify, when a file in a watched directory is written,
+// replaced or touched, so a loop can sleep until then instead of polling
+// modification times. A thread waits for the events and calls onChange for
+// each batch; the owner checks which of its files actually changed.
+class DirectoryWatcher
+{
+public:
+    // onChange runs on the watcher's thread
+    explicit DirectoryWatcher(std::function<void()> onChange);
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher &) = delete;
+    DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+    // watches the directory filename lies in; false if it cannot be watched
+    bool watchFileDirectory(const std::string &filename);
+    // false when inotify is not available: nothing will ever be reported
+    bool isActive() const { return inotifyFd >= 0; }
+    // whether anything changed since the last call
+    bool takeChanged() { return changed.exchange(false); }
+
+private:
+    void run();
+
+    std::function<void()> onChange;
+    int inotifyFd = -1;
+    int stopPipe[2] = {-1, -1};
+    std::atomic<bool> changed{false};
+    std::thread thread;
+};
+
+#endif
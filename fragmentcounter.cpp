@@ -0,0 +1,107 @@
+#include "fragmentcounter.h"
+
+using namespace std;
+
+void reportFragments(ostream &out, const char *name, const FragmentStats &stats)
+{
+    if (stats.frames == 0)
+        return;
+    auto perFrame = [&stats](uint64_t total) { return (total + stats.frames / 2) / stats.frames; };
+    uint64_t saved = stats.rasterized > stats.shaded ? stats.rasterized - stats.shaded : 0;
+    out << name << ", average of " << stats.frames << " frames: " << perFrame(stats.rasterized)
+        << " fragments passed the depth test, " << perFrame(stats.shaded) << " were shaded, "
+        << perFrame(saved) << " (" << (stats.rasterized > 0 ? 100.0 * saved / stats.rasterized : 0.0)
+        << "%) hidden fragments not shaded" << endl;
+}
+
+void FragmentCounter::init()
+{
+    glGenQueries(QUERY_RING_SIZE * NUM_FRAGMENT_PASSES, &queries[0][0]);
+    queryHead = 0;
+    queryPending = 0;
+    frameActive = passActive = false;
+}
+
+void FragmentCounter::release()
+{
+    if (queries[0][0] == 0)
+        return;
+    if (passActive)
+        endPass();
+    if (frameActive)
+        endFrame();
+    collect(true);
+    glDeleteQueries(QUERY_RING_SIZE * NUM_FRAGMENT_PASSES, &queries[0][0]);
+    for (GLuint(&frame)[NUM_FRAGMENT_PASSES] : queries)
+    {
+        for (GLuint &query : frame)
+            query = 0;
+    }
+}
+
+void FragmentCounter::beginFrame()
+{
+    if (queries[0][0] == 0)
+        return;
+    // a full ring skips the frame rather than wait for the oldest one
+    collect(false);
+    if (queryPending == QUERY_RING_SIZE)
+        return;
+    for (bool &pass : used[queryHead])
+        pass = false;
+    frameActive = true;
+}
+
+void FragmentCounter::beginPass(FragmentPass pass)
+{
+    if (!frameActive)
+        return;
+    glBeginQuery(GL_SAMPLES_PASSED, queries[queryHead][pass]);
+    used[queryHead][pass] = true;
+    passActive = true;
+}
+
+void FragmentCounter::endPass()
+{
+    if (!passActive)
+        return;
+    glEndQuery(GL_SAMPLES_PASSED);
+    passActive = false;
+}
+
+void FragmentCounter::endFrame()
+{
+    if (!frameActive)
+        return;
+    frameActive = false;
+    queryHead = (queryHead + 1) % QUERY_RING_SIZE;
+    queryPending++;
+}
+
+// reads finished frames oldest first; with wait, blocks for all of them
+void FragmentCounter::collect(bool wait)
+{
+    while (queryPending > 0)
+    {
+        int frame = (queryHead - queryPending + QUERY_RING_SIZE) % QUERY_RING_SIZE;
+        // the shaded pass ends last, so its result is the last to arrive
+        FragmentPass last = used[frame][PASS_SHADE] ? PASS_SHADE : PASS_DEPTH;
+        if (!wait && used[frame][last])
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[frame][last], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+        }
+        GLuint64 samples[NUM_FRAGMENT_PASSES] = {};
+        for (int pass = 0; pass < NUM_FRAGMENT_PASSES; pass++)
+        {
+            if (used[frame][pass])
+                glGetQueryObjectui64v(queries[frame][pass], GL_QUERY_RESULT, &samples[pass]);
+        }
+        queryPending--;
+        totals.frames++;
+        totals.rasterized += used[frame][PASS_DEPTH] ? samples[PASS_DEPTH] : samples[PASS_SHADE];
+        totals.shaded += samples[PASS_SHADE];
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef FRAGMENTCOUNTER_H
+#define FRAGMENTCOUNTER_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <ostream>
+
+// Fragments that passed the depth test, summed over the frames counted.
+// rasterized is what shading every fragment as its triangle comes would
+// shade, overdraw included; shaded is what the shading actually ran for.
+// The two are the same when nothing resolves visibility first.
+struct FragmentStats
+{
+    size_t frames = 0;
+    uint64_t rasterized = 0, shaded = 0;
+};
+
+// per frame averages and the share of shading that was saved
+void reportFragments(std::ostream &out, const char *name, const FragmentStats &stats);
+
+enum FragmentPass
+{
+    PASS_DEPTH, // depth-only pre-pass: every fragment that passes GL_LESS
+    PASS_SHADE, // the shaded pass
+    NUM_FRAGMENT_PASSES
+};
+
+// Counts the fragments of each pass with GL_SAMPLES_PASSED queries, kept
+// in a small ring like FrameTimer's and read only once available, so the
+// counts never stall the pipeline.
+class FragmentCounter
+{
+public:
+    FragmentCounter() {}
+    FragmentCounter(const FragmentCounter &) = delete;
+    FragmentCounter &operator=(const FragmentCounter &) = delete;
+
+    // creates the query ring; needs a current context
+    void init();
+    // collects outstanding queries and deletes them; needs the context
+    void release();
+
+    // bracket one frame's passes, each pass at most once; a frame without
+    // a depth pass counts its shaded fragments as rasterized too
+    void beginFrame();
+    void beginPass(FragmentPass pass);
+    void endPass();
+    void endFrame();
+
+    const FragmentStats &stats() const { return totals; }
+
+private:
+    static const int QUERY_RING_SIZE = 8;
+
+    void collect(bool wait);
+
+    GLuint queries[QUERY_RING_SIZE][NUM_FRAGMENT_PASSES] = {};
+    bool used[QUERY_RING_SIZE][NUM_FRAGMENT_PASSES] = {};
+    int queryHead = 0;    // next frame to issue
+    int queryPending = 0; // issued but not yet read, oldest at head - pending
+    bool frameActive = false, passActive = false;
+    FragmentStats totals;
+};
+
+#endif
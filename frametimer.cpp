@@ -0,0 +1,243 @@
+#include "frametimer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+    const char *const phaseNames[NUM_FRAME_PHASES] = {
+        "input",
+        "load",
+        "upload",
+        "draw",
+        "present",
+    };
+
+    const int HISTOGRAM_BUCKETS = 20;
+
+    struct TimeStats
+    {
+        size_t count = 0;
+        double min = 0.0, mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+        // HISTOGRAM_BUCKETS equal buckets over [0, max]
+        vector<size_t> histogram;
+    };
+
+    // nearest-rank percentile of sorted values
+    double percentile(const vector<double> &sorted, double p)
+    {
+        size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+        return sorted[rank == 0 ? 0 : rank - 1];
+    }
+
+    TimeStats computeStats(const vector<double> &times)
+    {
+        TimeStats stats;
+        stats.count = times.size();
+        if (times.empty())
+            return stats;
+        vector<double> sorted = times;
+        sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (double t : sorted)
+            sum += t;
+        stats.min = sorted.front();
+        stats.max = sorted.back();
+        stats.mean = sum / sorted.size();
+        stats.p50 = percentile(sorted, 50.0);
+        stats.p95 = percentile(sorted, 95.0);
+        stats.p99 = percentile(sorted, 99.0);
+
+        stats.histogram.assign(HISTOGRAM_BUCKETS, 0);
+        for (double t : sorted)
+        {
+            int bucket = stats.max > 0.0 ? (int)(t / stats.max * HISTOGRAM_BUCKETS) : 0;
+            stats.histogram[min(bucket, HISTOGRAM_BUCKETS - 1)]++;
+        }
+        return stats;
+    }
+
+    bool allZero(const vector<double> &times)
+    {
+        return all_of(times.begin(), times.end(), [](double t) { return t == 0.0; });
+    }
+
+    void printStats(ostream &out, const char *name, const TimeStats &stats)
+    {
+        out << "  " << left << setw(8) << name << right << fixed << setprecision(3)
+            << setw(9) << stats.min << setw(9) << stats.mean << setw(9) << stats.p50
+            << setw(9) << stats.p95 << setw(9) << stats.p99 << setw(9) << stats.max << "\n";
+    }
+
+    void writeStats(ostream &out, const TimeStats &stats)
+    {
+        out << "{\"count\": " << stats.count << ", \"min\": " << stats.min << ", \"mean\": " << stats.mean
+            << ", \"p50\": " << stats.p50 << ", \"p95\": " << stats.p95 << ", \"p99\": " << stats.p99
+            << ", \"max\": " << stats.max << ", \"histogramBucketMs\": " << stats.max / HISTOGRAM_BUCKETS
+            << ", \"histogram\": [";
+        for (size_t i = 0; i < stats.histogram.size(); i++)
+            out << (i ? ", " : "") << stats.histogram[i];
+        out << "]}";
+    }
+}
+
+void FrameTimer::init()
+{
+    glGenQueries(QUERY_RING_SIZE, queries);
+    queryHead = 0;
+    queryPending = 0;
+    queryActive = false;
+}
+
+void FrameTimer::release()
+{
+    if (queries[0] == 0)
+        return;
+    if (queryActive)
+        endGpu();
+    collect(true);
+    glDeleteQueries(QUERY_RING_SIZE, queries);
+    for (GLuint &query : queries)
+        query = 0;
+}
+
+void FrameTimer::beginFrame()
+{
+    frameStart = Clock::now();
+    phaseStart = frameStart;
+    if (!started)
+    {
+        firstFrame = frameStart;
+        started = true;
+    }
+    for (vector<double> &times : phaseTimes)
+        times.push_back(0.0);
+}
+
+void FrameTimer::mark(FramePhase phase)
+{
+    Clock::time_point now = Clock::now();
+    phaseTimes[phase].back() += chrono::duration<double, milli>(now - phaseStart).count();
+    phaseStart = now;
+}
+
+void FrameTimer::endFrame()
+{
+    lastFrame = Clock::now();
+    frameTimes.push_back(chrono::duration<double, milli>(lastFrame - frameStart).count());
+    collect(false);
+}
+
+void FrameTimer::discardFrame()
+{
+    for (vector<double> &times : phaseTimes)
+        times.pop_back();
+}
+
+void FrameTimer::beginGpu()
+{
+    if (queries[0] == 0)
+        return;
+    // the ring is full of results the GPU has not finished: skip this frame
+    // rather than wait for the oldest one
+    collect(false);
+    if (queryPending == QUERY_RING_SIZE)
+    {
+        droppedGpuFrames++;
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, queries[queryHead]);
+    queryActive = true;
+}
+
+void FrameTimer::endGpu()
+{
+    if (!queryActive)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    queryActive = false;
+    queryHead = (queryHead + 1) % QUERY_RING_SIZE;
+    queryPending++;
+}
+
+// reads finished queries oldest first; with wait, blocks for all of them
+void FrameTimer::collect(bool wait)
+{
+    while (queryPending > 0)
+    {
+        GLuint query = queries[(queryHead - queryPending + QUERY_RING_SIZE) % QUERY_RING_SIZE];
+        if (!wait)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        queryPending--;
+        // some drivers (llvmpipe) return a raw timestamp for the very first
+        // query; no frame can take longer on the GPU than we have been running
+        double milliseconds = nanoseconds / 1.0e6;
+        if (milliseconds > chrono::duration<double, milli>(Clock::now() - firstFrame).count())
+            droppedGpuFrames++;
+        else
+            gpuTimes.push_back(milliseconds);
+    }
+}
+
+double FrameTimer::elapsedSeconds() const
+{
+    if (frameTimes.empty())
+        return 0.0;
+    return chrono::duration<double>(lastFrame - firstFrame).count();
+}
+
+void FrameTimer::report(ostream &out) const
+{
+    if (frameTimes.empty())
+        return;
+    out << "frame times (ms) over " << frameTimes.size() << " frames:\n"
+        << "  " << left << setw(8) << "" << right
+        << setw(9) << "min" << setw(9) << "mean" << setw(9) << "p50"
+        << setw(9) << "p95" << setw(9) << "p99" << setw(9) << "max" << "\n";
+    printStats(out, "frame", computeStats(frameTimes));
+    for (int i = 0; i < NUM_FRAME_PHASES; i++)
+    {
+        if (!allZero(phaseTimes[i]))
+            printStats(out, phaseNames[i], computeStats(phaseTimes[i]));
+    }
+    if (!gpuTimes.empty())
+        printStats(out, "gpu", computeStats(gpuTimes));
+    if (droppedGpuFrames > 0)
+        out << "  " << droppedGpuFrames << " frames without a GPU time (query ring full or invalid result)\n";
+    out << defaultfloat << flush;
+}
+
+bool FrameTimer::writeJson(const string &filename) const
+{
+    ofstream out(filename);
+    if (!out.is_open())
+    {
+        cerr << "Failed to write " << filename << endl;
+        return false;
+    }
+    out << setprecision(6);
+    out << "{\n  \"frames\": " << frameTimes.size() << ",\n  \"seconds\": " << elapsedSeconds()
+        << ",\n  \"droppedGpuFrames\": " << droppedGpuFrames << ",\n  \"frame\": ";
+    writeStats(out, computeStats(frameTimes));
+    for (int i = 0; i < NUM_FRAME_PHASES; i++)
+    {
+        out << ",\n  \"" << phaseNames[i] << "\": ";
+        writeStats(out, computeStats(phaseTimes[i]));
+    }
+    out << ",\n  \"gpu\": ";
+    writeStats(out, computeStats(gpuTimes));
+    out << "\n}\n";
+    return out.good();
+}
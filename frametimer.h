@@ -0,0 +1,75 @@
+#ifndef FRAMETIMER_H
+#define FRAMETIMER_H
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// CPU phases of one frame, in the order they run
+enum FramePhase
+{
+    PHASE_INPUT,   // event handling and camera update
+    PHASE_LOAD,    // uploading batches of a model that is still loading
+    PHASE_UPLOAD,  // uniform block and per-draw uniforms
+    PHASE_DRAW,    // clear and draw call submission
+    PHASE_PRESENT, // buffer swap, or readback and handing the image to the encoders
+    NUM_FRAME_PHASES
+};
+
+// Records CPU time per phase and GPU time per frame. GPU time comes from
+// GL_TIME_ELAPSED queries kept in a small ring; a result is only read once
+// the GPU reports it available, so timing never stalls the pipeline.
+class FrameTimer
+{
+public:
+    FrameTimer() {}
+    FrameTimer(const FrameTimer &) = delete;
+    FrameTimer &operator=(const FrameTimer &) = delete;
+
+    // creates the query ring; needs a current context
+    void init();
+    // collects outstanding queries and deletes them; needs the context
+    void release();
+
+    void beginFrame();
+    // ends the running phase: the time since the previous mark goes to phase
+    void mark(FramePhase phase);
+    void endFrame();
+    // forgets the frame begun last, for a loop pass that drew nothing
+    void discardFrame();
+
+    // bracket the GPU work of a frame; not nestable
+    void beginGpu();
+    void endGpu();
+
+    size_t numFrames() const { return frameTimes.size(); }
+    double elapsedSeconds() const;
+
+    // min/mean/p50/p95/p99/max per phase, per frame and for the GPU, in ms
+    void report(std::ostream &out) const;
+    bool writeJson(const std::string &filename) const;
+
+private:
+    static const int QUERY_RING_SIZE = 8;
+
+    void collect(bool wait);
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point firstFrame, lastFrame, frameStart, phaseStart;
+    bool started = false;
+
+    GLuint queries[QUERY_RING_SIZE] = {};
+    int queryHead = 0;    // next query to issue
+    int queryPending = 0; // issued but not yet read, oldest at head - pending
+    bool queryActive = false;
+    size_t droppedGpuFrames = 0; // ring full or result unusable
+
+    std::vector<double> phaseTimes[NUM_FRAME_PHASES];
+    std::vector<double> frameTimes;
+    std::vector<double> gpuTimes;
+};
+
+#endif
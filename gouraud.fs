@@ -3,32 +3,54 @@ out vec4 FragColor;
 
 in vec3 FragPos;
 in vec3 Normal;
+in vec4 Tint; // rgb, a = how much of the material color it replaces
 
-uniform vec3 objColor;
-uniform vec3 lightPosition;
-uniform vec3 lightColor;
-uniform float lightIntensity;
-uniform float ka;
-uniform float kd;
-uniform float ks;
-uniform float ns;
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPosition;
+    vec4 lightColor; // rgb, w = intensity
+    vec4 viewPosition;
+};
+
+struct MaterialData
+{
+    vec4 color;        // rgb
+    vec4 coefficients; // ka, kd, ks, ns
+};
+
+#define MAX_MATERIALS 512
+layout (std140) uniform Materials
+{
+    MaterialData materials[MAX_MATERIALS];
+};
+flat in int MaterialIndex; // from the draw, see source.vs
 
 void main()
 {
+    MaterialData material = materials[MaterialIndex];
+    vec3 objColor = mix(material.color.rgb, Tint.rgb, Tint.a);
+    float ka = material.coefficients.x;
+    float kd = material.coefficients.y;
+    float ks = material.coefficients.z;
+    float ns = material.coefficients.w;
+    float lightIntensity = lightColor.w;
+
     // Ambient lighting
-    vec3 ambient = ka * lightIntensity * lightColor;
+    vec3 ambient = ka * lightIntensity * lightColor.rgb;
 
     // Diffuse lighting
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPosition - FragPos);
+    vec3 lightDir = normalize(lightPosition.xyz - FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = kd * diff * lightIntensity * lightColor;
+    vec3 diffuse = kd * diff * lightIntensity * lightColor.rgb;
 
     // Specular lighting
     vec3 viewDir = normalize(-FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), ns);
-    vec3 specular = ks * spec * lightIntensity * lightColor;  
+    vec3 specular = ks * spec * lightIntensity * lightColor.rgb;  
 
     // Combine lighting components
     vec3 result = (ambient + diffuse + specular) * objColor;
@@ -0,0 +1,42 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Fast non-cryptographic 64-bit hash for detecting changed file contents.
+// Four independent lanes keep the multiplies pipelined on large inputs.
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0)
+{
+    const uint64_t prime1 = 0x9e3779b185ebca87ull;
+    const uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t lanes[4] = {seed + prime1, seed + prime2, seed, seed - prime1};
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            uint64_t word;
+            memcpy(&word, p + i + k * 8, 8);
+            lanes[k] += word * prime2;
+            lanes[k] = (lanes[k] << 31) | (lanes[k] >> 33);
+            lanes[k] *= prime1;
+        }
+    }
+
+    uint64_t h = size;
+    for (int k = 0; k < 4; k++)
+        h = (h ^ lanes[k]) * prime1 + prime2;
+    for (; i < size; i++)
+        h = (h ^ p[i]) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    return h;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#include "headless.h"
+
+// keep eglplatform.h from pulling in Xlib, whose macros clash with ours
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+    bool hasExtension(const char *extensions, const char *name)
+    {
+        if (extensions == NULL)
+            return false;
+        size_t length = strlen(name);
+        for (const char *p = strstr(extensions, name); p != NULL; p = strstr(p + length, name))
+        {
+            if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+                return true;
+        }
+        return false;
+    }
+
+    // The surfaceless platform needs neither X, Wayland nor a GPU device node.
+    // Without it fall back to the default display, which drivers such as
+    // NVIDIA's also serve headlessly.
+    EGLDisplay openDisplay()
+    {
+        const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+        {
+            PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if (getPlatformDisplay != NULL)
+            {
+                EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+                if (display != EGL_NO_DISPLAY)
+                    return display;
+            }
+        }
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    // GL returns the bottom row first
+    void copyFlipped(const unsigned char *pixels, int width, int height, vector<unsigned char> &rgb)
+    {
+        size_t rowBytes = (size_t)width * 3;
+        rgb.resize(rowBytes * height);
+        for (int y = 0; y < height; y++)
+            memcpy(rgb.data() + y * rowBytes, pixels + (height - 1 - y) * rowBytes, rowBytes);
+    }
+}
+
+bool HeadlessContext::create(int width, int height)
+{
+    release();
+
+    EGLDisplay eglDisplay = openDisplay();
+    EGLint major, minor;
+    if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+    {
+        cerr << "headless: no EGL display" << endl;
+        return false;
+    }
+    display = eglDisplay;
+    if (!hasExtension(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context") ||
+        !eglBindAPI(EGL_OPENGL_API))
+    {
+        cerr << "headless: EGL " << major << "." << minor << " cannot make a desktop GL context current without a surface" << endl;
+        release();
+        return false;
+    }
+
+    // the framebuffer object brings its own attachments, so the config only
+    // has to support desktop GL
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE};
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &numConfigs) || numConfigs == 0)
+    {
+        cerr << "headless: no EGL config for desktop GL" << endl;
+        release();
+        return false;
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE};
+    EGLContext eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (eglContext == EGL_NO_CONTEXT)
+    {
+        cerr << "headless: failed to create an OpenGL 3.3 core context" << endl;
+        release();
+        return false;
+    }
+    context = eglContext;
+    if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+    {
+        cerr << "headless: failed to make the context current" << endl;
+        release();
+        return false;
+    }
+
+    // GLEW builds for GLX report a missing X display after it has loaded the
+    // GL entry points; that is expected here
+    glewExperimental = GL_TRUE;
+    GLenum glewError = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (glewError == GLEW_ERROR_NO_GLX_DISPLAY)
+        glewError = GLEW_OK;
+#endif
+    if (glewError != GLEW_OK)
+    {
+        cerr << "headless: glewInit failed (" << glewError << ")" << endl;
+        release();
+        return false;
+    }
+
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cerr << "headless: " << width << "x" << height << " framebuffer is incomplete" << endl;
+        release();
+        return false;
+    }
+    glViewport(0, 0, width, height);
+    frameWidth = width;
+    frameHeight = height;
+
+    glGenBuffers(READBACK_RING_SIZE, readbackBuffers);
+    for (GLuint buffer : readbackBuffers)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 3, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readbackHead = readbackPending = 0;
+
+    cout << "headless: " << glGetString(GL_RENDERER) << ", OpenGL " << glGetString(GL_VERSION)
+         << ", " << width << "x" << height << endl;
+    return true;
+}
+
+void HeadlessContext::release()
+{
+    if (display == nullptr)
+        return;
+    if (context != nullptr)
+    {
+        if (readbackBuffers[0] != 0)
+        {
+            for (GLsync &fence : readbackFences)
+            {
+                if (fence != 0)
+                    glDeleteSync(fence);
+                fence = 0;
+            }
+            glDeleteBuffers(READBACK_RING_SIZE, readbackBuffers);
+        }
+        if (framebuffer != 0)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(2, renderbuffers);
+        }
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+    }
+    eglTerminate(display);
+    display = nullptr;
+    context = nullptr;
+    framebuffer = 0;
+    renderbuffers[0] = renderbuffers[1] = 0;
+    for (GLuint &buffer : readbackBuffers)
+        buffer = 0;
+    readbackHead = readbackPending = 0;
+    frameWidth = frameHeight = 0;
+}
+
+void HeadlessContext::startReadback()
+{
+    if (readbackPending == READBACK_RING_SIZE)
+        return;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[readbackHead]);
+    // with a pack buffer bound the pointer is an offset into it, and the
+    // copy is queued behind the frame's draws instead of waiting for them
+    glReadPixels(0, 0, frameWidth, frameHeight, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readbackFences[readbackHead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readbackHead = (readbackHead + 1) % READBACK_RING_SIZE;
+    readbackPending++;
+}
+
+bool HeadlessContext::finishReadback(vector<unsigned char> &rgb, bool wait)
+{
+    if (readbackPending == 0)
+        return false;
+    int oldest = (readbackHead - readbackPending + READBACK_RING_SIZE) % READBACK_RING_SIZE;
+    GLsync &fence = readbackFences[oldest];
+    // flushing on the first wait makes sure the fence reaches the GPU
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (wait && status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(fence, 0, 1000000000);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    glDeleteSync(fence);
+    fence = 0;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[oldest]);
+    const unsigned char *pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)frameWidth * frameHeight * 3, GL_MAP_READ_BIT);
+    if (pixels != NULL)
+    {
+        copyFlipped(pixels, frameWidth, frameHeight, rgb);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else
+    {
+        cerr << "headless: failed to map a readback buffer" << endl;
+        rgb.assign((size_t)frameWidth * frameHeight * 3, 0);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readbackPending--;
+    return true;
+}
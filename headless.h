@@ -0,0 +1,54 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+// An OpenGL 3.3 core context without a window or display server. EGL is
+// opened on Mesa's surfaceless platform, which runs on llvmpipe when there is
+// no GPU, and frames are rendered into a framebuffer object of a fixed size.
+class HeadlessContext
+{
+public:
+    HeadlessContext() {}
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+    ~HeadlessContext() { release(); }
+
+    // Creates the context, makes it current and binds a width x height
+    // framebuffer with color and depth attachments. Errors are printed.
+    bool create(int width, int height);
+    void release();
+
+    int width() const { return frameWidth; }
+    int height() const { return frameHeight; }
+
+    // Frame readback through a ring of pixel buffer objects. startReadback
+    // queues a copy of the frame into the next buffer and returns without
+    // waiting for rendering; finishReadback hands the oldest copy back as
+    // RGB, top row first, once the GPU has written it, so the frames in
+    // between keep the GPU busy. The ring must not be full.
+    void startReadback();
+    // false if no readback is pending or, without wait, the oldest is not
+    // done yet
+    bool finishReadback(std::vector<unsigned char> &rgb, bool wait);
+    int pendingReadbacks() const { return readbackPending; }
+    bool readbackRingFull() const { return readbackPending == READBACK_RING_SIZE; }
+
+private:
+    static const int READBACK_RING_SIZE = 3;
+
+    // EGLDisplay/EGLContext, kept opaque so EGL headers stay out of here
+    void *display = nullptr;
+    void *context = nullptr;
+    GLuint framebuffer = 0;
+    GLuint renderbuffers[2] = {0, 0};
+    int frameWidth = 0, frameHeight = 0;
+    GLuint readbackBuffers[READBACK_RING_SIZE] = {};
+    GLsync readbackFences[READBACK_RING_SIZE] = {};
+    int readbackHead = 0;    // next buffer to read into
+    int readbackPending = 0; // started but not finished, oldest at head - pending
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "imagewriter.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+    void putBigEndian(vector<unsigned char> &out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((unsigned char)(value >> shift));
+    }
+
+    // length, type, data, CRC of type and data
+    void putChunk(vector<unsigned char> &png, const char *type, const unsigned char *data, size_t size)
+    {
+        putBigEndian(png, (uint32_t)size);
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data, data + size);
+        putBigEndian(png, (uint32_t)crc32(0, png.data() + start, (uInt)(size + 4)));
+    }
+
+    bool writeFile(const string &filename, const unsigned char *header, size_t headerSize, const vector<unsigned char> &data)
+    {
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (file == NULL)
+        {
+            cerr << "Failed to write " << filename << endl;
+            return false;
+        }
+        bool ok = fwrite(header, 1, headerSize, file) == headerSize;
+        ok = ok && fwrite(data.data(), 1, data.size(), file) == data.size();
+        ok = fclose(file) == 0 && ok;
+        if (!ok)
+            cerr << "Failed to write " << filename << endl;
+        return ok;
+    }
+}
+
+bool writePpm(const string &filename, int width, int height, const vector<unsigned char> &rgb)
+{
+    char header[32];
+    int headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    return writeFile(filename, (const unsigned char *)header, headerSize, rgb);
+}
+
+bool writePng(const string &filename, int width, int height, const vector<unsigned char> &rgb)
+{
+    // every row filtered as the difference to the pixel on its left, which
+    // turns the flat background of a render into runs of zeros
+    size_t rowBytes = (size_t)width * 3;
+    vector<unsigned char> filtered((rowBytes + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char *row = rgb.data() + y * rowBytes;
+        unsigned char *out = filtered.data() + y * (rowBytes + 1);
+        out[0] = 1; // Sub
+        copy(row, row + min<size_t>(rowBytes, 3), out + 1);
+        for (size_t i = 3; i < rowBytes; i++)
+            out[1 + i] = (unsigned char)(row[i] - row[i - 3]);
+    }
+    uLongf deflatedSize = compressBound((uLong)filtered.size());
+    vector<unsigned char> deflated(deflatedSize);
+    if (compress2(deflated.data(), &deflatedSize, filtered.data(), (uLong)filtered.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        cerr << "Failed to compress " << filename << endl;
+        return false;
+    }
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    vector<unsigned char> header;
+    putBigEndian(header, (uint32_t)width);
+    putBigEndian(header, (uint32_t)height);
+    // 8 bits per channel, RGB, deflate, adaptive filtering, not interlaced
+    const unsigned char format[5] = {8, 2, 0, 0, 0};
+    header.insert(header.end(), format, format + 5);
+    vector<unsigned char> png;
+    putChunk(png, "IHDR", header.data(), header.size());
+    putChunk(png, "IDAT", deflated.data(), deflatedSize);
+    putChunk(png, "IEND", NULL, 0);
+    return writeFile(filename, signature, sizeof(signature), png);
+}
+
+bool writeImage(const string &filename, int width, int height, const vector<unsigned char> &rgb)
+{
+    string extension = filename.size() >= 4 ? filename.substr(filename.size() - 4) : "";
+    transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+    if (extension == ".png")
+        return writePng(filename, width, height, rgb);
+    return writePpm(filename, width, height, rgb);
+}
+
+ImageWriter::ImageWriter(unsigned int numThreads, size_t maxQueued)
+{
+    if (numThreads == 0)
+        numThreads = thread::hardware_concurrency();
+    if (numThreads == 0)
+        numThreads = 1;
+    this->maxQueued = maxQueued > 0 ? maxQueued : numThreads * 2;
+    for (unsigned int i = 0; i < numThreads; i++)
+        workers.emplace_back(&ImageWriter::workerLoop, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread &worker : workers)
+        worker.join();
+}
+
+void ImageWriter::submit(const string &filename, int width, int height, vector<unsigned char> &rgb)
+{
+    Image image;
+    image.filename = filename;
+    image.width = width;
+    image.height = height;
+    image.rgb.swap(rgb);
+
+    unique_lock<mutex> lock(queueMutex);
+    if (queue.size() >= maxQueued)
+    {
+        auto start = chrono::steady_clock::now();
+        space.wait(lock, [this] { return queue.size() < maxQueued; });
+        submitSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    queue.push_back(move(image));
+    if (!spareBuffers.empty())
+    {
+        rgb.swap(spareBuffers.back());
+        spareBuffers.pop_back();
+    }
+    lock.unlock();
+    wake.notify_one();
+}
+
+bool ImageWriter::finish()
+{
+    unique_lock<mutex> lock(queueMutex);
+    space.wait(lock, [this] { return queue.empty() && busyWorkers == 0; });
+    return !failed;
+}
+
+size_t ImageWriter::written() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return imagesWritten;
+}
+
+double ImageWriter::busySeconds() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return workerSeconds;
+}
+
+double ImageWriter::blockedSeconds() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return submitSeconds;
+}
+
+void ImageWriter::workerLoop()
+{
+    unique_lock<mutex> lock(queueMutex);
+    for (;;)
+    {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        // the queue is drained before stopping, so nothing submitted is lost
+        if (queue.empty())
+            return;
+        Image image = move(queue.front());
+        queue.pop_front();
+        busyWorkers++;
+        lock.unlock();
+        space.notify_all();
+
+        auto start = chrono::steady_clock::now();
+        bool ok = writeImage(image.filename, image.width, image.height, image.rgb);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        busyWorkers--;
+        workerSeconds += seconds;
+        if (ok)
+            imagesWritten++;
+        else
+            failed = true;
+        spareBuffers.push_back(move(image.rgb));
+        space.notify_all();
+    }
+}
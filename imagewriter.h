@@ -0,0 +1,73 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes an RGB image, top row first, as a binary PPM.
+bool writePpm(const std::string &filename, int width, int height, const std::vector<unsigned char> &rgb);
+// The same as an 8-bit RGB PNG, deflated with zlib.
+bool writePng(const std::string &filename, int width, int height, const std::vector<unsigned char> &rgb);
+// PNG for a .png extension, whatever its case, PPM otherwise.
+bool writeImage(const std::string &filename, int width, int height, const std::vector<unsigned char> &rgb);
+
+// Encodes and writes images on worker threads while the caller renders the
+// next ones. Images are written in any order, each to its own file. At most
+// maxQueued wait for a worker: submit blocks beyond that, so a slow encoder
+// or disk holds rendering back instead of filling memory with frames.
+class ImageWriter
+{
+public:
+    // numThreads == 0 uses one thread per hardware thread; maxQueued == 0
+    // allows two images per thread
+    explicit ImageWriter(unsigned int numThreads = 0, size_t maxQueued = 0);
+    // writes what is still queued
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    // Queues rgb for writeImage. The pixels are taken over: rgb comes back
+    // holding a buffer of an image written earlier, to fill again.
+    void submit(const std::string &filename, int width, int height, std::vector<unsigned char> &rgb);
+    // waits until everything submitted is written; false if any write failed
+    bool finish();
+
+    unsigned int numThreads() const { return (unsigned int)workers.size(); }
+    // images whose write succeeded
+    size_t written() const;
+    // encoding and writing, summed over the workers
+    double busySeconds() const;
+    // time submit spent waiting for room in the queue
+    double blockedSeconds() const;
+
+private:
+    struct Image
+    {
+        std::string filename;
+        int width = 0, height = 0;
+        std::vector<unsigned char> rgb;
+    };
+
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    mutable std::mutex queueMutex;
+    std::condition_variable wake;  // an image was queued, or stopping
+    std::condition_variable space; // an image was taken or finished
+    std::deque<Image> queue;
+    std::vector<std::vector<unsigned char>> spareBuffers;
+    size_t maxQueued;
+    size_t busyWorkers = 0;
+    size_t imagesWritten = 0;
+    bool failed = false;
+    bool stopping = false;
+    double workerSeconds = 0.0, submitSeconds = 0.0;
+};
+
+#endif
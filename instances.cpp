@@ -0,0 +1,67 @@
+#include "instances.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+InstanceData identityInstance()
+{
+    InstanceData instance;
+    instance.model = glm::mat4(1.0f);
+    instance.normalMatrix = glm::mat3(1.0f);
+    instance.tint = glm::vec4(0.0f);
+    return instance;
+}
+
+void meshBounds(const MeshBuffers &mesh, glm::vec3 &boundsMin, glm::vec3 &boundsMax)
+{
+    boundsMin = glm::vec3(0.0f);
+    boundsMax = glm::vec3(0.0f);
+    for (size_t i = 0; i < mesh.submeshes.size(); i++)
+    {
+        const SubMesh &submesh = mesh.submeshes[i];
+        boundsMin = i == 0 ? submesh.boundsMin : glm::min(boundsMin, submesh.boundsMin);
+        boundsMax = i == 0 ? submesh.boundsMax : glm::max(boundsMax, submesh.boundsMax);
+    }
+}
+
+vector<InstanceData> makeInstanceGrid(size_t count, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, unsigned int seed)
+{
+    vector<InstanceData> instances(count);
+    if (count == 0)
+        return instances;
+
+    size_t columns = (size_t)ceil(sqrt((double)count));
+    size_t rows = (count + columns - 1) / columns;
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    glm::vec3 size = boundsMax - boundsMin;
+    // a cell is as large as the copy may get when turned about Y
+    float cell = max(max(size.x, size.z) * 1.42f, size.y);
+    if (cell <= 0.0f)
+        cell = 1.0f;
+    float gridSize = max(size.x, size.y);
+    float scale = (gridSize > 0.0f ? gridSize : cell) / (cell * columns);
+
+    mt19937 random(seed);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (size_t i = 0; i < count; i++)
+    {
+        float column = (float)(i % columns) - (columns - 1) * 0.5f;
+        float row = (float)(i / columns) - (rows - 1) * 0.5f;
+        glm::vec3 offset = center + glm::vec3(column, row, 0.0f) * (cell * scale);
+
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), offset);
+        model = glm::rotate(model, unit(random) * 6.2831853f, glm::vec3(0.0f, 1.0f, 0.0f));
+        model = glm::scale(model, glm::vec3(scale));
+        model = glm::translate(model, -center);
+
+        InstanceData &instance = instances[i];
+        instance.model = model;
+        instance.normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        instance.tint = glm::vec4(unit(random), unit(random), unit(random), 0.5f);
+    }
+    return instances;
+}
@@ -0,0 +1,30 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "meshcache.h"
+
+// Per-instance vertex attributes, uploaded as they are into the instance
+// buffer and read by source.vs at locations 2-9.
+struct InstanceData
+{
+    glm::mat4 model;
+    glm::mat3 normalMatrix; // transpose(inverse(mat3(model)))
+    glm::vec4 tint;         // rgb, a = how much of the material color it replaces
+};
+
+// The single copy drawn when no instances are set: identity, no tint.
+InstanceData identityInstance();
+
+// Object-space bounding box of all submeshes.
+void meshBounds(const MeshBuffers &mesh, glm::vec3 &boundsMin, glm::vec3 &boundsMax);
+
+// Lays count copies out on a square grid in the XY plane, scaled down so the
+// whole grid covers the box of a single copy. Every copy gets a random turn
+// about Y and a random tint, repeatable for the same seed.
+std::vector<InstanceData> makeInstanceGrid(size_t count, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, unsigned int seed = 1);
+
+#endif
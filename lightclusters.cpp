@@ -0,0 +1,154 @@
+#include "lightclusters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace std;
+
+namespace
+{
+    const size_t TILES_PER_SLICE = LightClusters::CLUSTERS_X * LightClusters::CLUSTERS_Y;
+
+    // The tiles along one screen axis that a view-space extent [low, high]
+    // can project to anywhere between depths near and far. False if none.
+    bool tileRange(float low, float high, float nearDepth, float farDepth, float project, int numTiles, int &first, int &last)
+    {
+        float ndcLow = min(low / nearDepth, low / farDepth) * project;
+        float ndcHigh = max(high / nearDepth, high / farDepth) * project;
+        if (ndcHigh < -1.0f || ndcLow > 1.0f)
+            return false;
+        first = min(max((int)floor((ndcLow + 1.0f) * 0.5f * numTiles), 0), numTiles - 1);
+        last = min(max((int)floor((ndcHigh + 1.0f) * 0.5f * numTiles), 0), numTiles - 1);
+        return true;
+    }
+
+    // view-space extent of tile i along one axis, over depths near to far
+    void tileExtent(int i, int numTiles, float nearDepth, float farDepth, float project, float &low, float &high)
+    {
+        float ndcLow = -1.0f + 2.0f * i / numTiles, ndcHigh = -1.0f + 2.0f * (i + 1) / numTiles;
+        low = min(ndcLow * nearDepth, ndcLow * farDepth) / project;
+        high = max(ndcHigh * nearDepth, ndcHigh * farDepth) / project;
+    }
+
+    float distanceToRange(float v, float low, float high)
+    {
+        return v < low ? low - v : (v > high ? v - high : 0.0f);
+    }
+}
+
+vector<PointLight> makePointLights(size_t count, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, unsigned int seed)
+{
+    vector<PointLight> lights(count);
+    glm::vec3 size = boundsMax - boundsMin;
+    // together the spheres fill the box a few times over, however many
+    float radius = max(glm::length(size), 1e-3f) * 0.75f / cbrt((float)max<size_t>(count, 1));
+
+    mt19937 random(seed);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (PointLight &light : lights)
+    {
+        // a little outside the box too, so the edges are lit like the middle
+        glm::vec3 t(unit(random), unit(random), unit(random));
+        light.position = boundsMin - size * 0.1f + t * size * 1.2f;
+        light.radius = radius * (0.5f + unit(random));
+        // a saturated hue
+        float hue = unit(random) * 6.0f;
+        light.color = glm::clamp(glm::vec3(fabs(hue - 3.0f) - 1.0f, 2.0f - fabs(hue - 2.0f), 2.0f - fabs(hue - 4.0f)), 0.0f, 1.0f);
+        light.intensity = 1.0f;
+    }
+    return lights;
+}
+
+LightClusters::LightClusters(unsigned int numThreads) : pool(numThreads), slices(CLUSTERS_Z)
+{
+}
+
+void LightClusters::assign(const vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, size_t maxIndices)
+{
+    viewLights.resize(lights.size());
+    for (size_t i = 0; i < lights.size(); i++)
+        viewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(lights[i].position, 1.0f)), lights[i].radius);
+
+    // the near and far plane of a glm::perspective matrix
+    projectX = projection[0][0];
+    projectY = projection[1][1];
+    nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+    farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+    depthScale = CLUSTERS_Z / log(farPlane / nearPlane);
+    depthBias = -log(nearPlane) * depthScale;
+
+    pool.parallelFor(CLUSTERS_Z, [&](size_t slice) { assignSlice(slice); });
+
+    // slices one after another, each already sorted by cluster
+    clusterRanges.resize(NUM_CLUSTERS * 2);
+    lightIndices.clear();
+    overflowed = false;
+    for (size_t s = 0; s < CLUSTERS_Z; s++)
+    {
+        const Slice &slice = slices[s];
+        size_t base = lightIndices.size();
+        size_t kept = min(slice.indices.size(), maxIndices - base);
+        overflowed = overflowed || kept < slice.indices.size();
+        lightIndices.insert(lightIndices.end(), slice.indices.begin(), slice.indices.begin() + kept);
+        size_t first = 0;
+        for (size_t tile = 0; tile < TILES_PER_SLICE; tile++)
+        {
+            size_t cluster = s * TILES_PER_SLICE + tile;
+            size_t count = slice.counts[tile];
+            clusterRanges[cluster * 2] = (uint32_t)(base + min(first, kept));
+            clusterRanges[cluster * 2 + 1] = (uint32_t)(min(first + count, kept) - min(first, kept));
+            first += count;
+        }
+    }
+}
+
+void LightClusters::assignSlice(size_t s)
+{
+    Slice &slice = slices[s];
+    slice.pairClusters.clear();
+    slice.pairLights.clear();
+    float sliceNear = nearPlane * pow(farPlane / nearPlane, (float)s / CLUSTERS_Z);
+    float sliceFar = nearPlane * pow(farPlane / nearPlane, (float)(s + 1) / CLUSTERS_Z);
+
+    for (size_t i = 0; i < viewLights.size(); i++)
+    {
+        const glm::vec4 &light = viewLights[i];
+        float depth = -light.z, radius = light.w;
+        if (depth + radius < sliceNear || depth - radius > sliceFar)
+            continue;
+        float nearDepth = max(sliceNear, depth - radius), farDepth = min(sliceFar, depth + radius);
+        int x0, x1, y0, y1;
+        if (!tileRange(light.x - radius, light.x + radius, nearDepth, farDepth, projectX, CLUSTERS_X, x0, x1) ||
+            !tileRange(light.y - radius, light.y + radius, nearDepth, farDepth, projectY, CLUSTERS_Y, y0, y1))
+            continue;
+
+        float dz = distanceToRange(depth, sliceNear, sliceFar);
+        for (int y = y0; y <= y1; y++)
+        {
+            float low, high;
+            tileExtent(y, CLUSTERS_Y, sliceNear, sliceFar, projectY, low, high);
+            float dy = distanceToRange(light.y, low, high);
+            for (int x = x0; x <= x1; x++)
+            {
+                tileExtent(x, CLUSTERS_X, sliceNear, sliceFar, projectX, low, high);
+                float dx = distanceToRange(light.x, low, high);
+                if (dx * dx + dy * dy + dz * dz > radius * radius)
+                    continue;
+                slice.pairClusters.push_back((uint32_t)(y * CLUSTERS_X + x));
+                slice.pairLights.push_back((uint32_t)i);
+            }
+        }
+    }
+
+    // counting sort by cluster, lights in order within each
+    slice.counts.assign(TILES_PER_SLICE, 0);
+    for (uint32_t tile : slice.pairClusters)
+        slice.counts[tile]++;
+    vector<uint32_t> next(TILES_PER_SLICE, 0);
+    for (size_t tile = 1; tile < TILES_PER_SLICE; tile++)
+        next[tile] = next[tile - 1] + slice.counts[tile - 1];
+    slice.indices.resize(slice.pairLights.size());
+    for (size_t i = 0; i < slice.pairLights.size(); i++)
+        slice.indices[next[slice.pairClusters[i]]++] = slice.pairLights[i];
+}
@@ -0,0 +1,81 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "threadpool.h"
+
+// A point light besides the key light. Its contribution fades to nothing at
+// radius, so it only needs to reach the clusters its sphere touches.
+struct PointLight
+{
+    glm::vec3 position; // world space
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// count lights scattered through the box, with random hues and radii sized
+// so that a few of them overlap anywhere; repeatable for the same seed
+std::vector<PointLight> makePointLights(size_t count, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, unsigned int seed = 1);
+
+// Splits the view frustum into a grid of clusters, CLUSTERS_X by CLUSTERS_Y
+// screen tiles by CLUSTERS_Z depth slices spaced exponentially between the
+// near and far plane, and lists the lights whose spheres touch each one.
+// clustered.fs finds its fragment's cluster from gl_FragCoord and view
+// depth, so it only evaluates those lights.
+//
+// Assignment runs one depth slice per task: a slice keeps the lights that
+// overlap its depth range, narrows each to the tiles its sphere can project
+// to and tests those clusters' view-space boxes exactly.
+class LightClusters
+{
+public:
+    static const unsigned int CLUSTERS_X = 16, CLUSTERS_Y = 16, CLUSTERS_Z = 24;
+    static const size_t NUM_CLUSTERS = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+    // numThreads == 0 uses one thread per hardware thread
+    explicit LightClusters(unsigned int numThreads = 0);
+
+    LightClusters(const LightClusters &) = delete;
+    LightClusters &operator=(const LightClusters &) = delete;
+
+    // Fills clusters() and indices() for the view, and a symmetric
+    // perspective projection such as glm::perspective. At most maxIndices
+    // entries are listed; clusters past that lose their lights.
+    void assign(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, size_t maxIndices);
+
+    // per cluster, x fastest then y then slice: first entry in indices()
+    // and number of lights
+    const std::vector<uint32_t> &clusters() const { return clusterRanges; }
+    const std::vector<uint32_t> &indices() const { return lightIndices; }
+    // slice = log(view depth) * scale + bias, floored
+    float sliceScale() const { return depthScale; }
+    float sliceBias() const { return depthBias; }
+    bool truncated() const { return overflowed; }
+    unsigned int numThreads() const { return pool.size(); }
+
+private:
+    // the (cluster in slice, light) pairs of one slice, then sorted by cluster
+    struct Slice
+    {
+        std::vector<uint32_t> pairClusters, pairLights;
+        std::vector<uint32_t> counts, indices;
+    };
+
+    void assignSlice(size_t slice);
+
+    ThreadPool pool;
+    std::vector<glm::vec4> viewLights; // view-space center, radius
+    float projectX = 1.0f, projectY = 1.0f; // projection[0][0] and [1][1]
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    float depthScale = 0.0f, depthBias = 0.0f;
+    std::vector<Slice> slices;
+    std::vector<uint32_t> clusterRanges, lightIndices;
+    bool overflowed = false;
+};
+
+#endif
@@ -3,97 +3,735 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <sstream>
+#include <cstdio>
+#include <thread>
 #include <glm/glm.hpp>
 #include "glm/gtc/matrix_transform.hpp"
 #include <glm/gtc/type_ptr.hpp>
+#include "directorywatcher.h"
+#include "frametimer.h"
+#include "headless.h"
+#include "imagewriter.h"
+#include "renderer.h"
+#include "softrenderer.h"
+#include "thumbnails.h"
 using namespace std;
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
+void window_refresh_callback(GLFWwindow *window);
 void processInput(GLFWwindow *window, glm::mat4 &projection);
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
-void loadOBJ(const std::string &filename, std::vector<glm::vec3> &vertices, std::vector<glm::vec3> &colors, std::vector<unsigned int> &indices);
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 800;
+// thumbnail size when --size is not given
+const unsigned int THUMBNAIL_SIZE = 256;
 
-struct Material
+// window or framebuffer size, set from the command line
+unsigned int scrWidth = SCR_WIDTH;
+unsigned int scrHeight = SCR_HEIGHT;
+
+float userScaleFactor = 1.0f;
+float rotX = 0.0f;
+float rotY = 0.0f;
+float rotZ = 0.0f;
+glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 10.0f);
+glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
+glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+float cameraSpeed = 0.5f;
+Light light = Light(glm::vec3(3.0f, -1.0f, 3.0f), glm::vec3(1.0f), 1.0f);
+
+// fragment shaders --shading and the Tab key choose from, as NAME.fs
+const char *const SHADINGS[] = {"source", "phong", "gouraud", "flat", "clustered"};
+// the one that draws the point lights of --lights
+const int CLUSTERED_SHADING = 4;
+const int NUM_SHADINGS = sizeof(SHADINGS) / sizeof(SHADINGS[0]);
+// Tab presses not yet applied; the key callback has no renderer to switch
+int shadingSteps = 0;
+// P presses not yet applied, each toggling the depth pre-pass
+int prepassToggles = 0;
+// seconds between checks of the shader files for hot reload, when inotify
+// cannot tell the window about edits
+const double SHADER_RELOAD_INTERVAL = 0.5;
+// set by the window callbacks when the last frame no longer fills the
+// window as it is, for the render-on-demand loop
+bool windowDamaged = true;
+
+struct Options
+{
+    string objFilename = "data/pawn.obj";
+    string sceneFilename; // manifest of models to place, instead of objFilename
+    bool headless = false;
+    bool software = false;
+    bool cpuTransform = false;
+    int transformBenchmark = 0;  // iterations, 0 = off
+    unsigned int numThreads = 0; // software renderer, CPU transform and culling, 0 = all hardware threads
+    size_t numInstances = 1;     // copies of the model drawn in a grid
+    bool culling = true;         // frustum culling of instances and submeshes
+    float lodError = 1.0f;       // pixels of simplification error allowed, 0 = full detail only
+    bool quantize = false;       // 16-bit positions and octahedral normals in the vertex buffer
+    float quantizeError = 1e-4f; // position error allowed, as a fraction of the bounds' diagonal
+    size_t streamBudget = 0;     // loader memory in bytes when streaming the OBJ, 0 = load it whole
+    string loadMode;             // "sync" or "async"; empty = async with a window, sync headless
+    int shading = -1;            // index into SHADINGS, -1 = source, or clustered with lights
+    size_t numLights = 0;        // point lights around the scene, besides the key light
+    bool multiDraw = true;       // one indirect multi-draw per frame where GL supports it
+    bool depthPrepass = false;   // depth-only pass first, then shade with GL_EQUAL
+    bool countFragments = false; // occlusion queries per pass; on with the pre-pass
+    // window only
+    bool onDemand = true;        // redraw only when something on screen changed
+    float maxFps = 0.0f;         // frame rate cap, 0 = none
+    int swapInterval = -1;       // 1 = vsync, 0 = off, -1 = the driver's default
+    // directory of linked program binaries, "" = compile every time
+    string shaderCache = "shadercache";
+    glm::vec3 cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
+    // headless only
+    int numFrames = 1;
+    float spin = 0.0f; // degrees around Y between frames
+    string output = "frame.ppm";
+    unsigned int numEncoders = 0; // image encoding threads, 0 = all hardware threads
+    // thumbnails only
+    string thumbnailSource; // directory or list of OBJs, "" = not making thumbnails
+    string thumbnailDir = "thumbnails";
+    unsigned int numLoaders = 0; // OBJ parsing threads, 0 = all hardware threads
+    string statsJson; // frame time statistics, written at exit if set
+};
+
+void printUsage(const char *program)
+{
+    cout << "usage: " << program << " [model.obj] [options]\n"
+         << "  --scene FILE        draw the objects a manifest places, one per line:\n"
+         << "                      model.obj x y z [scale [degrees about Y]]\n"
+         << "  --headless          render offscreen through EGL, no window or display needed\n"
+         << "  --software          render on the CPU without OpenGL; implies --headless\n"
+         << "  --cpu-transform     transform vertices on the CPU (SIMD, threaded) into a mapped buffer\n"
+         << "  --transform-bench N compare GPU and CPU vertex transform over N passes at startup\n"
+         << "  --threads N         software renderer, CPU transform and culling threads (default: all)\n"
+         << "  --instances N       draw N copies of the model on a grid with one instanced draw\n"
+         << "  --no-cull           submit everything instead of frustum culling on the CPU\n"
+         << "  --lod-error PIXELS  screen error allowed when picking a simplified LOD (default 1, 0 = off)\n"
+         << "  --quantize          12 byte vertices: 16-bit positions and octahedral normals\n"
+         << "  --quantize-error F  position error allowed, as a fraction of the model's size (default 1e-4);\n"
+         << "                      floats are kept when 16 bits cannot meet it\n"
+         << "  --stream MB         stream the OBJ into the GPU buffers within MB of loader memory,\n"
+         << "                      bypassing the mesh cache; for models larger than RAM. Outside the\n"
+         << "                      budget: 40 bytes per 64 KB chunk of the OBJ, under 1 MB per GB,\n"
+         << "                      and positions and normals spilled to $TMPDIR (default /tmp)\n"
+         << "  --load sync|async   load the model before the first frame, or on a worker thread\n"
+         << "                      while drawing what has arrived (default: async with a window)\n"
+         << "  --shading NAME      fragment shader: source, phong, gouraud, flat or clustered\n"
+         << "                      (default source, clustered with --lights);\n"
+         << "                      Tab switches to the next one in the window\n"
+         << "  --lights N          N point lights around the scene, assigned to view-space\n"
+         << "                      clusters on the CPU every frame for --shading clustered\n"
+         << "  --shader-cache DIR  where linked shader binaries are kept (default shadercache)\n"
+         << "  --no-shader-cache   compile the shaders from source every time\n"
+         << "  --no-multi-draw     one draw per submesh and LOD level instead of a single\n"
+         << "                      glMultiDrawElementsIndirect per frame\n"
+         << "  --depth-prepass     lay down depth first, then shade only the visible fragments;\n"
+         << "                      P toggles it in the window\n"
+         << "  --count-fragments   count depth-tested and shaded fragments per frame\n"
+         << "                      (implied by --depth-prepass)\n"
+         << "  --redraw MODE       window: on-demand (default) waits for input and redraws only\n"
+         << "                      when the picture changes; continuous redraws every frame\n"
+         << "  --fps N             window: at most N frames per second (default: no cap)\n"
+         << "  --vsync on|off      window: sync buffer swaps to the display refresh\n"
+         << "  --size WxH          framebuffer size (default " << SCR_WIDTH << "x" << SCR_HEIGHT << ")\n"
+         << "  --camera X,Y,Z      camera position (default 0,0,10)\n"
+         << "  --target X,Y,Z      point the camera looks at (default 0,0,0)\n"
+         << "  --frames N          headless: number of frames to render (default 1)\n"
+         << "  --spin DEGREES      headless: model rotation about Y between frames\n"
+         << "  --turntable N       headless: N frames once around the model; sets --frames and --spin\n"
+         << "  --output FILE       headless: image to write, PNG for .png and PPM otherwise; with\n"
+         << "                      several frames the frame number is added before the extension\n"
+         << "  --encoders N        headless: threads encoding images while rendering goes on\n"
+         << "                      (default: all)\n"
+         << "  --thumbnails SOURCE render a PNG of every OBJ below a directory, or listed one per\n"
+         << "                      line in a file, with one headless context; "
+         << THUMBNAIL_SIZE << "x" << THUMBNAIL_SIZE << " unless --size\n"
+         << "  --thumbnail-dir DIR where the thumbnails go (default thumbnails)\n"
+         << "  --loaders N         thumbnails: threads parsing OBJs (default: all)\n"
+         << "  --stats-json FILE   write frame time statistics as JSON at exit" << endl;
+}
+
+bool parseVec3(const char *text, glm::vec3 &v)
+{
+    return sscanf(text, "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+// Fills options and the camera globals; prints usage and returns false on
+// anything it does not understand.
+bool parseOptions(int argc, char **argv, Options &options)
 {
-    glm::vec3 color;
-    float kd, ks, ka, ns;
-    string name;
-    Material()
+    bool haveModel = false, haveSize = false;
+    for (int i = 1; i < argc; i++)
     {
-        color = glm::vec3(0.0f);
-        kd = 0.0f;
-        ks = 0.0f;
-        ka = 0.0f;
-        ns = 0.0f;
+        string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool ok = true;
+        if (arg == "--headless")
+            options.headless = true;
+        else if (arg == "--software")
+            options.software = options.headless = true;
+        else if (arg == "--cpu-transform")
+            options.cpuTransform = true;
+        else if (arg == "--transform-bench" && value != NULL)
+            ok = sscanf(argv[++i], "%d", &options.transformBenchmark) == 1 && options.transformBenchmark > 0;
+        else if (arg == "--threads" && value != NULL)
+            ok = sscanf(argv[++i], "%u", &options.numThreads) == 1;
+        else if (arg == "--instances" && value != NULL)
+            ok = sscanf(argv[++i], "%zu", &options.numInstances) == 1 && options.numInstances > 0;
+        else if (arg == "--no-cull")
+            options.culling = false;
+        else if (arg == "--lod-error" && value != NULL)
+            ok = sscanf(argv[++i], "%f", &options.lodError) == 1 && options.lodError >= 0.0f;
+        else if (arg == "--quantize")
+            options.quantize = true;
+        else if (arg == "--quantize-error" && value != NULL)
+            ok = sscanf(argv[++i], "%f", &options.quantizeError) == 1 && options.quantizeError > 0.0f;
+        else if (arg == "--stream" && value != NULL)
+        {
+            size_t megabytes = 0;
+            ok = sscanf(argv[++i], "%zu", &megabytes) == 1 && megabytes > 0;
+            options.streamBudget = megabytes << 20;
+        }
+        else if (arg == "--load" && value != NULL)
+        {
+            options.loadMode = argv[++i];
+            ok = options.loadMode == "sync" || options.loadMode == "async";
+        }
+        else if (arg == "--shading" && value != NULL)
+        {
+            string name = argv[++i];
+            options.shading = -1;
+            for (int k = 0; k < NUM_SHADINGS; k++)
+            {
+                if (name == SHADINGS[k])
+                    options.shading = k;
+            }
+            ok = options.shading >= 0;
+        }
+        else if (arg == "--redraw" && value != NULL)
+        {
+            string mode = argv[++i];
+            options.onDemand = mode == "on-demand";
+            ok = options.onDemand || mode == "continuous";
+        }
+        else if (arg == "--fps" && value != NULL)
+            ok = sscanf(argv[++i], "%f", &options.maxFps) == 1 && options.maxFps >= 0.0f;
+        else if (arg == "--vsync" && value != NULL)
+        {
+            string mode = argv[++i];
+            options.swapInterval = mode == "on" ? 1 : 0;
+            ok = mode == "on" || mode == "off";
+        }
+        else if (arg == "--lights" && value != NULL)
+            ok = sscanf(argv[++i], "%zu", &options.numLights) == 1;
+        else if (arg == "--scene" && value != NULL)
+            options.sceneFilename = argv[++i];
+        else if (arg == "--no-multi-draw")
+            options.multiDraw = false;
+        else if (arg == "--depth-prepass")
+            options.depthPrepass = options.countFragments = true;
+        else if (arg == "--count-fragments")
+            options.countFragments = true;
+        else if (arg == "--shader-cache" && value != NULL)
+            options.shaderCache = argv[++i];
+        else if (arg == "--no-shader-cache")
+            options.shaderCache.clear();
+        else if (arg == "--size" && value != NULL)
+            ok = haveSize = sscanf(argv[++i], "%ux%u", &scrWidth, &scrHeight) == 2 && scrWidth > 0 && scrHeight > 0;
+        else if (arg == "--camera" && value != NULL)
+            ok = parseVec3(argv[++i], cameraPos);
+        else if (arg == "--target" && value != NULL)
+            ok = parseVec3(argv[++i], options.cameraTarget);
+        else if (arg == "--frames" && value != NULL)
+            ok = sscanf(argv[++i], "%d", &options.numFrames) == 1 && options.numFrames > 0;
+        else if (arg == "--spin" && value != NULL)
+            ok = sscanf(argv[++i], "%f", &options.spin) == 1;
+        else if (arg == "--turntable" && value != NULL)
+        {
+            ok = sscanf(argv[++i], "%d", &options.numFrames) == 1 && options.numFrames > 0;
+            options.spin = ok ? 360.0f / options.numFrames : 0.0f;
+            options.headless = true;
+        }
+        else if (arg == "--encoders" && value != NULL)
+            ok = sscanf(argv[++i], "%u", &options.numEncoders) == 1;
+        else if (arg == "--output" && value != NULL)
+            options.output = argv[++i];
+        else if (arg == "--thumbnails" && value != NULL)
+        {
+            options.thumbnailSource = argv[++i];
+            options.headless = true;
+        }
+        else if (arg == "--thumbnail-dir" && value != NULL)
+            options.thumbnailDir = argv[++i];
+        else if (arg == "--loaders" && value != NULL)
+            ok = sscanf(argv[++i], "%u", &options.numLoaders) == 1;
+        else if (arg == "--stats-json" && value != NULL)
+            options.statsJson = argv[++i];
+        else if (arg[0] != '-' && !haveModel)
+        {
+            options.objFilename = arg;
+            haveModel = true;
+        }
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            cerr << "Bad argument: " << arg << endl;
+            printUsage(argv[0]);
+            return false;
+        }
     }
-    Material(glm::vec3 a, float b, float c, float d, float e)
+    if (options.shading < 0)
+        options.shading = options.numLights > 0 ? CLUSTERED_SHADING : 0;
+    if (!options.thumbnailSource.empty() && !haveSize)
+        scrWidth = scrHeight = THUMBNAIL_SIZE;
+    return true;
+}
+
+// "out.ppm", 3 -> "out_0003.ppm"
+string frameFilename(const string &output, int frame)
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = output.find_last_of('.');
+    size_t slash = output.find_last_of('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return output + number;
+    return output.substr(0, dot) + number + output.substr(dot);
+}
+
+ViewParams currentView(const Options &options, const glm::mat4 &projection)
+{
+    ViewParams view;
+    view.cameraPos = cameraPos;
+    view.cameraTarget = options.cameraTarget;
+    view.projection = projection;
+    view.rotX = rotX;
+    view.rotY = rotY;
+    view.rotZ = rotZ;
+    view.scale = userScaleFactor;
+    return view;
+}
+
+// prints the frame time statistics and the average frame rate
+void reportTimes(const FrameTimer &timer, const Options &options)
+{
+    double seconds = timer.elapsedSeconds();
+    double fps = seconds > 0.0 ? timer.numFrames() / seconds : 0.0;
+    std::cout << "performance: " << fps << " frames per second" << std::endl;
+    timer.report(cout);
+    if (!options.statsJson.empty())
+        timer.writeJson(options.statsJson);
+}
+
+// throughput of rendering, readback and encoding together, and where the
+// render loop waited
+void reportPipeline(const ImageWriter &writer, int width, int height, double seconds, double readbackWait)
+{
+    double fps = seconds > 0.0 ? writer.written() / seconds : 0.0;
+    double busy = seconds > 0.0 ? 100.0 * writer.busySeconds() / (seconds * writer.numThreads()) : 0.0;
+    cout << "pipeline: " << writer.written() << " frames of " << width << "x" << height << " in " << seconds
+         << " s, " << fps << " frames per second; " << writer.numThreads() << " encoder threads " << busy
+         << "% busy; rendering waited " << readbackWait * 1000.0 << " ms for readback and "
+         << writer.blockedSeconds() * 1000.0 << " ms for encoders" << endl;
+}
+
+// scenes are packed from the mesh cache before anything is drawn
+bool asyncLoad(const Options &options)
+{
+    if (!options.sceneFilename.empty())
+        return false;
+    return options.loadMode.empty() ? !options.headless : options.loadMode == "async";
+}
+
+// picks how load() reads the mesh and lays out its vertices; the CPU
+// transform and quantization both need the whole mesh in memory, and an
+// asynchronous load uploads its batches as they are
+void prepareLoad(Renderer &renderer, const Options &options)
+{
+    bool scene = !options.sceneFilename.empty();
+    bool cpuTransform = (options.cpuTransform || options.transformBenchmark > 0) && !scene;
+    if (options.streamBudget > 0 && scene)
+        cout << "stream: ignored with --scene" << endl;
+    else if (options.streamBudget > 0 && cpuTransform)
+        cout << "stream: ignored with --cpu-transform and --transform-bench" << endl;
+    if (options.loadMode == "async" && scene)
+        cout << "load: async ignored with --scene" << endl;
+    bool stream = options.streamBudget > 0 && !cpuTransform && !scene;
+    if (options.quantize && cpuTransform)
+        cout << "quantize: ignored with --cpu-transform and --transform-bench" << endl;
+    else if (options.quantize && stream)
+        cout << "quantize: ignored with --stream" << endl;
+    else if (options.quantize && asyncLoad(options))
+        cout << "quantize: ignored with --load async" << endl;
+    renderer.setQuantization(options.quantize && !cpuTransform && !stream && !asyncLoad(options), options.quantizeError);
+    renderer.setStreaming(stream ? options.streamBudget : 0);
+}
+
+string shadingFilename(int shading)
+{
+    return string(SHADINGS[shading]) + ".fs";
+}
+
+// the pre-pass needs the shading programs, so it follows the load
+bool prepareDepthPrepass(Renderer &renderer, const Options &options)
+{
+    if (options.depthPrepass && !renderer.setDepthPrepass(true))
+        return false;
+    if (options.depthPrepass)
+        cout << "depth pre-pass: on" << endl;
+    renderer.setFragmentCounting(options.countFragments);
+    return true;
+}
+
+// load() or beginLoad(), whichever --load asks for
+bool startLoad(Renderer &renderer, const Options &options)
+{
+    prepareLoad(renderer, options);
+    renderer.setShaderCache(options.shaderCache);
+    string fragmentFilename = shadingFilename(options.shading);
+    bool ok;
+    if (!options.sceneFilename.empty())
+        ok = renderer.loadScene(options.sceneFilename, "source.vs", fragmentFilename);
+    else if (asyncLoad(options))
+        ok = renderer.beginLoad(options.objFilename, "source.vs", fragmentFilename);
+    else
+        ok = renderer.load(options.objFilename, "source.vs", fragmentFilename);
+    return ok && prepareDepthPrepass(renderer, options);
+}
+
+// Time from startup to the first frame presented with part of the model in
+// it, and to the frame after which nothing was left to load; the two are
+// the same for a synchronous load.
+class LoadTimes
+{
+public:
+    LoadTimes() : start(chrono::steady_clock::now()) {}
+
+    // after every present until both are logged
+    void framePresented(const Renderer &renderer)
     {
-        color = a;
-        kd = b;
-        ks = c;
-        ka = d;
-        ns = e;
+        if (!firstFrameLogged && !renderer.mesh().submeshes.empty())
+        {
+            cout << "load: first frame after " << milliseconds() << " ms" << endl;
+            firstFrameLogged = true;
+        }
+        loadChecked(renderer);
+    }
+    // the load may also finish between frames
+    void loadChecked(const Renderer &renderer)
+    {
+        if (!loadedLogged && !renderer.loading())
+        {
+            cout << "load: fully loaded after " << milliseconds() << " ms" << endl;
+            loadedLogged = true;
+        }
+    }
+    // nothing more will load
+    void failed()
+    {
+        cout << "load: failed" << endl;
+        firstFrameLogged = loadedLogged = true;
+    }
+
+private:
+    double milliseconds() const
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
     }
-};
 
-vector<float> loadObj(string filename, vector<Material> &materials);
+    chrono::steady_clock::time_point start;
+    bool firstFrameLogged = false, loadedLogged = false;
+};
 
-struct Light
+// sets up the CPU transform when it is used or benchmarked
+bool prepareCpuTransform(Renderer &renderer, const Options &options, const glm::mat4 &projection)
 {
-    glm::vec3 position, color;
-    float intensity;
+    if (!options.cpuTransform && options.transformBenchmark == 0)
+        return true;
+    if (!options.sceneFilename.empty())
+    {
+        // the objects are placed by instancing, which is GPU-side
+        cout << "cpu transform: ignored with --scene" << endl;
+        return true;
+    }
+    if (!renderer.initCpuTransform("cpu.vs", renderer.fragmentShader(), options.numThreads))
+        return false;
+    renderer.benchmarkTransforms(currentView(options, projection), options.transformBenchmark);
+    renderer.setCpuTransform(options.cpuTransform);
+    return true;
+}
 
-    Light(glm::vec3 a, glm::vec3 b, float c)
+// replaces the single model with a grid of copies when more than one is
+// asked for, then sets up culling and LOD selection over whatever is drawn
+void prepareInstances(Renderer &renderer, const Options &options)
+{
+    if (options.numInstances > 1 && !options.sceneFilename.empty())
+        cout << "instances: ignored with --scene" << endl;
+    else if (options.numInstances > 1 && options.cpuTransform)
+        cout << "instances: ignored with --cpu-transform" << endl;
+    else if (options.numInstances > 1)
     {
-        position = a;
-        color = b;
-        intensity = c;
+        glm::vec3 boundsMin, boundsMax;
+        meshBounds(renderer.mesh(), boundsMin, boundsMax);
+        renderer.setInstances(makeInstanceGrid(options.numInstances, boundsMin, boundsMax));
+        cout << "instances: " << renderer.numInstances() << " copies, "
+             << renderer.numInstances() * renderer.numTriangles() << " triangles per frame" << endl;
     }
-};
-float userScaleFactor = 1.0f;
-float rotX = 0.0f;
-float rotY = 0.0f;
-float rotZ = 0.0f;
-glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 10.0f);
-glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
-glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
-float cameraSpeed = 0.5f;
+    renderer.setCulling(options.culling, options.numThreads);
+    renderer.setLodThreshold(options.lodError);
+    if (renderer.setMultiDraw(options.multiDraw))
+        cout << "multi-draw: one glMultiDrawElementsIndirect per frame" << endl;
+    else if (options.multiDraw)
+        cout << "multi-draw: needs GL 4.3 or ARB_multi_draw_indirect and ARB_base_instance, drawing per submesh" << endl;
+}
+
+// scatters the point lights through the box of everything drawn
+void prepareLights(Renderer &renderer, const Options &options)
+{
+    if (options.numLights == 0)
+        return;
+    glm::vec3 boundsMin, boundsMax;
+    renderer.sceneBounds(boundsMin, boundsMax);
+    renderer.setPointLights(makePointLights(options.numLights, boundsMin, boundsMax), options.numThreads);
+    if (options.shading != CLUSTERED_SHADING)
+        cout << "lights: only --shading clustered draws them" << endl;
+}
+
+// what the last frame submitted
+void reportDraws(const Renderer &renderer)
+{
+    cout << "draws: " << renderer.drawCommands() << " commands in " << renderer.drawCalls() << " draw calls in the last frame" << endl;
+}
 
-int main()
+// everything that needs the whole mesh, once it has loaded
+bool finishLoad(Renderer &renderer, const Options &options, const glm::mat4 &projection)
 {
-    string line, text;
-    ifstream in("source.vs");
-    while (getline(in, line))
+    if (!prepareCpuTransform(renderer, options, projection))
+        return false;
+    prepareInstances(renderer, options);
+    prepareLights(renderer, options);
+    return true;
+}
+
+// Uploads what the loader has sent since the last frame, within a slice of
+// the frame; finishes the load when it is complete. False if it failed.
+bool continueLoad(Renderer &renderer, const Options &options, const glm::mat4 &projection)
+{
+    const double LOAD_SECONDS_PER_FRAME = 0.004;
+    LoadStatus status = renderer.pollLoad(LOAD_SECONDS_PER_FRAME);
+    if (status == LOAD_FAILED)
+        return false;
+    return status == LOAD_PENDING || finishLoad(renderer, options, projection);
+}
+
+int runHeadless(const Options &options)
+{
+    HeadlessContext context;
+    if (!context.create(scrWidth, scrHeight))
+        return -1;
+
+    LoadTimes loadTimes;
+    Renderer renderer;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)scrWidth / (float)scrHeight, 0.1f, 100.0f);
+    if (!startLoad(renderer, options) || (!renderer.loading() && !finishLoad(renderer, options, projection)))
+    {
+        renderer.release();
+        return -1;
+    }
+
+    FrameTimer timer;
+    timer.init();
+    // frames come back through the readback ring a few frames late and are
+    // encoded on the writer's threads, so this thread only waits when the
+    // ring or the encoders fall behind
+    ImageWriter writer(options.numEncoders);
+    vector<unsigned char> pixels;
+    int framesRead = 0;
+    double readbackWait = 0.0;
+    auto collectFrame = [&](bool wait) {
+        auto start = chrono::steady_clock::now();
+        if (!context.finishReadback(pixels, wait))
+            return false;
+        if (wait)
+            readbackWait += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        string filename = options.numFrames == 1 ? options.output : frameFilename(options.output, framesRead);
+        framesRead++;
+        writer.submit(filename, context.width(), context.height(), pixels);
+        return true;
+    };
+    auto pipelineStart = chrono::steady_clock::now();
+    bool ok = true;
+    for (int frame = 0; frame < options.numFrames && ok; frame++)
+    {
+        timer.beginFrame();
+        if (renderer.loading())
+        {
+            if (!continueLoad(renderer, options, projection))
+            {
+                loadTimes.failed();
+                ok = false;
+            }
+            timer.mark(PHASE_LOAD);
+        }
+        renderer.upload(currentView(options, projection), light);
+        timer.mark(PHASE_UPLOAD);
+        timer.beginGpu();
+        renderer.draw();
+        timer.endGpu();
+        timer.mark(PHASE_DRAW);
+        if (context.readbackRingFull())
+            collectFrame(true);
+        context.startReadback();
+        while (collectFrame(false))
+            ;
+        timer.mark(PHASE_PRESENT);
+        timer.endFrame();
+        loadTimes.framePresented(renderer);
+        rotY += options.spin;
+    }
+    while (collectFrame(true))
+        ;
+    ok = writer.finish() && ok;
+    double pipelineSeconds = chrono::duration<double>(chrono::steady_clock::now() - pipelineStart).count();
+    // fewer frames than the load took: let it finish, for the statistics
+    while (ok && renderer.loading())
     {
-        text += line + "\n";
+        if (!continueLoad(renderer, options, projection))
+        {
+            loadTimes.failed();
+            ok = false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
     }
-    GLchar const *vertexShaderSource = text.c_str();
+    loadTimes.loadChecked(renderer);
+    if (ok)
+        cout << "headless: wrote " << options.numFrames << " frame(s) of "
+             << (options.sceneFilename.empty() ? options.objFilename : options.sceneFilename) << endl;
+
+    timer.release();
+    reportTimes(timer, options);
+    reportPipeline(writer, context.width(), context.height(), pipelineSeconds, readbackWait);
+    renderer.reportCulling(cout);
+    renderer.reportLights(cout);
+    reportDraws(renderer);
+    renderer.setFragmentCounting(false); // collects the last frames
+    reportFragments(cout, "fragments", renderer.fragmentStats());
+    renderer.release();
+    context.release();
+    return ok ? 0 : -1;
+}
 
-    string aline, atext;
-    ifstream ain("source.fs");
-    while (getline(ain, aline))
+// same frames as runHeadless, rasterized by SoftwareRenderer
+int runSoftware(const Options &options)
+{
+    MeshBuffers mesh;
+    if (!loadMesh(options.objFilename, mesh))
+        return -1;
+    SoftwareRenderer renderer(options.numThreads);
+    renderer.resize(scrWidth, scrHeight);
+    cout << "software: " << renderer.numThreads() << " threads, " << scrWidth << "x" << scrHeight << endl;
+    if (options.numInstances > 1)
+        cout << "instances: ignored with --software" << endl;
+    if (options.quantize)
+        cout << "quantize: ignored with --software" << endl;
+    if (options.streamBudget > 0)
+        cout << "stream: ignored with --software" << endl;
+    if (options.loadMode == "async")
+        cout << "load: async ignored with --software" << endl;
+    if (options.shading != 0)
+        cout << "shading: ignored with --software" << endl;
+    if (!options.sceneFilename.empty())
+        cout << "scene: ignored with --software" << endl;
+    if (options.numLights > 0)
+        cout << "lights: ignored with --software" << endl;
+    if (options.depthPrepass)
+        cout << "depth pre-pass: the software renderer always shades after resolving visibility" << endl;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)scrWidth / (float)scrHeight, 0.1f, 100.0f);
+
+    // no GL context, so only CPU times are recorded
+    FrameTimer timer;
+    ImageWriter writer(options.numEncoders);
+    vector<unsigned char> pixels;
+    auto pipelineStart = chrono::steady_clock::now();
+    for (int frame = 0; frame < options.numFrames; frame++)
     {
-        atext += aline + "\n";
+        timer.beginFrame();
+        renderer.draw(mesh, currentView(options, projection), light);
+        timer.mark(PHASE_DRAW);
+        string filename = options.numFrames == 1 ? options.output : frameFilename(options.output, frame);
+        pixels = renderer.pixels();
+        writer.submit(filename, renderer.width(), renderer.height(), pixels);
+        timer.mark(PHASE_PRESENT);
+        timer.endFrame();
+        rotY += options.spin;
     }
-    GLchar const *fragmentShaderSource = atext.c_str();
+    bool ok = writer.finish();
+    double pipelineSeconds = chrono::duration<double>(chrono::steady_clock::now() - pipelineStart).count();
+    if (ok)
+        cout << "software: wrote " << options.numFrames << " frame(s) of " << options.objFilename << endl;
+    reportTimes(timer, options);
+    reportPipeline(writer, renderer.width(), renderer.height(), pipelineSeconds, 0.0);
+    if (options.countFragments)
+        reportFragments(cout, "software fragments", renderer.fragmentStats());
+    return ok ? 0 : -1;
+}
 
+int runThumbnails(const Options &options)
+{
+    vector<string> objFilenames;
+    if (!listAssets(options.thumbnailSource, objFilenames))
+        return -1;
+    if (options.software)
+        cout << "software: ignored with --thumbnails" << endl;
+    if (!options.sceneFilename.empty())
+        cout << "scene: ignored with --thumbnails" << endl;
+    if (options.numInstances > 1)
+        cout << "instances: ignored with --thumbnails" << endl;
+    if (options.numLights > 0)
+        cout << "lights: ignored with --thumbnails" << endl;
+
+    HeadlessContext context;
+    if (!context.create(scrWidth, scrHeight))
+        return -1;
+    ThumbnailSettings settings;
+    settings.fragmentFilename = shadingFilename(options.shading);
+    settings.shaderCache = options.shaderCache;
+    settings.outputDirectory = options.thumbnailDir;
+    settings.viewDirection = cameraPos - options.cameraTarget;
+    settings.light = light;
+    settings.numLoaders = options.numLoaders;
+    settings.numEncoders = options.numEncoders;
+    bool ok = renderThumbnails(context, objFilenames, options.thumbnailSource, settings);
+    context.release();
+    return ok ? 0 : -1;
+}
+
+int runWindowed(const Options &options)
+{
     // glfw: initialize and configure
     // ------------------------------
-    glfwInit();
+    if (!glfwInit())
+    {
+        std::cout << "Failed to initialize GLFW; use --headless without a display" << std::endl;
+        return -1;
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     // glfw window creation
     // --------------------
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "viewGL", NULL, NULL);
+    GLFWwindow *window = glfwCreateWindow(scrWidth, scrHeight, "viewGL", NULL, NULL);
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -102,255 +740,167 @@ int main()
     }
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    glfwSetKeyCallback(window, key_callback);
+    if (options.swapInterval >= 0)
+        glfwSwapInterval(options.swapInterval);
 
     // // glew: load all OpenGL function pointers
     glewInit();
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    
-    // build and compile our shader program
-    // ------------------------------------
-    // vertex shader
-    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-    // check for shader compile errors
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    // fragment shader
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-    // check for shader compile errors
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    // link shaders
-    unsigned int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    // check for linking errors
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                  << infoLog << std::endl;
-    }
-
-
-    // Uncomment this part for the new implementation
-    Light light = Light(glm::vec3(3.0f, -1.0f, 3.0f), glm::vec3(1.0f), 1.0f);
-    vector<Material> materials = vector<Material>();
-    vector<float> obj = loadObj("data/pawn.obj", materials);
-    unsigned int numVertices = (obj.size() / 6);
-
-    // Uncomment this part for the original CPU vs GPU-side implementation
-    /*glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    
-    // Toggle CPU-side vs GPU-side model transform
-    bool CPUside = false;
-
-    // set up vertex data (and buffer(s)) and configure vertex attributes
-    // ------------------------------------------------------------------
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> colors;
-    std::vector<unsigned int> indices;
-    loadOBJ("./data/pawn.obj", vertices, colors, indices);*/
-
-    unsigned int VBO, VAO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    // Uncomment this part for the new implementation
-    glBufferData(GL_ARRAY_BUFFER, obj.size() * sizeof(float), &obj.front(), GL_STATIC_DRAW);
-
-    // position attribute
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
-
-
-    // Uncomment this part for the original CPU vs GPU-side implementation
-    /*if(CPUside){
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec4) + colors.size() * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
-    } else {
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3) + colors.size() * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
-    }
-    std::vector<glm::vec4> transformedVertices(vertices.size());
 
+    // projection
+    glm::mat4 projection = glm::mat4(1.0f);
+    projection = glm::perspective(glm::radians(45.0f), (float)scrWidth / (float)scrHeight, 0.1f, 100.0f);
 
-    if (CPUside){
-        glBufferSubData(GL_ARRAY_BUFFER, 0, transformedVertices.size() * sizeof(glm::vec4), &transformedVertices[0]);
-    } else {
-        glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(glm::vec3), &vertices[0]);
-    }
-    
-    if (CPUside){
-        glBufferSubData(GL_ARRAY_BUFFER, transformedVertices.size() * sizeof(glm::vec4), colors.size() * sizeof(glm::vec3), &colors[0]);
-    } else {
-        glBufferSubData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), colors.size() * sizeof(glm::vec3), &colors[0]);
-    }
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-    
-    if (CPUside){
-        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
-    } else {
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+    // shaders, mesh and buffers are set up the same way as in headless mode;
+    // an asynchronous load goes on inside the render loop
+    LoadTimes loadTimes;
+    Renderer renderer;
+    if (!startLoad(renderer, options) || (!renderer.loading() && !finishLoad(renderer, options, projection)))
+    {
+        renderer.release();
+        glfwTerminate();
+        return -1;
     }
-    
-    glEnableVertexAttribArray(0);
-
-    if (CPUside){
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)(vertices.size() * sizeof(glm::vec4)));
-    } else {
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)(vertices.size() * sizeof(glm::vec3)));
-    }*/
-
-    // attribute
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (char *)(3 * sizeof(float)));
 
-    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    // You can unbind the VAO afterwards so other VAO calls won't accidentally modify this VAO, but this rarely happens. Modifying other
-    // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly necessary.
-    glBindVertexArray(0);
     // wireframe mode
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    glEnable(GL_DEPTH_TEST);
 
-    // projection
-    glm::mat4 projection = glm::mat4(1.0f);
-    projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-
-    double startTime = glfwGetTime();
-    int numFrames = 0;
+    FrameTimer timer;
+    timer.init();
+    int shading = options.shading;
+    // shader edits wake the loop, which otherwise sleeps until input; with
+    // no inotify, the files are polled every SHADER_RELOAD_INTERVAL instead
+    DirectoryWatcher shaderWatcher([] { glfwPostEmptyEvent(); });
+    bool watchingShaders = shaderWatcher.watchFileDirectory("source.vs");
+    for (int k = 0; k < NUM_SHADINGS && watchingShaders; k++)
+        watchingShaders = shaderWatcher.watchFileDirectory(shadingFilename(k));
+    double lastReloadCheck = glfwGetTime();
+    // on demand, a frame is drawn when the view, the light or the window
+    // changed, or something else altered the picture since the last one
+    ViewParams drawnView;
+    Light drawnLight = light;
+    bool redraw = true;
+    size_t idleWakeups = 0;
+    double nextFrameTime = glfwGetTime();
 
     // render loop
     while (!glfwWindowShouldClose(window))
     {
+        timer.beginFrame();
+
         // input
-        // Uncomment for the new implementation
         processInput(window, projection);
-
-        // render
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // draw our first triangle
-        glUseProgram(shaderProgram);
-
-        // view
-        glm::mat4 view = glm::mat4(1.0f);
-        glm::vec3 cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
-        glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
-        view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
-
-        // model
-        glm::mat4 model = glm::mat4(1.0f);
-        // translate
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-        // rotate
-        model = glm::rotate(model, glm::radians(rotX), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(rotY), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(rotZ), glm::vec3(0.0f, 0.0f, 1.0f));
-        // scale
-        glm::vec3 scaleFactor = glm::vec3(userScaleFactor);
-        model = glm::scale(model, scaleFactor);
-
-        // send final matrix to vertex shader
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, &model[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, &projection[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, &view[0][0]);
-
-        // send material and light to fragment shader
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPosition"), 1, &light.position[0]);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, &light.color[0]);
-        glUniform1f(glGetUniformLocation(shaderProgram, "lightIntensity"), light.intensity);
-
-        // Bind the VAO
-        glBindVertexArray(VAO);
-
-        // Draw each material group separately
-        int offset = 0;
-        for (const auto &mat : materials)
+        for (; shadingSteps > 0; shadingSteps--)
         {
-            glUniform3fv(glGetUniformLocation(shaderProgram, "objColor"), 1, &mat.color[0]);
-            glUniform1f(glGetUniformLocation(shaderProgram, "ka"), mat.ka);
-            glUniform1f(glGetUniformLocation(shaderProgram, "ks"), mat.ks);
-            glUniform1f(glGetUniformLocation(shaderProgram, "kd"), mat.kd);
-            glUniform1f(glGetUniformLocation(shaderProgram, "ns"), mat.ns);
-
-            // Draw the triangles for the current material
-            glDrawArrays(GL_TRIANGLES, offset, numVertices);
-            offset += numVertices;
+            // one that does not build is reported and skipped
+            shading = (shading + 1) % NUM_SHADINGS;
+            if (renderer.setFragmentShader(shadingFilename(shading)))
+            {
+                cout << "shading: " << SHADINGS[shading] << endl;
+                redraw = true;
+            }
         }
-
-        // Unbind the VAO
-        glBindVertexArray(0);
-
-        
-        // Uncomment this for CPU vs. GPU-side implementation
-        /*if (CPUside == false){
-            unsigned int mvpLoc = glGetUniformLocation(shaderProgram, "mvp");
-            glUseProgram(shaderProgram);
-            glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, glm::value_ptr(mvp));
-            
-            glBindVertexArray(VAO);
-        } else {
-            for (size_t i = 0; i < vertices.size(); ++i) {
-                glm::vec4 transformedVertex = mvp * glm::vec4(vertices[i], 1.0f);
-                transformedVertices[i] = transformedVertex;//glm::vec3(transformedVertex);
+        for (; prepassToggles > 0; prepassToggles--)
+        {
+            bool prepass = !renderer.depthPrepassEnabled();
+            if (renderer.setDepthPrepass(prepass))
+                cout << "depth pre-pass: " << (prepass ? "on" : "off") << endl;
+        }
+        if (watchingShaders ? shaderWatcher.takeChanged() : glfwGetTime() - lastReloadCheck >= SHADER_RELOAD_INTERVAL)
+        {
+            redraw = renderer.reloadShaders() || redraw;
+            lastReloadCheck = glfwGetTime();
+        }
+        ViewParams view = currentView(options, projection);
+        redraw = redraw || windowDamaged || !(view == drawnView) || !(light == drawnLight) || !options.onDemand;
+        timer.mark(PHASE_INPUT);
+        if (renderer.loading())
+        {
+            if (!continueLoad(renderer, options, projection))
+            {
+                loadTimes.failed();
+                glfwSetWindowShouldClose(window, true);
             }
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, transformedVertices.size() * sizeof(glm::vec4), &transformedVertices[0]);
-            
-          
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glUseProgram(shaderProgram);
-            glBindVertexArray(VAO);
+            timer.mark(PHASE_LOAD);
+            redraw = true;
         }
 
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        
-        numFrames++;
-        */
+        if (!redraw)
+        {
+            // nothing on screen would change: sleep until an event arrives,
+            // a shader file is written, or without inotify until it is time
+            // to look at the shader files again
+            timer.discardFrame();
+            if (watchingShaders)
+                glfwWaitEvents();
+            else
+                glfwWaitEventsTimeout(SHADER_RELOAD_INTERVAL);
+            idleWakeups++;
+            continue;
+        }
+
+        // render
+        renderer.upload(view, light);
+        timer.mark(PHASE_UPLOAD);
+        timer.beginGpu();
+        renderer.draw();
+        timer.endGpu();
+        timer.mark(PHASE_DRAW);
+
         glfwSwapBuffers(window);
+        drawnView = view;
+        drawnLight = light;
+        redraw = windowDamaged = false;
         glfwPollEvents();
+        timer.mark(PHASE_PRESENT);
+        timer.endFrame();
+        loadTimes.framePresented(renderer);
+
+        // the cap paces frame starts; a late frame resets the schedule
+        // instead of being made up for with a burst
+        if (options.maxFps > 0.0f)
+        {
+            nextFrameTime += 1.0 / options.maxFps;
+            double now = glfwGetTime();
+            if (nextFrameTime > now)
+                this_thread::sleep_for(chrono::duration<double>(nextFrameTime - now));
+            else
+                nextFrameTime = now;
+        }
     }
-    double deltaTime = glfwGetTime() - startTime;
+    if (options.onDemand)
+        cout << "redraw: on demand, " << timer.numFrames() << " frames drawn, woke " << idleWakeups << " times without drawing" << endl;
 
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteProgram(shaderProgram);
+    timer.release();
+    renderer.reportCulling(cout);
+    renderer.reportLights(cout);
+    reportDraws(renderer);
+    renderer.setFragmentCounting(false);
+    reportFragments(cout, "fragments", renderer.fragmentStats());
+    renderer.release();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
-    double fps = ((double) numFrames) / deltaTime;
-    std::cout << "performance: " << fps << " frames per second";
+    reportTimes(timer, options);
     return 0;
 }
 
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+    if (!options.thumbnailSource.empty())
+        return runThumbnails(options);
+    if (options.software)
+        return runSoftware(options);
+    return options.headless ? runHeadless(options) : runWindowed(options);
+}
+
 void processInput(GLFWwindow *window, glm::mat4 &projection)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -378,17 +928,21 @@ void processInput(GLFWwindow *window, glm::mat4 &projection)
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
         rotY += 1.0f;
     if (glfwGetKey(window,GLFW_KEY_0) == GLFW_PRESS)
-        projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
+        projection = glm::perspective(glm::radians(45.0f), (float)scrWidth / (float)scrHeight, 0.1f, 1000.0f);
     if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
-        projection = glm::perspective(90.0f, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
+        projection = glm::perspective(90.0f, (float)scrWidth / (float)scrHeight, 0.1f, 1000.0f);
     if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
         projection = glm::perspective(45.0f, 1.0f, 0.1f, 1000.0f);
     if(glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
-        projection = glm::perspective(45.0f, (float)SCR_WIDTH / (float)SCR_HEIGHT, 1.0f, 10000.0f);
+        projection = glm::perspective(45.0f, (float)scrWidth / (float)scrHeight, 1.0f, 10000.0f);
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
+    if (key == GLFW_KEY_TAB && action == GLFW_PRESS)
+        shadingSteps++;
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        prepassToggles++;
     if (key == GLFW_KEY_R && action == GLFW_PRESS)
     {
         userScaleFactor = 1.0f;
@@ -402,380 +956,10 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
     glViewport(0, 0, width, height);
+    windowDamaged = true;
 }
-
-// Comment this one in for new implementation
-vector<float> loadObj(string filename, vector<Material> &materials)
+// the window was uncovered or otherwise needs its contents again
+void window_refresh_callback(GLFWwindow *window)
 {
-    string line, text;
-    ifstream in(filename);
-    vector<glm::vec3> vertices;
-    vector<glm::vec3> normals;
-    vector<glm::vec3> facesVertices;
-    vector<glm::vec3> facesNormals;
-    vector<float> vertexes;
-    string mtlFilename;
-    string currentMaterial;
-
-    // read file, vertices and faces
-    while (getline(in, line))
-    {
-        // read in vertices
-        if (line.rfind("v ", 0) == 0)
-        {
-            vector<string> tempVertex;
-            istringstream iss(line);
-            string temp;
-            while (getline(iss, temp, ' '))
-            {
-                tempVertex.push_back(temp);
-            }
-            float x = stof(tempVertex[1]);
-            float y = stof(tempVertex[2]);
-            float z = stof(tempVertex[3]);
-            vertices.push_back(glm::vec3(x, y, z));
-        }
-        // read in normals
-        if (line.rfind("vn ", 0) == 0)
-        {
-            vector<string> tempNormal;
-            istringstream iss(line);
-            string temp;
-            while (getline(iss, temp, ' '))
-            {
-                tempNormal.push_back(temp);
-            }
-            float x = stof(tempNormal[1]);
-            float y = stof(tempNormal[2]);
-            float z = stof(tempNormal[3]);
-            normals.push_back(glm::vec3(x, y, z));
-        }
-        // read in faces
-        if (line.rfind("f ", 0) == 0)
-        {
-            vector<string> tempFace;
-            istringstream iss(line);
-            string temp;
-            while (getline(iss, temp, ' '))
-            {
-                tempFace.push_back(temp);
-            }
-            // triangulate the face
-            for (long unsigned int i = 1; i < tempFace.size() - 1; i++)
-            {
-                // first vertex
-                istringstream iss1(tempFace[1]);
-                string temp1;
-                getline(iss1, temp1, '/');
-                int v1 = stoi(temp1) - 1;
-                getline(iss1, temp1, '/');
-                getline(iss1, temp1, '/');
-                int n1 = stoi(temp1) - 1;
-                // second vertex
-                istringstream iss2(tempFace[i]);
-                string temp2;
-                getline(iss2, temp2, '/');
-                int v2 = stoi(temp2) - 1;
-                getline(iss2, temp2, '/');
-                getline(iss2, temp2, '/');
-                int n2 = stoi(temp2) - 1;
-                // third vertex
-                istringstream iss3(tempFace[i + 1]);
-                string temp3;
-                getline(iss3, temp3, '/');
-                int v3 = stoi(temp3) - 1;
-                getline(iss3, temp3, '/');
-                getline(iss3, temp3, '/');
-                int n3 = stoi(temp3) - 1;
-                // add the triangle to the vertexes vector
-                vertexes.push_back(vertices[v1].x);
-                vertexes.push_back(vertices[v1].y);
-                vertexes.push_back(vertices[v1].z);
-                vertexes.push_back(normals[n1].x);
-                vertexes.push_back(normals[n1].y);
-                vertexes.push_back(normals[n1].z);
-                vertexes.push_back(vertices[v2].x);
-                vertexes.push_back(vertices[v2].y);
-                vertexes.push_back(vertices[v2].z);
-                vertexes.push_back(normals[n2].x);
-                vertexes.push_back(normals[n2].y);
-                vertexes.push_back(normals[n2].z);
-                vertexes.push_back(vertices[v3].x);
-                vertexes.push_back(vertices[v3].y);
-                vertexes.push_back(vertices[v3].z);
-                vertexes.push_back(normals[n3].x);
-                vertexes.push_back(normals[n3].y);
-                vertexes.push_back(normals[n3].z);
-            }
-        }
-        // Below is for flat shading
-        /*        if (line.rfind("f ", 0) == 0)
-        {
-            vector<string> tempFace;
-            istringstream iss(line);
-            string temp;
-            while (getline(iss, temp, ' '))
-            {
-                tempFace.push_back(temp);
-            }
-
-            // triangulate the face
-            for (long unsigned int i = 1; i < tempFace.size() - 1; i++)
-            {
-                // first vertex
-                istringstream iss1(tempFace[1]);
-                string temp1;
-                getline(iss1, temp1, '/');
-                int v1 = stoi(temp1) - 1;
-
-                // second vertex
-                istringstream iss2(tempFace[i]);
-                string temp2;
-                getline(iss2, temp2, '/');
-                int v2 = stoi(temp2) - 1;
-
-                // third vertex
-                istringstream iss3(tempFace[i + 1]);
-                string temp3;
-                getline(iss3, temp3, '/');
-                int v3 = stoi(temp3) - 1;
-
-                // calculate the normal
-                glm::vec3 p1 = vertices[v1];
-                glm::vec3 p2 = vertices[v2];
-                glm::vec3 p3 = vertices[v3];
-                glm::vec3 normal = glm::normalize(glm::cross(p2 - p1, p3 - p1));
-
-                // add the triangle to the vertexes vector
-                vertexes.push_back(vertices[v1].x);
-                vertexes.push_back(vertices[v1].y);
-                vertexes.push_back(vertices[v1].z);
-                vertexes.push_back(normal.x);
-                vertexes.push_back(normal.y);
-                vertexes.push_back(normal.z);
-
-                vertexes.push_back(vertices[v2].x);
-                vertexes.push_back(vertices[v2].y);
-                vertexes.push_back(vertices[v2].z);
-                vertexes.push_back(normal.x);
-                vertexes.push_back(normal.y);
-                vertexes.push_back(normal.z);
-
-                vertexes.push_back(vertices[v3].x);
-                vertexes.push_back(vertices[v3].y);
-                vertexes.push_back(vertices[v3].z);
-                vertexes.push_back(normal.x);
-                vertexes.push_back(normal.y);
-                vertexes.push_back(normal.z);
-            }
-        }*/
-        // read in MTL file
-        if (line.rfind("mtllib ", 0) == 0)
-        {
-            mtlFilename = line.substr(7);
-        }
-        // read in material name
-        if (line.rfind("usemtl ", 0) == 0)
-        {
-            currentMaterial = line.substr(7);
-        }
-    }
-
-    ifstream mtlFile("data/" + mtlFilename);
-    if (mtlFile.is_open())
-    {
-        Material currentMat = Material();
-        while (getline(mtlFile, line))
-        {
-            if (line.rfind("newmtl ", 0) == 0)
-            {
-                if (!currentMat.color.r == 0 && !currentMat.color.g == 0 && !currentMat.color.b == 0)
-                {
-                    materials.push_back(currentMat);
-                }
-                currentMat = Material(glm::vec3(0.0f), 0.0f, 0.0f, 0.0f, 0.0f);
-            }
-            else if (line.rfind("Ka ", 0) == 0)
-            {
-                istringstream iss(line.substr(3));
-                iss >> currentMat.ka;
-            }
-            else if (line.rfind("Kd ", 0) == 0)
-            {
-                istringstream iss(line.substr(3));
-                iss >> currentMat.color.r >> currentMat.color.g >> currentMat.color.b;
-                currentMat.kd = 1.0f;
-            }
-            else if (line.rfind("Ks ", 0) == 0)
-            {
-                istringstream iss(line.substr(3));
-                iss >> currentMat.ks;
-            }
-            else if (line.rfind("Ns ", 0) == 0)
-            {
-                istringstream iss(line.substr(3));
-                iss >> currentMat.ns;
-            }
-        }
-        if (!currentMat.color.r == 0 && !currentMat.color.g == 0 && !currentMat.color.b == 0)
-        {
-            materials.push_back(currentMat);
-        }
-        in.close();
-        mtlFile.close();
-    }
-
-    return vertexes;
+    windowDamaged = true;
 }
-
-// Old implementation, comment this one in for the CPU vs. GPU-side comparison
-
-/*void loadOBJ(const std::string &filename, std::vector<glm::vec3> &vertices, std::vector<glm::vec3> &colors, std::vector<unsigned int> &indices){
-    std::ifstream file(filename);
-    if (!file.is_open())
-    {
-        std::cerr << "Failed to open file: " << filename << std::endl;
-        return;
-    }
-
-    std::vector<glm::vec3> temp_vertices;
-    std::vector<glm::vec3> temp_colors;
-
-    std::string line;
-    std::string material_file;
-    glm::vec3 current_color(1.0f, 0.5f, 0.2f); // default color
-
-    std::ifstream mtl_file;
-    Material current_material;
-
-    while (std::getline(file, line))
-    {
-        std::istringstream iss(line);
-        std::string prefix;
-        iss >> prefix;
-
-        if (prefix == "v")
-        {
-            float x, y, z;
-            iss >> x >> y >> z;
-            temp_vertices.emplace_back(x, y, z);
-            temp_colors.emplace_back(current_color);
-        }
-        else if (prefix == "mtllib")
-        {
-            std::string mtl_filename;
-            iss >> mtl_filename;
-            mtl_file.open("./data/" + mtl_filename);
-            if (!mtl_file.is_open())
-            {
-                std::cerr << "Failed to open material file: " << mtl_filename << std::endl;
-                continue;
-            }
-
-            std::string mtl_line;
-            Material temp_material;
-            std::string current_mtl_name;
-
-            while (std::getline(mtl_file, mtl_line))
-            {
-                std::istringstream mtl_iss(mtl_line);
-                std::string mtl_prefix;
-                mtl_iss >> mtl_prefix;
-
-                if (mtl_prefix == "newmtl")
-                {
-                    if (!current_mtl_name.empty())
-                    {
-                       // materials.push_back(temp_material);
-                        materials[current_mtl_name] = temp_material;
-                    }
-                    mtl_iss >> current_mtl_name;
-                    temp_material = Material();
-                }
-                else if (mtl_prefix == "Ka")
-                {
-                    float r, g, b;
-                    mtl_iss >> r >> g >> b;
-                    temp_material.ambient = glm::vec3(r, g, b);
-                }
-                else if (mtl_prefix == "Kd")
-                {
-                    float r, g, b;
-                    mtl_iss >> r >> g >> b;
-                    temp_material.diffuse = glm::vec3(r, g, b);
-                }
-                else if (mtl_prefix == "Ks")
-                {
-                    float r, g, b;
-                    mtl_iss >> r >> g >> b;
-                    temp_material.specular = glm::vec3(r, g, b);
-                }
-                else if (mtl_prefix == "Ns")
-                {
-                    float shininess;
-                    mtl_iss >> shininess;
-                    temp_material.shininess = shininess;
-                }
-            }
-
-            if (!current_mtl_name.empty())
-            {
-                materials[current_mtl_name] = temp_material;
-            }
-
-            mtl_file.close();
-        }
-        else if (prefix == "usemtl")
-        {
-            std::string material_name;
-            iss >> material_name;
-            if (materials.count(material_name))
-            {
-                current_material = materials[material_name];
-                current_color = current_material.diffuse;
-            }
-            else
-            {
-                std::cerr << "Warning: Material '" << material_name << "' not found" << std::endl;
-            }
-        }
-        else if (prefix == "f")
-        {
-            std::vector<unsigned int> face_vertices;
-            std::string vertex_data;
-            while (iss >> vertex_data)
-            {
-                size_t delimiter_pos = vertex_data.find('/');
-                if (delimiter_pos == std::string::npos)
-                {
-                    // Vertex only
-                    face_vertices.push_back(std::stoul(vertex_data) - 1);
-                }
-                else
-                {
-                    // Vertex and texture coordinate (or normal)
-                    face_vertices.push_back(std::stoul(vertex_data.substr(0, delimiter_pos)) - 1);
-                }
-            }
-
-            // Triangulate the face
-            for (size_t i = 2; i < face_vertices.size(); ++i)
-            {
-                indices.push_back(face_vertices[0]);
-                indices.push_back(face_vertices[i - 1]);
-                indices.push_back(face_vertices[i]);
-
-                // Assign the current color to the vertices of the face
-                colors.push_back(current_color);
-                colors.push_back(current_color);
-                colors.push_back(current_color);
-            }
-        }
-    }
-
-    file.close();
-
-    vertices = std::move(temp_vertices);
-    colors = std::move(temp_colors);
-    
-}*/
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "mappedfile.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MappedFile::open(const std::string &filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    fileSize = (size_t)st.st_size;
+    if (fileSize > 0)
+    {
+        void *ptr = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            ::close(fd);
+            fileSize = 0;
+            return false;
+        }
+        // the parsers walk the file front to back exactly once
+        madvise(ptr, fileSize, MADV_SEQUENTIAL);
+        fileData = (const char *)ptr;
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    opened = true;
+    return true;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        fileData = other.fileData;
+        fileSize = other.fileSize;
+        opened = other.opened;
+        other.fileData = nullptr;
+        other.fileSize = 0;
+        other.opened = false;
+    }
+    return *this;
+}
+
+void MappedFile::close()
+{
+    if (fileData != nullptr)
+        munmap((void *)fileData, fileSize);
+    fileData = nullptr;
+    fileSize = 0;
+    opened = false;
+}
+
+void MappedFile::release(const char *begin, const char *end) const
+{
+    // whole pages only; a page still partly needed simply faults back in
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)begin / pageSize * pageSize;
+    uintptr_t last = ((uintptr_t)end + pageSize - 1) / pageSize * pageSize;
+    if (fileData == nullptr || last <= first)
+        return;
+    madvise((void *)first, last - first, MADV_DONTNEED);
+}
+
+bool SpillFile::create(const std::string &prefix, size_t size)
+{
+    close();
+
+    std::string pattern = prefix + "XXXXXX";
+    int fd = mkstemp(&pattern[0]);
+    if (fd < 0)
+        return false;
+    // nothing is left behind, however the process ends
+    unlink(pattern.c_str());
+    if (size > 0)
+    {
+        void *ptr = MAP_FAILED;
+        if (ftruncate(fd, (off_t)size) == 0)
+            ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+        fileData = (char *)ptr;
+        fileSize = size;
+    }
+    ::close(fd);
+    return true;
+}
+
+void SpillFile::close()
+{
+    if (fileData != nullptr)
+        munmap(fileData, fileSize);
+    fileData = nullptr;
+    fileSize = 0;
+}
+
+void SpillFile::release() const
+{
+    // a shared mapping keeps its contents in the file, dirty pages included
+    if (fileData != nullptr)
+        madvise(fileData, fileSize, MADV_DONTNEED);
+}
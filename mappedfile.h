@@ -0,0 +1,66 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+// Read-only memory mapping of a whole file. The contents are scanned in place,
+// so nothing is copied into a userspace buffer.
+class MappedFile
+{
+public:
+    MappedFile() {}
+    explicit MappedFile(const std::string &filename) { open(filename); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    // the mapping moves along, leaving other closed
+    MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    bool open(const std::string &filename);
+    void close();
+
+    bool isOpen() const { return opened; }
+    const char *begin() const { return fileData; }
+    const char *end() const { return fileData + fileSize; }
+    size_t size() const { return fileSize; }
+
+    // Drops the pages of [begin, end) from the process once they have been
+    // scanned; they are read back from the file if touched again.
+    void release(const char *begin, const char *end) const;
+
+private:
+    const char *fileData = nullptr;
+    size_t fileSize = 0;
+    bool opened = false;
+};
+
+// Writable scratch space in an unlinked temporary file, for tables that may
+// not fit in RAM. Written pages go to the page cache rather than staying in
+// the process, and release() hands back the ones the process holds.
+class SpillFile
+{
+public:
+    SpillFile() {}
+    ~SpillFile() { close(); }
+
+    SpillFile(const SpillFile &) = delete;
+    SpillFile &operator=(const SpillFile &) = delete;
+
+    // creates a zero-filled file of size bytes named prefix + a unique suffix
+    bool create(const std::string &prefix, size_t size);
+    void close();
+
+    char *data() const { return fileData; }
+    size_t size() const { return fileSize; }
+    void release() const;
+
+private:
+    char *fileData = nullptr;
+    size_t fileSize = 0;
+};
+
+#endif
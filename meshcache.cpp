@@ -0,0 +1,442 @@
+#include "meshcache.h"
+#include "hash.h"
+#include "meshoptimize.h"
+#include "simplify.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    const char MESHCACHE_MAGIC[8] = {'M', 'E', 'S', 'H', 'B', 'I', 'N', '\0'};
+    // 3: submesh bounds, 4: LODs, 5: optimized triangle and vertex order,
+    // 6: MTL path relative to the OBJ, a missing MTL recorded as such
+    const uint32_t MESHCACHE_VERSION = 6;
+    // SourceStamp::size of an MTL the OBJ names but that did not exist
+    const uint64_t ABSENT_SOURCE = ~(uint64_t)0;
+
+    // identity of a source file at the time the cache was built
+    struct SourceStamp
+    {
+        uint64_t size;
+        int64_t mtime; // nanoseconds
+        uint64_t hash;
+    };
+
+    struct MeshCacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        SourceStamp obj;
+        SourceStamp mtl;
+        // sections, as byte offsets from the start of the file
+        uint64_t metaOffset, metaSize;
+        uint64_t vertexOffset, numVertices;
+        uint64_t indexOffset, numIndices;
+        uint32_t indexSize;
+        uint32_t numMaterials;
+        uint32_t numSubmeshes;
+        uint32_t numLods; // each with numSubmeshes submeshes
+        uint64_t payloadHash;
+    };
+
+    // on-disk material, followed by nameLength bytes of name
+    struct MaterialRecord
+    {
+        float color[3];
+        float kd, ks, ka, ns;
+        uint32_t nameLength;
+    };
+
+    uint64_t alignTo(uint64_t offset, uint64_t alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    bool statFile(const string &filename, SourceStamp &stamp)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0)
+            return false;
+        stamp.size = (uint64_t)st.st_size;
+        stamp.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        stamp.hash = 0;
+        return true;
+    }
+
+    bool hashFile(const string &filename, uint64_t &hash)
+    {
+        MappedFile file(filename);
+        if (!file.isOpen())
+            return false;
+        hash = hashBytes(file.begin(), file.size());
+        return true;
+    }
+
+    // A matching size and mtime is trusted as is. A file that was touched or
+    // copied without changing is recognised by its content hash. A file
+    // recorded as absent matches as long as it is still missing.
+    bool sourceMatches(const string &filename, const SourceStamp &stamp)
+    {
+        SourceStamp current;
+        if (!statFile(filename, current))
+            return stamp.size == ABSENT_SOURCE;
+        if (current.size != stamp.size)
+            return false;
+        if (current.mtime == stamp.mtime)
+            return true;
+        uint64_t hash;
+        return hashFile(filename, hash) && hash == stamp.hash;
+    }
+
+    // mtl path as mtllib names it, materials, submesh ranges, then per LOD
+    // its error and ranges
+    vector<char> serializeMeta(const Mesh &mesh, const string &mtlName)
+    {
+        vector<char> meta;
+        auto append = [&meta](const void *data, size_t size) {
+            meta.insert(meta.end(), (const char *)data, (const char *)data + size);
+        };
+
+        uint32_t pathLength = (uint32_t)mtlName.size();
+        append(&pathLength, sizeof(pathLength));
+        append(mtlName.data(), pathLength);
+        for (const Material &mat : mesh.materials)
+        {
+            MaterialRecord record = {{mat.color.r, mat.color.g, mat.color.b}, mat.kd, mat.ks, mat.ka, mat.ns, (uint32_t)mat.name.size()};
+            append(&record, sizeof(record));
+            append(mat.name.data(), mat.name.size());
+        }
+        append(mesh.submeshes.data(), mesh.submeshes.size() * sizeof(SubMesh));
+        for (const MeshLod &lod : mesh.lods)
+        {
+            append(&lod.error, sizeof(lod.error));
+            append(lod.submeshes.data(), lod.submeshes.size() * sizeof(SubMesh));
+        }
+        return meta;
+    }
+
+    bool deserializeMeta(const char *p, const char *end, uint32_t numMaterials, uint32_t numSubmeshes, uint32_t numLods,
+                         string &mtlName, vector<Material> &materials, vector<SubMesh> &submeshes, vector<MeshLod> &lods)
+    {
+        uint32_t pathLength;
+        if (end - p < (ptrdiff_t)sizeof(pathLength))
+            return false;
+        memcpy(&pathLength, p, sizeof(pathLength));
+        p += sizeof(pathLength);
+        if ((size_t)(end - p) < pathLength)
+            return false;
+        mtlName.assign(p, pathLength);
+        p += pathLength;
+
+        materials.clear();
+        for (uint32_t i = 0; i < numMaterials; i++)
+        {
+            MaterialRecord record;
+            if (end - p < (ptrdiff_t)sizeof(record))
+                return false;
+            memcpy(&record, p, sizeof(record));
+            p += sizeof(record);
+            if ((size_t)(end - p) < record.nameLength)
+                return false;
+            Material mat(glm::vec3(record.color[0], record.color[1], record.color[2]), record.kd, record.ks, record.ka, record.ns);
+            mat.name.assign(p, record.nameLength);
+            p += record.nameLength;
+            materials.push_back(mat);
+        }
+
+        size_t submeshBytes = numSubmeshes * sizeof(SubMesh);
+        if ((size_t)(end - p) != submeshBytes + numLods * (sizeof(float) + submeshBytes))
+            return false;
+        submeshes.resize(numSubmeshes);
+        memcpy(submeshes.data(), p, submeshBytes);
+        p += submeshBytes;
+        lods.resize(numLods);
+        for (MeshLod &lod : lods)
+        {
+            memcpy(&lod.error, p, sizeof(lod.error));
+            p += sizeof(lod.error);
+            lod.submeshes.resize(numSubmeshes);
+            memcpy(lod.submeshes.data(), p, submeshBytes);
+            p += submeshBytes;
+        }
+        return true;
+    }
+
+    uint64_t hashPayload(const void *meta, size_t metaSize, const void *vertices, size_t vertexBytes, const void *indices, size_t indexBytes)
+    {
+        uint64_t hash = hashBytes(meta, metaSize);
+        hash = hashBytes(vertices, vertexBytes, hash);
+        return hashBytes(indices, indexBytes, hash);
+    }
+
+    // "models/pawn.obj" -> "models/"; what mtllib names is relative to it
+    string objDirectory(const string &objFilename)
+    {
+        size_t slash = objFilename.find_last_of('/');
+        return slash == string::npos ? string() : objFilename.substr(0, slash + 1);
+    }
+
+    bool writeAt(FILE *file, uint64_t offset, const void *data, size_t size)
+    {
+        return fseek(file, (long)offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size;
+    }
+}
+
+string meshCacheFilename(const string &objFilename)
+{
+    size_t dot = objFilename.find_last_of('.');
+    size_t slash = objFilename.find_last_of('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return objFilename + ".meshbin";
+    return objFilename.substr(0, dot) + ".meshbin";
+}
+
+bool writeMeshCache(const string &cacheFilename, const string &objFilename, const Mesh &mesh)
+{
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESHCACHE_MAGIC, sizeof(header.magic));
+    header.version = MESHCACHE_VERSION;
+    header.headerSize = sizeof(MeshCacheHeader);
+
+    if (!statFile(objFilename, header.obj) || !hashFile(objFilename, header.obj.hash))
+        return false;
+    // loadObj resolved the MTL against the OBJ's directory; the cache keeps
+    // the name relative to it, so it stays valid from any working directory
+    string mtlName = mesh.mtlFilename;
+    string directory = objDirectory(objFilename);
+    if (!mtlName.empty() && mtlName.compare(0, directory.size(), directory) == 0)
+        mtlName = mtlName.substr(directory.size());
+    if (!mesh.mtlFilename.empty())
+    {
+        if (statFile(mesh.mtlFilename, header.mtl))
+            hashFile(mesh.mtlFilename, header.mtl.hash);
+        else
+            header.mtl.size = ABSENT_SOURCE;
+    }
+
+    // indices are stored in the width they are drawn with
+    vector<unsigned short> shortIndices;
+    const void *indexData = mesh.indices.data();
+    header.indexSize = sizeof(unsigned int);
+    if (mesh.useShortIndices())
+    {
+        shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+        indexData = shortIndices.data();
+        header.indexSize = sizeof(unsigned short);
+    }
+
+    vector<char> meta = serializeMeta(mesh, mtlName);
+    size_t vertexBytes = mesh.vertices.size() * sizeof(float);
+    size_t indexBytes = mesh.indices.size() * header.indexSize;
+    header.metaOffset = sizeof(MeshCacheHeader);
+    header.metaSize = meta.size();
+    header.vertexOffset = alignTo(header.metaOffset + header.metaSize, 64);
+    header.numVertices = mesh.numVertices();
+    header.indexOffset = alignTo(header.vertexOffset + vertexBytes, 64);
+    header.numIndices = mesh.indices.size();
+    header.numMaterials = (uint32_t)mesh.materials.size();
+    header.numSubmeshes = (uint32_t)mesh.submeshes.size();
+    header.numLods = (uint32_t)mesh.lods.size();
+    header.payloadHash = hashPayload(meta.data(), meta.size(), mesh.vertices.data(), vertexBytes, indexData, indexBytes);
+
+    // a unique name next to the cache, so concurrent writers of the same
+    // cache, threads of one process included, never share a temporary
+    string tempFilename = cacheFilename + ".tmpXXXXXX";
+    int fd = mkstemp(&tempFilename[0]);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        cerr << "meshcache: cannot write " << tempFilename << endl;
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(tempFilename.c_str());
+        }
+        return false;
+    }
+    // mkstemp creates the file private to its owner; caches are shared
+    fchmod(fd, 0644);
+    bool ok = writeAt(file, 0, &header, sizeof(header)) &&
+              writeAt(file, header.metaOffset, meta.data(), meta.size()) &&
+              writeAt(file, header.vertexOffset, mesh.vertices.data(), vertexBytes) &&
+              writeAt(file, header.indexOffset, indexData, indexBytes);
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempFilename.c_str(), cacheFilename.c_str()) != 0)
+    {
+        cerr << "meshcache: failed to write " << cacheFilename << endl;
+        unlink(tempFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool loadMesh(const string &objFilename, MeshBuffers &buffers, const MeshLoadOptions &options)
+{
+    string cacheFilename = meshCacheFilename(objFilename);
+    if (buffers.mapCache(cacheFilename, objFilename, options.obj.quiet))
+        return true;
+    Mesh mesh = loadObj(objFilename, options.obj);
+    if (mesh.indices.empty())
+    {
+        cerr << "No triangles in " << objFilename << endl;
+        return false;
+    }
+    if (options.lods)
+        generateLods(mesh);
+    if (options.optimize)
+        optimizeMesh(mesh);
+    if (options.writeCache)
+        writeMeshCache(cacheFilename, objFilename, mesh);
+    buffers.assign(std::move(mesh));
+    return true;
+}
+
+bool MeshBuffers::mapCache(const string &cacheFilename, const string &objFilename, bool quiet)
+{
+    auto startTime = chrono::steady_clock::now();
+
+    if (!cache.open(cacheFilename))
+        return false;
+
+    auto reject = [&](const char *reason) {
+        if (!quiet)
+            cout << "meshcache: " << cacheFilename << " " << reason << ", loading " << objFilename << endl;
+        cache.close();
+        return false;
+    };
+
+    MeshCacheHeader header;
+    if (cache.size() < sizeof(header))
+        return reject("is truncated");
+    memcpy(&header, cache.begin(), sizeof(header));
+    if (memcmp(header.magic, MESHCACHE_MAGIC, sizeof(header.magic)) != 0 || header.headerSize != sizeof(header))
+        return reject("is not a mesh cache");
+    if (header.version != MESHCACHE_VERSION)
+        return reject("has an old format version");
+    if (header.indexSize != 2 && header.indexSize != 4)
+        return reject("is corrupt");
+
+    uint64_t vertexBytes = header.numVertices * 6 * sizeof(float);
+    uint64_t indexBytes = header.numIndices * header.indexSize;
+    if (header.metaOffset + header.metaSize > cache.size() ||
+        header.vertexOffset % 16 != 0 || header.vertexOffset + vertexBytes > cache.size() ||
+        header.indexOffset % 16 != 0 || header.indexOffset + indexBytes > cache.size())
+        return reject("is truncated");
+
+    const char *meta = cache.begin() + header.metaOffset;
+    string mtlName;
+    vector<Material> cachedMaterials;
+    vector<SubMesh> cachedSubmeshes;
+    vector<MeshLod> cachedLods;
+    if (!deserializeMeta(meta, meta + header.metaSize, header.numMaterials, header.numSubmeshes, header.numLods,
+                         mtlName, cachedMaterials, cachedSubmeshes, cachedLods))
+        return reject("is corrupt");
+    auto rangesValid = [&](const vector<SubMesh> &ranges) {
+        for (const SubMesh &submesh : ranges)
+        {
+            if ((uint64_t)submesh.first + submesh.count > header.numIndices || submesh.materialIndex >= header.numMaterials)
+                return false;
+        }
+        return true;
+    };
+    if (!rangesValid(cachedSubmeshes))
+        return reject("is corrupt");
+    for (const MeshLod &lod : cachedLods)
+    {
+        if (!rangesValid(lod.submeshes))
+            return reject("is corrupt");
+    }
+
+    if (!sourceMatches(objFilename, header.obj))
+        return reject("is stale");
+    if (!mtlName.empty() && !sourceMatches(objDirectory(objFilename) + mtlName, header.mtl))
+        return reject("is stale (material file changed)");
+
+    const char *vertices = cache.begin() + header.vertexOffset;
+    const char *indices = cache.begin() + header.indexOffset;
+    if (hashPayload(meta, header.metaSize, vertices, vertexBytes, indices, indexBytes) != header.payloadHash)
+        return reject("is corrupt");
+
+    ownedVertices.clear();
+    ownedIndices.clear();
+    ownedShortIndices.clear();
+    materials = cachedMaterials;
+    submeshes = cachedSubmeshes;
+    lods = cachedLods;
+    vertexData = (const float *)vertices;
+    vertexCount = header.numVertices;
+    indexData = indices;
+    indexCount = header.numIndices;
+    indexSize = header.indexSize;
+
+    if (quiet)
+        return true;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << "meshcache: mapped " << cacheFilename << " in " << seconds * 1000.0 << " ms, "
+         << numTriangles() << " triangles, " << vertexCount << " vertices, " << lods.size() << " LODs" << endl;
+    return true;
+}
+
+void MeshBuffers::assign(Mesh &&mesh)
+{
+    cache.close();
+    ownedVertices = std::move(mesh.vertices);
+    ownedIndices.clear();
+    ownedShortIndices.clear();
+    materials = std::move(mesh.materials);
+    submeshes = std::move(mesh.submeshes);
+    lods = std::move(mesh.lods);
+
+    vertexData = ownedVertices.data();
+    vertexCount = ownedVertices.size() / 6;
+    if (vertexCount <= 65536)
+    {
+        ownedShortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+        indexData = ownedShortIndices.data();
+        indexSize = sizeof(unsigned short);
+    }
+    else
+    {
+        ownedIndices = std::move(mesh.indices);
+        indexData = ownedIndices.data();
+        indexSize = sizeof(unsigned int);
+    }
+    indexCount = indexSize == 2 ? ownedShortIndices.size() : ownedIndices.size();
+}
+
+void MeshBuffers::assign(StreamedMesh &&mesh)
+{
+    cache.close();
+    ownedVertices.clear();
+    ownedIndices.clear();
+    ownedShortIndices.clear();
+    materials = std::move(mesh.materials);
+    submeshes = std::move(mesh.submeshes);
+    lods.clear();
+
+    vertexData = nullptr;
+    vertexCount = mesh.numVertices;
+    indexData = nullptr;
+    indexCount = mesh.numIndices;
+    indexSize = sizeof(unsigned int);
+}
+
+size_t MeshBuffers::numTriangles() const
+{
+    size_t triangles = 0;
+    for (const SubMesh &submesh : submeshes)
+        triangles += submesh.count / 3;
+    return triangles;
+}
@@ -0,0 +1,78 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include "mappedfile.h"
+#include "objloader.h"
+
+#include <string>
+#include <vector>
+
+// .meshbin is a binary cache of a loaded Mesh: a versioned header, the
+// size/mtime/content hash of the OBJ and MTL it was built from, the
+// materials, per-material index ranges with their bounds, the index ranges
+// of every LOD, and the final vertex and index buffers laid out exactly as
+// they are uploaded.
+
+// "data/pawn.obj" -> "data/pawn.meshbin"
+std::string meshCacheFilename(const std::string &objFilename);
+
+// Writes mesh to cacheFilename through a temporary file and a rename, so a
+// reader never sees a partially written cache.
+bool writeMeshCache(const std::string &cacheFilename, const std::string &objFilename, const Mesh &mesh);
+
+// Vertex and index buffers ready for glBufferData. They either point straight
+// into a mapped .meshbin or are taken over from a freshly loaded Mesh.
+class MeshBuffers
+{
+public:
+    // Maps the cache and checks it against the OBJ/MTL on disk. Returns false
+    // if the cache is missing, stale or corrupt. quiet leaves stdout alone.
+    bool mapCache(const std::string &cacheFilename, const std::string &objFilename, bool quiet = false);
+    void assign(Mesh &&mesh);
+    // A streamed mesh is only on the GPU: vertices() and indices() are null.
+    void assign(StreamedMesh &&mesh);
+
+    const float *vertices() const { return vertexData; }
+    size_t numVertices() const { return vertexCount; }
+    size_t vertexBytes() const { return vertexCount * 6 * sizeof(float); }
+
+    const void *indices() const { return indexData; }
+    size_t numIndices() const { return indexCount; }
+    bool shortIndices() const { return indexSize == 2; }
+    size_t indexBytes() const { return indexCount * indexSize; }
+    // full-detail triangles, without the LODs
+    size_t numTriangles() const;
+
+    std::vector<Material> materials;
+    std::vector<SubMesh> submeshes;
+    std::vector<MeshLod> lods;
+
+private:
+    MappedFile cache;
+    std::vector<float> ownedVertices;
+    std::vector<unsigned int> ownedIndices;
+    std::vector<unsigned short> ownedShortIndices;
+
+    const float *vertexData = nullptr;
+    size_t vertexCount = 0;
+    const void *indexData = nullptr;
+    size_t indexCount = 0;
+    size_t indexSize = 4;
+};
+
+// What loadMesh does on a cache miss besides parsing the OBJ.
+struct MeshLoadOptions
+{
+    ObjLoadOptions obj;     // its quiet also silences the cache's report
+    bool lods = true;       // generateLods
+    bool optimize = true;   // optimizeMesh
+    bool writeCache = true; // rewrite the .meshbin next to the OBJ
+};
+
+// Maps the .meshbin cache next to objFilename when it is current, otherwise
+// loads the OBJ, generates its LODs, optimizes the triangle and vertex order
+// and rewrites the cache, as far as options ask for. Returns false if
+// nothing was loaded.
+bool loadMesh(const std::string &objFilename, MeshBuffers &buffers, const MeshLoadOptions &options = MeshLoadOptions());
+
+#endif
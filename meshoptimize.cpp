@@ -0,0 +1,460 @@
+#include "meshoptimize.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+    const uint32_t NO_VERTEX = 0xffffffffu;
+    // overdraw figures taken while loading: the first and last report, and
+    // the check of every cluster sort
+    const int LOAD_OVERDRAW_RESOLUTION = 64;
+    const size_t FETCH_LINE = 64;
+    const size_t FETCH_CACHE_LINES = 64;
+    // clusters smaller than this are not split further
+    const size_t MIN_CLUSTER_TRIANGLES = 16;
+
+    glm::vec3 position(const vector<float> &vertices, unsigned int index)
+    {
+        const float *v = &vertices[(size_t)index * 6];
+        return glm::vec3(v[0], v[1], v[2]);
+    }
+
+    // FIFO cache misses of a triangle list
+    size_t countCacheMisses(const unsigned int *indices, size_t numIndices, size_t numVertices, unsigned int cacheSize)
+    {
+        // a vertex is cached while fewer than cacheSize misses happened since its own
+        vector<size_t> missedAt(numVertices, 0);
+        size_t misses = 0;
+        for (size_t i = 0; i < numIndices; i++)
+        {
+            size_t &stamp = missedAt[indices[i]];
+            if (stamp == 0 || misses - stamp >= cacheSize)
+                stamp = ++misses;
+        }
+        return misses;
+    }
+
+    // Rasterizes the triangles, in order, with a depth test and counts how
+    // many fragments pass compared to how many pixels end up covered. Both
+    // faces are drawn, as the renderer does not cull.
+    void rasterizeView(const vector<float> &vertices, const unsigned int *indices, size_t numIndices,
+                       const glm::vec3 &axisX, const glm::vec3 &axisY, const glm::vec3 &axisZ,
+                       const glm::vec3 &center, float extent, int size, size_t &shaded, size_t &covered)
+    {
+        vector<float> depth((size_t)size * size, INFINITY);
+        float toPixels = size * 0.5f / extent;
+        for (size_t t = 0; t + 2 < numIndices; t += 3)
+        {
+            glm::vec3 p[3];
+            for (int k = 0; k < 3; k++)
+            {
+                glm::vec3 d = position(vertices, indices[t + k]) - center;
+                p[k] = glm::vec3(glm::dot(d, axisX) * toPixels + size * 0.5f, glm::dot(d, axisY) * toPixels + size * 0.5f, glm::dot(d, axisZ));
+            }
+            float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+            if (area == 0.0f)
+                continue;
+            int minX = max(0, (int)floor(min(p[0].x, min(p[1].x, p[2].x))));
+            int maxX = min(size - 1, (int)ceil(max(p[0].x, max(p[1].x, p[2].x))));
+            int minY = max(0, (int)floor(min(p[0].y, min(p[1].y, p[2].y))));
+            int maxY = min(size - 1, (int)ceil(max(p[0].y, max(p[1].y, p[2].y))));
+            for (int y = minY; y <= maxY; y++)
+            {
+                for (int x = minX; x <= maxX; x++)
+                {
+                    float px = x + 0.5f, py = y + 0.5f;
+                    float w0 = ((p[1].x - px) * (p[2].y - py) - (p[2].x - px) * (p[1].y - py)) / area;
+                    float w1 = ((p[2].x - px) * (p[0].y - py) - (p[0].x - px) * (p[2].y - py)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                        continue;
+                    float z = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+                    float &stored = depth[(size_t)y * size + x];
+                    if (z < stored)
+                    {
+                        covered += stored == INFINITY;
+                        stored = z;
+                        shaded++;
+                    }
+                }
+            }
+        }
+    }
+
+    // fragments shaded per covered pixel over orthographic views from the
+    // six axis directions and the eight corners
+    float measureOverdraw(const vector<float> &vertices, const unsigned int *indices, size_t numIndices, int resolution)
+    {
+        glm::vec3 boundsMin = position(vertices, indices[0]), boundsMax = boundsMin;
+        for (size_t i = 0; i < numIndices; i++)
+        {
+            boundsMin = glm::min(boundsMin, position(vertices, indices[i]));
+            boundsMax = glm::max(boundsMax, position(vertices, indices[i]));
+        }
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        float extent = max(glm::length(boundsMax - boundsMin) * 0.5f, 1e-6f);
+        size_t shaded = 0, covered = 0;
+        for (int view = 0; view < 14; view++)
+        {
+            glm::vec3 direction;
+            if (view < 6)
+            {
+                direction = glm::vec3(0.0f);
+                direction[view / 2] = view % 2 == 0 ? 1.0f : -1.0f;
+            }
+            else
+            {
+                int corner = view - 6;
+                direction = glm::normalize(glm::vec3(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f));
+            }
+            glm::vec3 up = fabs(direction.y) > 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::vec3 axisX = glm::normalize(glm::cross(up, direction));
+            glm::vec3 axisY = glm::cross(direction, axisX);
+            rasterizeView(vertices, indices, numIndices, axisX, axisY, direction, center, extent, resolution, shaded, covered);
+        }
+        return covered > 0 ? (float)shaded / covered : 0.0f;
+    }
+
+    // Tipsify's choice of the next fanning vertex: among the vertices just
+    // emitted that still have triangles, the one that has been in the cache
+    // longest without falling out once its triangles are emitted
+    uint32_t nextFanningVertex(const vector<uint32_t> &candidates, const vector<uint32_t> &liveTriangles,
+                               const vector<size_t> &cacheTime, size_t timestamp, unsigned int cacheSize)
+    {
+        uint32_t best = NO_VERTEX;
+        long bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (liveTriangles[v] == 0)
+                continue;
+            long priority = 0;
+            if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                priority = (long)(timestamp - cacheTime[v]);
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = v;
+            }
+        }
+        return best;
+    }
+}
+
+MeshOrderStats analyzeMeshOrder(const vector<float> &vertices, const unsigned int *indices, size_t numIndices, int overdrawResolution)
+{
+    MeshOrderStats stats = {0.0f, 0.0f, 0.0f, 0.0f};
+    size_t numVertices = vertices.size() / 6;
+    if (numIndices < 3)
+        return stats;
+
+    size_t misses = countCacheMisses(indices, numIndices, numVertices, VERTEX_CACHE_SIZE);
+    vector<char> used(numVertices, 0);
+    size_t usedVertices = 0;
+    for (size_t i = 0; i < numIndices; i++)
+    {
+        usedVertices += !used[indices[i]];
+        used[indices[i]] = 1;
+    }
+    stats.acmr = (float)misses / (numIndices / 3);
+    stats.atvr = (float)misses / usedVertices;
+
+    // the vertices of a miss are read through a small LRU of cache lines
+    const size_t vertexBytes = 6 * sizeof(float);
+    vector<size_t> lines;
+    size_t linesRead = 0;
+    vector<size_t> missedAt(numVertices, 0);
+    size_t vertexMisses = 0;
+    for (size_t i = 0; i < numIndices; i++)
+    {
+        size_t &stamp = missedAt[indices[i]];
+        if (stamp != 0 && vertexMisses - stamp < VERTEX_CACHE_SIZE)
+            continue;
+        stamp = ++vertexMisses;
+        size_t first = indices[i] * vertexBytes / FETCH_LINE, last = (indices[i] * vertexBytes + vertexBytes - 1) / FETCH_LINE;
+        for (size_t line = first; line <= last; line++)
+        {
+            auto found = find(lines.begin(), lines.end(), line);
+            if (found != lines.end())
+                lines.erase(found);
+            else
+                linesRead++;
+            lines.push_back(line);
+            if (lines.size() > FETCH_CACHE_LINES)
+                lines.erase(lines.begin());
+        }
+    }
+    stats.overfetch = (float)(linesRead * FETCH_LINE) / (usedVertices * vertexBytes);
+    if (overdrawResolution <= 0)
+        return stats;
+
+    stats.overdraw = measureOverdraw(vertices, indices, numIndices, overdrawResolution);
+    return stats;
+}
+
+void optimizeVertexCache(unsigned int *indices, size_t numIndices, size_t numVertices,
+                         vector<size_t> &clusterStarts, unsigned int cacheSize)
+{
+    size_t numTriangles = numIndices / 3;
+    clusterStarts.clear();
+    if (numTriangles == 0)
+        return;
+
+    // triangles around each vertex: adjacency[adjacencyStart[v], adjacencyStart[v + 1])
+    vector<uint32_t> liveTriangles(numVertices, 0);
+    for (size_t i = 0; i < numTriangles * 3; i++)
+        liveTriangles[indices[i]]++;
+    vector<size_t> adjacencyStart(numVertices + 1, 0);
+    for (size_t v = 0; v < numVertices; v++)
+        adjacencyStart[v + 1] = adjacencyStart[v] + liveTriangles[v];
+    vector<uint32_t> adjacency(numTriangles * 3);
+    vector<size_t> next(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < numTriangles * 3; i++)
+        adjacency[next[indices[i]]++] = (uint32_t)(i / 3);
+
+    vector<size_t> cacheTime(numVertices, 0);
+    vector<char> emitted(numTriangles, 0);
+    vector<uint32_t> deadEnds; // recently used vertices, to resume from
+    vector<uint32_t> candidates;
+    vector<unsigned int> output;
+    output.reserve(numTriangles * 3);
+    size_t timestamp = cacheSize + 1;
+    size_t cursor = 0; // next vertex to scan for when all else is dead
+
+    uint32_t fanning = indices[0];
+    bool jumped = true;
+    while (fanning != NO_VERTEX)
+    {
+        if (jumped)
+            clusterStarts.push_back(output.size() / 3);
+        candidates.clear();
+        for (size_t a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; a++)
+        {
+            uint32_t t = adjacency[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = indices[(size_t)t * 3 + k];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (timestamp - cacheTime[v] > cacheSize)
+                    cacheTime[v] = timestamp++;
+            }
+        }
+
+        fanning = nextFanningVertex(candidates, liveTriangles, cacheTime, timestamp, cacheSize);
+        jumped = false;
+        if (fanning != NO_VERTEX)
+            continue;
+        // dead end: go back to a recent vertex, or scan for any live one
+        while (!deadEnds.empty() && fanning == NO_VERTEX)
+        {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0)
+                fanning = v;
+        }
+        while (fanning == NO_VERTEX && cursor < numVertices)
+        {
+            if (liveTriangles[cursor] > 0)
+            {
+                fanning = (uint32_t)cursor;
+                jumped = true;
+            }
+            cursor++;
+        }
+    }
+    copy(output.begin(), output.end(), indices);
+}
+
+void optimizeOverdraw(const vector<float> &vertices, unsigned int *indices, size_t numIndices,
+                      const vector<size_t> &clusterStarts, float threshold)
+{
+    size_t numTriangles = numIndices / 3;
+    size_t numVertices = vertices.size() / 6;
+    if (numTriangles == 0)
+        return;
+
+    // Soft boundaries: a run is cut wherever the part since the last cut,
+    // starting from a cold cache, already does as well as the whole run
+    // did. Clusters are then drawn in any order at the cost of at most
+    // threshold times the run's misses.
+    vector<size_t> starts;
+    vector<size_t> missedAt(numVertices, 0);
+    size_t misses = 0, coldFrom = 0;
+    auto visit = [&](size_t t) {
+        for (int k = 0; k < 3; k++)
+        {
+            size_t &stamp = missedAt[indices[t * 3 + k]];
+            if (stamp <= coldFrom || misses - stamp >= VERTEX_CACHE_SIZE)
+                stamp = ++misses;
+        }
+    };
+    for (size_t c = 0; c < clusterStarts.size(); c++)
+    {
+        size_t start = clusterStarts[c];
+        size_t end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : numTriangles;
+        coldFrom = misses;
+        for (size_t t = start; t < end; t++)
+            visit(t);
+        float runAcmr = (float)(misses - coldFrom) / (end - start);
+
+        starts.push_back(start);
+        coldFrom = misses;
+        for (size_t t = start; t < end; t++)
+        {
+            visit(t);
+            size_t count = t + 1 - start;
+            if (count >= MIN_CLUSTER_TRIANGLES && t + 1 < end && (float)(misses - coldFrom) / count <= runAcmr * threshold)
+            {
+                start = t + 1;
+                coldFrom = misses;
+                starts.push_back(start);
+            }
+        }
+    }
+
+    // sort by how much each cluster faces away from the mesh center
+    glm::vec3 meshCenter(0.0f);
+    for (size_t i = 0; i < numIndices; i++)
+        meshCenter += position(vertices, indices[i]);
+    meshCenter /= (float)numIndices;
+    struct Cluster
+    {
+        size_t first, count;
+        float sortKey;
+    };
+    vector<Cluster> clusters(starts.size());
+    for (size_t c = 0; c < starts.size(); c++)
+    {
+        size_t end = c + 1 < starts.size() ? starts[c + 1] : numTriangles;
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = starts[c]; t < end; t++)
+        {
+            glm::vec3 p0 = position(vertices, indices[t * 3]);
+            glm::vec3 p1 = position(vertices, indices[t * 3 + 1]);
+            glm::vec3 p2 = position(vertices, indices[t * 3 + 2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+            float a = glm::length(n);
+            centroid += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        float normalLength = glm::length(normal);
+        float key = 0.0f;
+        if (area > 0.0f && normalLength > 0.0f)
+            key = glm::dot(centroid / area - meshCenter, normal / normalLength);
+        clusters[c] = Cluster{starts[c], end - starts[c], key};
+    }
+    stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+    vector<unsigned int> sorted;
+    sorted.reserve(numTriangles * 3);
+    for (const Cluster &cluster : clusters)
+        sorted.insert(sorted.end(), indices + cluster.first * 3, indices + (cluster.first + cluster.count) * 3);
+    // nothing is culled, so the clusters facing away are drawn over as well
+    // and the sort can just as well add overdraw; keep it only where it helps
+    if (measureOverdraw(vertices, sorted.data(), numIndices, LOAD_OVERDRAW_RESOLUTION) <
+        measureOverdraw(vertices, indices, numIndices, LOAD_OVERDRAW_RESOLUTION))
+        copy(sorted.begin(), sorted.end(), indices);
+}
+
+void optimizeVertexFetch(Mesh &mesh)
+{
+    // the full mesh comes first in the index buffer, and the LODs only use
+    // its vertices, so first use over the whole buffer follows the full mesh
+    size_t numVertices = mesh.numVertices();
+    vector<uint32_t> remap(numVertices, NO_VERTEX);
+    uint32_t nextVertex = 0;
+    for (unsigned int &index : mesh.indices)
+    {
+        if (remap[index] == NO_VERTEX)
+            remap[index] = nextVertex++;
+        index = remap[index];
+    }
+
+    // vertices no triangle uses go last, in their old order
+    vector<float> reordered(mesh.vertices.size());
+    for (size_t v = 0; v < numVertices; v++)
+    {
+        if (remap[v] == NO_VERTEX)
+            remap[v] = nextVertex++;
+        copy(&mesh.vertices[v * 6], &mesh.vertices[v * 6] + 6, &reordered[(size_t)remap[v] * 6]);
+    }
+    mesh.vertices.swap(reordered);
+}
+
+void optimizeMesh(Mesh &mesh, const atomic<bool> *cancel)
+{
+    auto startTime = chrono::steady_clock::now();
+    size_t fullIndices = 0;
+    for (const SubMesh &submesh : mesh.submeshes)
+        fullIndices = max(fullIndices, (size_t)submesh.first + submesh.count);
+    // overdraw only in the first and last report, the others are cheap
+    auto report = [&](const char *stage, int overdrawResolution) {
+        MeshOrderStats stats = analyzeMeshOrder(mesh.vertices, mesh.indices.data(), fullIndices, overdrawResolution);
+        cout << "optimize: " << stage << ": ACMR " << stats.acmr << ", ATVR " << stats.atvr;
+        if (overdrawResolution > 0)
+            cout << ", overdraw " << stats.overdraw;
+        cout << ", overfetch " << stats.overfetch << endl;
+        return stats;
+    };
+    MeshOrderStats input = report("input", LOAD_OVERDRAW_RESOLUTION);
+    vector<unsigned int> inputIndices = mesh.indices;
+    vector<float> inputVertices = mesh.vertices;
+
+    // every submesh of every level is its own draw, so each is ordered alone
+    vector<SubMesh> ranges = mesh.submeshes;
+    for (const MeshLod &lod : mesh.lods)
+        ranges.insert(ranges.end(), lod.submeshes.begin(), lod.submeshes.end());
+    auto cancelled = [&] { return cancel != nullptr && *cancel; };
+    vector<vector<size_t>> clusterStarts(ranges.size());
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        if (cancelled())
+            return;
+        optimizeVertexCache(&mesh.indices[ranges[i].first], ranges[i].count, mesh.numVertices(), clusterStarts[i]);
+    }
+    report("vertex cache", 0);
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        if (cancelled())
+            return;
+        optimizeOverdraw(mesh.vertices, &mesh.indices[ranges[i].first], ranges[i].count, clusterStarts[i]);
+    }
+    MeshOrderStats sorted = report("overdraw", 0);
+    vector<unsigned int> sortedIndices = mesh.indices;
+    vector<float> sortedVertices = mesh.vertices;
+    optimizeVertexFetch(mesh);
+    // vertices shared by triangles far apart in the new order are read
+    // again however they are numbered; first use does not always help
+    if (analyzeMeshOrder(mesh.vertices, mesh.indices.data(), fullIndices, 0).overfetch > sorted.overfetch)
+    {
+        mesh.indices.swap(sortedIndices);
+        mesh.vertices.swap(sortedVertices);
+    }
+    MeshOrderStats optimized = report("vertex fetch", LOAD_OVERDRAW_RESOLUTION);
+
+    // the stages trade the figures against each other, and the input order
+    // can already be the better one; it is kept unless nothing got worse
+    if (optimized.acmr > input.acmr || optimized.overdraw > input.overdraw || optimized.overfetch > input.overfetch)
+    {
+        mesh.indices.swap(inputIndices);
+        mesh.vertices.swap(inputVertices);
+        cout << "optimize: kept the input order, which measures better on some figure" << endl;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << "optimize: " << ranges.size() << " index ranges in " << seconds * 1000.0 << " ms" << endl;
+}
@@ -0,0 +1,57 @@
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "objloader.h"
+
+// post-transform cache entries the reordering and the statistics assume
+const unsigned int VERTEX_CACHE_SIZE = 16;
+// overdraw is measured on orthographic views of this many pixels square
+const int OVERDRAW_RESOLUTION = 256;
+
+struct MeshOrderStats
+{
+    float acmr;      // vertex shader runs per triangle with a FIFO cache
+    float atvr;      // vertex shader runs per vertex used; 1 is ideal
+    float overdraw;  // fragments shaded per covered pixel, over several views
+    float overfetch; // vertex bytes read through 64 byte lines per byte used
+};
+
+// Measures one triangle list over interleaved position/normal vertices.
+// Overdraw rasterizes 14 views of overdrawResolution pixels square, which
+// dominates the cost; 0 skips it and leaves overdraw at 0.
+MeshOrderStats analyzeMeshOrder(const std::vector<float> &vertices, const unsigned int *indices, size_t numIndices,
+                                int overdrawResolution = OVERDRAW_RESOLUTION);
+
+// Tipsify (Sander et al. 2007): reorders triangles in place so that
+// consecutive triangles share vertices still in a cache of cacheSize.
+// clusterStarts receives the first triangle of every run that began after
+// the cache had to be given up, the natural places to cut for overdraw.
+void optimizeVertexCache(unsigned int *indices, size_t numIndices, size_t numVertices,
+                         std::vector<size_t> &clusterStarts, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Splits the runs further wherever the cache efficiency so far is within
+// threshold of the whole list's, then sorts the clusters so those facing
+// away from the mesh center come first. Drawn from outside, they tend to
+// cover the rest, which early depth testing can then reject. The sorted
+// order is only kept when it measures less overdraw than the given one.
+void optimizeOverdraw(const std::vector<float> &vertices, unsigned int *indices, size_t numIndices,
+                      const std::vector<size_t> &clusterStarts, float threshold = 1.05f);
+
+// Renumbers the vertices in the order the indices first use them, so the
+// vertex fetch walks the buffer mostly forward. optimizeMesh keeps the old
+// numbering when this measures more overfetch.
+void optimizeVertexFetch(Mesh &mesh);
+
+// Runs all three stages over every submesh of every level and prints the
+// statistics of the full-detail mesh before and after each, overdraw only
+// before and after all of them and on a coarse grid, so that loading does
+// not pay for more than a rough figure. The input order is kept when the
+// result measures worse on any figure.
+// Once cancel turns true it returns with the ranges done so far reordered.
+void optimizeMesh(Mesh &mesh, const std::atomic<bool> *cancel = nullptr);
+
+#endif
@@ -0,0 +1,1068 @@
+#include "objloader.h"
+#include "mappedfile.h"
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/resource.h>
+#include <unordered_map>
+
+using namespace std;
+
+namespace
+{
+    // Tokenizer helpers. They all scan [p, end) of a mapped file in place and
+    // never allocate; p is advanced past whatever was consumed.
+
+    inline bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char *skipBlanks(const char *p, const char *end)
+    {
+        while (p < end && isBlank(*p))
+            ++p;
+        return p;
+    }
+
+    inline const char *findLineEnd(const char *p, const char *end)
+    {
+        const void *nl = memchr(p, '\n', end - p);
+        return nl ? (const char *)nl : end;
+    }
+
+    // keyword followed by at least one blank, e.g. "usemtl "
+    inline bool hasKeyword(const char *p, const char *end, const char *keyword, size_t length)
+    {
+        return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && isBlank(p[length]);
+    }
+
+    inline bool parseFloat(const char *&p, const char *end, float &value)
+    {
+        p = skipBlanks(p, end);
+        if (p < end && *p == '+')
+            ++p;
+        from_chars_result result = from_chars(p, end, value);
+        if (result.ec == errc::result_out_of_range)
+            value = 0.0f;
+        else if (result.ec != errc())
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    inline bool parseIndex(const char *&p, const char *end, int &value)
+    {
+        p = skipBlanks(p, end);
+        if (p < end && *p == '+')
+            ++p;
+        from_chars_result result = from_chars(p, end, value);
+        if (result.ec != errc())
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    inline bool parseVec3(const char *p, const char *end, glm::vec3 &value)
+    {
+        return parseFloat(p, end, value.x) && parseFloat(p, end, value.y) && parseFloat(p, end, value.z);
+    }
+
+    // rest of the line without surrounding blanks (mtllib/usemtl/newmtl names)
+    inline string restOfLine(const char *p, const char *end)
+    {
+        p = skipBlanks(p, end);
+        while (end > p && isBlank(end[-1]))
+            --end;
+        return string(p, end);
+    }
+
+    // OBJ indices are 1-based, negative values are relative to the current end
+    inline bool resolveIndex(int index, size_t count, size_t &resolved)
+    {
+        if (index > 0 && (size_t)index <= count)
+        {
+            resolved = (size_t)index - 1;
+            return true;
+        }
+        if (index < 0 && (size_t)(-(long)index) <= count)
+        {
+            resolved = count - (size_t)(-(long)index);
+            return true;
+        }
+        return false;
+    }
+
+    // one "v/vt/vn" group of a face; 0 means the component was absent
+    struct FaceCorner
+    {
+        int v, n;
+    };
+
+    // parses the corners after "f" into face, reusing its storage
+    void parseFace(const char *p, const char *end, vector<FaceCorner> &face)
+    {
+        face.clear();
+        while (true)
+        {
+            p = skipBlanks(p, end);
+            if (p >= end)
+                break;
+            FaceCorner corner = {0, 0};
+            if (!parseIndex(p, end, corner.v))
+                break;
+            if (p < end && *p == '/')
+            {
+                ++p;
+                // texture coordinates are not used by the renderer
+                int texcoord;
+                if (p < end && *p != '/')
+                    parseIndex(p, end, texcoord);
+                if (p < end && *p == '/')
+                {
+                    ++p;
+                    parseIndex(p, end, corner.n);
+                }
+            }
+            face.push_back(corner);
+        }
+    }
+
+    void loadMtl(const string &filename, vector<Material> &materials)
+    {
+        MappedFile file(filename);
+        if (!file.isOpen())
+        {
+            cerr << "Failed to open material file: " << filename << endl;
+            return;
+        }
+
+        // materials are kept in declaration order so usemtl can refer to them by index
+        Material currentMat = Material();
+        const char *p = file.begin();
+        const char *end = file.end();
+        while (p < end)
+        {
+            const char *lineEnd = findLineEnd(p, end);
+            p = skipBlanks(p, lineEnd);
+            glm::vec3 value;
+            if (hasKeyword(p, lineEnd, "newmtl", 6))
+            {
+                if (!currentMat.name.empty())
+                {
+                    materials.push_back(currentMat);
+                }
+                currentMat = Material(glm::vec3(0.0f), 0.0f, 0.0f, 0.0f, 0.0f);
+                currentMat.name = restOfLine(p + 6, lineEnd);
+            }
+            else if (hasKeyword(p, lineEnd, "Ka", 2))
+            {
+                const char *q = p + 2;
+                parseFloat(q, lineEnd, currentMat.ka);
+            }
+            else if (hasKeyword(p, lineEnd, "Kd", 2))
+            {
+                if (parseVec3(p + 2, lineEnd, value))
+                    currentMat.color = value;
+                currentMat.kd = 1.0f;
+            }
+            else if (hasKeyword(p, lineEnd, "Ks", 2))
+            {
+                const char *q = p + 2;
+                parseFloat(q, lineEnd, currentMat.ks);
+            }
+            else if (hasKeyword(p, lineEnd, "Ns", 2))
+            {
+                const char *q = p + 2;
+                parseFloat(q, lineEnd, currentMat.ns);
+            }
+            p = lineEnd + 1;
+        }
+        if (!currentMat.name.empty())
+        {
+            materials.push_back(currentMat);
+        }
+    }
+
+    enum LineType
+    {
+        LINE_OTHER,
+        LINE_VERTEX,
+        LINE_NORMAL,
+        LINE_FACE,
+        LINE_MTLLIB,
+        LINE_USEMTL
+    };
+
+    // identifies the statement at p; args points just past its keyword
+    inline LineType classifyLine(const char *p, const char *lineEnd, const char *&args)
+    {
+        if (lineEnd - p < 2)
+            return LINE_OTHER;
+        if (p[0] == 'v' && isBlank(p[1]))
+        {
+            args = p + 1;
+            return LINE_VERTEX;
+        }
+        if (p[0] == 'v' && p[1] == 'n' && lineEnd - p > 2 && isBlank(p[2]))
+        {
+            args = p + 2;
+            return LINE_NORMAL;
+        }
+        if (p[0] == 'f' && isBlank(p[1]))
+        {
+            args = p + 1;
+            return LINE_FACE;
+        }
+        if (hasKeyword(p, lineEnd, "mtllib", 6))
+        {
+            args = p + 6;
+            return LINE_MTLLIB;
+        }
+        if (hasKeyword(p, lineEnd, "usemtl", 6))
+        {
+            args = p + 6;
+            return LINE_USEMTL;
+        }
+        return LINE_OTHER;
+    }
+
+    // number of triangles the fan of a face line expands to; agrees with
+    // parseFace, which stops at the first group that is not an index
+    inline size_t countFaceTriangles(const char *p, const char *end)
+    {
+        size_t corners = 0;
+        while (true)
+        {
+            p = skipBlanks(p, end);
+            if (p >= end || !(isdigit((unsigned char)*p) || *p == '-' || *p == '+'))
+                break;
+            corners++;
+            while (p < end && !isBlank(*p))
+                ++p;
+        }
+        return corners > 2 ? corners - 2 : 0;
+    }
+
+    // A newline-aligned slice of the OBJ file. The first pass counts what the
+    // slice contains, a prefix sum over the counts gives each slice the global
+    // index of its first v/vn/triangle, and the later passes write straight
+    // into those slots of the shared arrays.
+    struct ObjChunk
+    {
+        const char *begin, *end;
+        size_t numVertices = 0, numNormals = 0, numTriangles = 0;
+        size_t vertexBase = 0, normalBase = 0, triangleBase = 0;
+        size_t skippedTriangles = 0;
+        string mtlFilename;
+        // last usemtl of the chunk, and the material active where it starts
+        string lastMaterial;
+        bool setsMaterial = false;
+        uint32_t startMaterial = 0;
+        size_t unknownMaterials = 0;
+        // triangles before the first usemtl, and after each usemtl by name
+        size_t leadingTriangles = 0;
+        unordered_map<string, size_t> materialTriangles;
+    };
+
+    void countChunk(ObjChunk &chunk)
+    {
+        size_t *materialRun = &chunk.leadingTriangles;
+        const char *p = chunk.begin;
+        while (p < chunk.end)
+        {
+            const char *lineEnd = findLineEnd(p, chunk.end);
+            p = skipBlanks(p, lineEnd);
+            const char *args;
+            size_t triangles;
+            switch (classifyLine(p, lineEnd, args))
+            {
+            case LINE_VERTEX:
+                chunk.numVertices++;
+                break;
+            case LINE_NORMAL:
+                chunk.numNormals++;
+                break;
+            case LINE_FACE:
+                triangles = countFaceTriangles(args, lineEnd);
+                chunk.numTriangles += triangles;
+                *materialRun += triangles;
+                break;
+            case LINE_MTLLIB:
+                if (chunk.mtlFilename.empty())
+                    chunk.mtlFilename = restOfLine(args, lineEnd);
+                break;
+            case LINE_USEMTL:
+                chunk.lastMaterial = restOfLine(args, lineEnd);
+                chunk.setsMaterial = true;
+                materialRun = &chunk.materialTriangles[chunk.lastMaterial];
+                break;
+            default:
+                break;
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    void parseChunkAttributes(const ObjChunk &chunk, glm::vec3 *vertices, glm::vec3 *normals)
+    {
+        glm::vec3 *vertex = vertices + chunk.vertexBase;
+        glm::vec3 *normal = normals + chunk.normalBase;
+        const char *p = chunk.begin;
+        while (p < chunk.end)
+        {
+            const char *lineEnd = findLineEnd(p, chunk.end);
+            p = skipBlanks(p, lineEnd);
+            const char *args;
+            LineType type = classifyLine(p, lineEnd, args);
+            // a malformed line still owns its slot, it just stays zero
+            if (type == LINE_VERTEX)
+                parseVec3(args, lineEnd, *vertex++);
+            else if (type == LINE_NORMAL)
+                parseVec3(args, lineEnd, *normal++);
+            p = lineEnd + 1;
+        }
+    }
+
+    // position and normal index of one triangle corner
+    struct CornerKey
+    {
+        uint32_t v, n;
+    };
+
+    const uint32_t NO_INDEX = 0xffffffffu;
+
+    // usemtl name -> index into Mesh::materials
+    typedef unordered_map<string, uint32_t> MaterialIndex;
+
+    // Resolves the faces of a chunk into corner keys, 3 per fan triangle, and
+    // the material of every triangle; keys and triangleMaterials point at the
+    // chunk's slice of the shared arrays.
+    // A triangle that cannot be emitted gets v = NO_INDEX on its first corner;
+    // one without normals gets n = NO_INDEX on all three and is given its
+    // flat face normal later.
+    void parseChunkFaces(ObjChunk &chunk, const MaterialIndex &materialIndex, uint32_t defaultMaterial, CornerKey *keys, uint32_t *triangleMaterials)
+    {
+        // indices resolve against what has been defined up to this line
+        size_t vertexCount = chunk.vertexBase;
+        size_t normalCount = chunk.normalBase;
+        CornerKey *out = keys;
+        uint32_t *outMaterial = triangleMaterials;
+        uint32_t currentMaterial = chunk.startMaterial;
+        vector<FaceCorner> face;
+
+        const char *p = chunk.begin;
+        while (p < chunk.end)
+        {
+            const char *lineEnd = findLineEnd(p, chunk.end);
+            p = skipBlanks(p, lineEnd);
+            const char *args;
+            LineType type = classifyLine(p, lineEnd, args);
+            if (type == LINE_VERTEX)
+                vertexCount++;
+            else if (type == LINE_NORMAL)
+                normalCount++;
+            else if (type == LINE_USEMTL)
+            {
+                MaterialIndex::const_iterator it = materialIndex.find(restOfLine(args, lineEnd));
+                if (it == materialIndex.end())
+                    chunk.unknownMaterials++;
+                currentMaterial = it != materialIndex.end() ? it->second : defaultMaterial;
+            }
+            else if (type == LINE_FACE)
+            {
+                size_t expected = countFaceTriangles(args, lineEnd);
+                parseFace(args, lineEnd, face);
+
+                // triangulate the face as a fan around its first corner
+                for (size_t i = 1; i <= expected; i++, out += 3)
+                {
+                    *outMaterial++ = currentMaterial;
+                    size_t v[3], n[3];
+                    bool valid = i + 1 < face.size();
+                    bool hasNormals = true;
+                    for (int k = 0; k < 3 && valid; k++)
+                    {
+                        const FaceCorner &corner = face[k == 0 ? 0 : i + k - 1];
+                        valid = resolveIndex(corner.v, vertexCount, v[k]);
+                        hasNormals = hasNormals && corner.n != 0 && resolveIndex(corner.n, normalCount, n[k]);
+                    }
+                    if (!valid)
+                    {
+                        out[0].v = NO_INDEX;
+                        chunk.skippedTriangles++;
+                        continue;
+                    }
+                    for (int k = 0; k < 3; k++)
+                    {
+                        out[k].v = (uint32_t)v[k];
+                        out[k].n = hasNormals ? (uint32_t)n[k] : NO_INDEX;
+                    }
+                }
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    // Hash table from a (v, vn) pair to the index of the output vertex that
+    // was emitted for it. The position index is its own hash: every position
+    // has a bucket, chained through the vertices emitted for it, and a bucket
+    // holds one entry per distinct normal the position is used with (one for
+    // smooth surfaces, a handful along hard edges). Output vertex i is entry i.
+    class CornerTable
+    {
+    public:
+        explicit CornerTable(size_t numPositions) : buckets(numPositions, NO_INDEX) {}
+
+        void reserve(size_t numEntries) { entries.reserve(numEntries); }
+
+        // vertex emitted for (v, n); a new one is added if there is none yet
+        uint32_t findOrInsert(uint32_t v, uint32_t n, bool &inserted)
+        {
+            for (uint32_t i = buckets[v]; i != NO_INDEX; i = entries[i].next)
+            {
+                if (entries[i].n == n)
+                {
+                    inserted = false;
+                    return entries[i].vertex;
+                }
+            }
+            uint32_t vertex = (uint32_t)entries.size();
+            entries.push_back(Entry{n, vertex, buckets[v]});
+            buckets[v] = vertex;
+            inserted = true;
+            return vertex;
+        }
+
+    private:
+        struct Entry
+        {
+            uint32_t n, vertex, next;
+        };
+
+        vector<uint32_t> buckets;
+        vector<Entry> entries;
+    };
+
+    inline void pushVertex(vector<float> &out, const glm::vec3 &position, const glm::vec3 &normal)
+    {
+        out.push_back(position.x);
+        out.push_back(position.y);
+        out.push_back(position.z);
+        out.push_back(normal.x);
+        out.push_back(normal.y);
+        out.push_back(normal.z);
+    }
+
+    // splits [begin, end) into about count pieces that each start on a new line
+    vector<ObjChunk> splitChunks(const char *begin, const char *end, size_t count)
+    {
+        vector<ObjChunk> chunks;
+        size_t size = end - begin;
+        const char *p = begin;
+        for (size_t i = 1; i <= count && p < end; i++)
+        {
+            const char *split = i == count ? end : begin + size * i / count;
+            if (split < p)
+                split = p;
+            if (split < end)
+            {
+                split = findLineEnd(split, end);
+                if (split < end)
+                    split++;
+            }
+            ObjChunk chunk;
+            chunk.begin = p;
+            chunk.end = split;
+            chunks.push_back(chunk);
+            p = split;
+        }
+        return chunks;
+    }
+
+    struct ObjTotals
+    {
+        size_t numVertices = 0, numNormals = 0, numTriangles = 0;
+        // faces before the first usemtl, or naming a material the MTL does
+        // not define, get this one, appended after the declared ones
+        uint32_t defaultMaterial = 0;
+    };
+
+    // Loads the mtllib an OBJ names, if any, and indexes its materials by
+    // name. Returns the index the default material will have.
+    uint32_t loadObjMaterials(const string &filename, const string &mtlFilename, string &mtlPath,
+                              vector<Material> &materials, MaterialIndex &materialIndex)
+    {
+        if (!mtlFilename.empty())
+        {
+            // mtllib paths are relative to the OBJ
+            size_t slash = filename.find_last_of('/');
+            mtlPath = (slash == string::npos ? string() : filename.substr(0, slash + 1)) + mtlFilename;
+            loadMtl(mtlPath, materials);
+        }
+        for (size_t i = 0; i < materials.size(); i++)
+            materialIndex.emplace(materials[i].name, (uint32_t)i);
+        return (uint32_t)materials.size();
+    }
+
+    // After the counting pass: a prefix sum over the counts gives each chunk
+    // its global offsets, then the MTL is loaded and every chunk learns the
+    // material active where it starts.
+    ObjTotals resolveChunks(vector<ObjChunk> &chunks, const string &filename, string &mtlPath,
+                            vector<Material> &materials, MaterialIndex &materialIndex)
+    {
+        ObjTotals totals;
+        string mtlFilename;
+        for (ObjChunk &chunk : chunks)
+        {
+            chunk.vertexBase = totals.numVertices;
+            chunk.normalBase = totals.numNormals;
+            chunk.triangleBase = totals.numTriangles;
+            totals.numVertices += chunk.numVertices;
+            totals.numNormals += chunk.numNormals;
+            totals.numTriangles += chunk.numTriangles;
+            if (mtlFilename.empty())
+                mtlFilename = chunk.mtlFilename;
+        }
+
+        // the material table is needed to resolve usemtl names
+        totals.defaultMaterial = loadObjMaterials(filename, mtlFilename, mtlPath, materials, materialIndex);
+        uint32_t currentMaterial = totals.defaultMaterial;
+        for (ObjChunk &chunk : chunks)
+        {
+            chunk.startMaterial = currentMaterial;
+            if (chunk.setsMaterial)
+            {
+                MaterialIndex::const_iterator it = materialIndex.find(chunk.lastMaterial);
+                currentMaterial = it != materialIndex.end() ? it->second : totals.defaultMaterial;
+            }
+        }
+        return totals;
+    }
+
+    void addDefaultMaterial(vector<Material> &materials)
+    {
+        Material fallback(glm::vec3(0.8f), 1.0f, 0.5f, 0.2f, 32.0f);
+        fallback.name = "default";
+        materials.push_back(fallback);
+    }
+}
+
+Mesh loadObj(string filename, const ObjLoadOptions &options)
+{
+    auto startTime = chrono::steady_clock::now();
+
+    Mesh mesh;
+    MappedFile file(filename);
+    if (!file.isOpen())
+    {
+        cerr << "Failed to open file: " << filename << endl;
+        return mesh;
+    }
+    auto cancelled = [&] { return options.cancel != nullptr && *options.cancel; };
+
+    // small files are not worth waking up threads for
+    const size_t minChunkSize = 1 << 20;
+    ThreadPool pool(file.size() < 2 * minChunkSize ? 1 : options.numThreads);
+    size_t numChunks = pool.size() == 1 ? 1 : min<size_t>(pool.size() * 4, file.size() / minChunkSize);
+    vector<ObjChunk> chunks = splitChunks(file.begin(), file.end(), numChunks);
+
+    // pass 1: count elements per chunk
+    pool.parallelFor(chunks.size(), [&](size_t i) { countChunk(chunks[i]); });
+    if (cancelled())
+        return Mesh();
+
+    // offsets of every chunk, and the materials usemtl refers to in pass 3
+    MaterialIndex materialIndex;
+    ObjTotals totals = resolveChunks(chunks, filename, mesh.mtlFilename, mesh.materials, materialIndex);
+    size_t numVertices = totals.numVertices, numNormals = totals.numNormals, numTriangles = totals.numTriangles;
+    uint32_t defaultMaterial = totals.defaultMaterial;
+
+    // pass 2: positions and normals; faces may refer to any earlier chunk,
+    // so they all have to be in place before the faces are resolved
+    vector<glm::vec3> vertices(numVertices);
+    vector<glm::vec3> normals(numNormals);
+    pool.parallelFor(chunks.size(), [&](size_t i) { parseChunkAttributes(chunks[i], vertices.data(), normals.data()); });
+    if (cancelled())
+        return Mesh();
+
+    // pass 3: resolve face corners and materials into each chunk's slice
+    vector<CornerKey> keys(numTriangles * 3);
+    vector<uint32_t> triangleMaterials(numTriangles);
+    pool.parallelFor(chunks.size(), [&](size_t i) {
+        parseChunkFaces(chunks[i], materialIndex, defaultMaterial, keys.data() + chunks[i].triangleBase * 3,
+                        triangleMaterials.data() + chunks[i].triangleBase);
+    });
+    if (cancelled())
+        return Mesh();
+
+    size_t unknownMaterials = 0;
+    for (const ObjChunk &chunk : chunks)
+        unknownMaterials += chunk.unknownMaterials;
+    if (unknownMaterials > 0)
+        cerr << "Warning: " << unknownMaterials << " usemtl statements name undefined materials in " << filename << endl;
+
+    // group triangles by material with a stable counting sort, so each
+    // material ends up as one contiguous index range in file order
+    size_t numMaterials = defaultMaterial + 1;
+    vector<size_t> materialStart(numMaterials + 1, 0);
+    for (uint32_t material : triangleMaterials)
+        materialStart[material + 1]++;
+    for (size_t m = 0; m < numMaterials; m++)
+        materialStart[m + 1] += materialStart[m];
+    vector<uint32_t> order(numTriangles);
+    vector<size_t> next(materialStart.begin(), materialStart.end() - 1);
+    for (size_t t = 0; t < numTriangles; t++)
+        order[next[triangleMaterials[t]]++] = (uint32_t)t;
+
+    // pass 4: emit one vertex per unique (v, vn) pair, in first-use order,
+    // and one submesh per material that has triangles
+    CornerTable table(numVertices);
+    table.reserve(max(numVertices, numNormals));
+    mesh.vertices.reserve(max(numVertices, numNormals) * 6);
+    mesh.indices.reserve(numTriangles * 3);
+    size_t skippedTriangles = 0;
+    for (size_t m = 0; m < numMaterials; m++)
+    {
+        if (cancelled())
+            return Mesh();
+        SubMesh submesh;
+        submesh.first = (unsigned int)mesh.indices.size();
+        submesh.materialIndex = (unsigned int)m;
+        submesh.boundsMin = glm::vec3(INFINITY);
+        submesh.boundsMax = glm::vec3(-INFINITY);
+        for (size_t i = materialStart[m]; i < materialStart[m + 1]; i++)
+        {
+            CornerKey *corners = &keys[(size_t)order[i] * 3];
+            if (corners[0].v == NO_INDEX)
+            {
+                skippedTriangles++;
+                continue;
+            }
+
+            // faces without vn get the flat face normal, which is never shared
+            if (corners[0].n == NO_INDEX)
+            {
+                const glm::vec3 &p0 = vertices[corners[0].v];
+                normals.push_back(glm::normalize(glm::cross(vertices[corners[1].v] - p0, vertices[corners[2].v] - p0)));
+                for (int k = 0; k < 3; k++)
+                    corners[k].n = (uint32_t)(normals.size() - 1);
+            }
+
+            for (int k = 0; k < 3; k++)
+            {
+                submesh.boundsMin = glm::min(submesh.boundsMin, vertices[corners[k].v]);
+                submesh.boundsMax = glm::max(submesh.boundsMax, vertices[corners[k].v]);
+                bool inserted;
+                uint32_t index = table.findOrInsert(corners[k].v, corners[k].n, inserted);
+                if (inserted)
+                    pushVertex(mesh.vertices, vertices[corners[k].v], normals[corners[k].n]);
+                mesh.indices.push_back(index);
+            }
+        }
+        submesh.count = (unsigned int)mesh.indices.size() - submesh.first;
+        if (submesh.count > 0)
+            mesh.submeshes.push_back(submesh);
+    }
+    if (skippedTriangles > 0)
+        cerr << "Warning: skipped " << skippedTriangles << " triangles with invalid indices in " << filename << endl;
+
+    if (!mesh.submeshes.empty() && mesh.submeshes.back().materialIndex == defaultMaterial)
+        addDefaultMaterial(mesh.materials);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    double megabytes = file.size() / (1024.0 * 1024.0);
+    if (!options.quiet)
+        cout << "loadObj: " << filename << ", " << megabytes << " MB in " << seconds * 1000.0 << " ms ("
+         << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s, " << pool.size() << " threads), "
+         << mesh.numTriangles() << " triangles, " << mesh.numVertices() << " unique vertices, "
+         << mesh.submeshes.size() << " material groups" << endl;
+
+    return mesh;
+}
+
+namespace
+{
+    // Memory one triangle of a face window takes: corner keys and material,
+    // up to three vertex table entries and new vertices, and the indices.
+    const size_t STREAM_BYTES_PER_TRIANGLE = 3 * sizeof(CornerKey) + sizeof(uint32_t) + 3 * 48 + 3 * 6 * sizeof(float) +
+                                             3 * sizeof(unsigned int);
+
+    // What streamObj keeps of a chunk between its passes: where its text
+    // starts, its global offsets and the usemtl in effect where it starts, as
+    // an index into the names seen so far. The counts and material runs of
+    // ObjChunk are folded into file-wide totals as soon as a window has been
+    // counted, so a chunk costs these 40 bytes for the rest of the load. One
+    // more entry after the last chunk holds the end of the file and the totals.
+    struct ChunkSpan
+    {
+        size_t offset;
+        size_t vertexBase, normalBase, triangleBase;
+        uint32_t startName;
+    };
+
+    const uint32_t NO_NAME = 0xffffffffu;
+
+    // spans [first, last) as the chunks the parse functions take
+    vector<ObjChunk> expandSpans(const vector<ChunkSpan> &spans, size_t first, size_t last, const char *text,
+                                 const vector<uint32_t> &nameMaterials, uint32_t defaultMaterial)
+    {
+        vector<ObjChunk> chunks(last - first);
+        for (size_t i = first; i < last; i++)
+        {
+            ObjChunk &chunk = chunks[i - first];
+            chunk.begin = text + spans[i].offset;
+            chunk.end = text + spans[i + 1].offset;
+            chunk.vertexBase = spans[i].vertexBase;
+            chunk.normalBase = spans[i].normalBase;
+            chunk.triangleBase = spans[i].triangleBase;
+            chunk.numTriangles = spans[i + 1].triangleBase - spans[i].triangleBase;
+            chunk.startMaterial = spans[i].startName == NO_NAME ? defaultMaterial : nameMaterials[spans[i].startName];
+        }
+        return chunks;
+    }
+
+    // Cuts count chunks into consecutive windows [starts[i], starts[i + 1]),
+    // each costing no more than limit unless it is a single chunk.
+    template <typename Cost>
+    vector<size_t> splitWindows(size_t count, size_t limit, Cost cost)
+    {
+        vector<size_t> starts(1, 0);
+        size_t windowCost = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t chunkCost = cost(i);
+            if (i > starts.back() && windowCost + chunkCost > limit)
+            {
+                starts.push_back(i);
+                windowCost = 0;
+            }
+            windowCost += chunkCost;
+        }
+        starts.push_back(count);
+        return starts;
+    }
+
+    // of the whole process, which includes whatever it held before the load
+    size_t peakResidentBytes()
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+        return (size_t)usage.ru_maxrss * 1024; // kilobytes on Linux
+    }
+
+    // where spill files go: $TMPDIR, or /tmp, so that OBJs in read-only or
+    // shared directories can be streamed as well
+    string spillDirectory()
+    {
+        const char *directory = getenv("TMPDIR");
+        return directory != nullptr && directory[0] != '\0' ? directory : "/tmp";
+    }
+}
+
+bool streamObj(const string &filename, size_t memoryBudget, MeshSink &sink, StreamedMesh &mesh, const ObjLoadOptions &options)
+{
+    auto startTime = chrono::steady_clock::now();
+    auto cancelled = [&] {
+        if (!sink.cancelled())
+            return false;
+        cout << "streamObj: cancelled " << filename << endl;
+        return true;
+    };
+
+    MappedFile file(filename);
+    if (!file.isOpen())
+    {
+        cerr << "Failed to open file: " << filename << endl;
+        return false;
+    }
+
+    // A quarter of the budget holds file text while it is scanned, half the
+    // faces of a window while they become vertices and indices. Chunks are
+    // small enough that a window of one always fits.
+    ThreadPool pool(options.numThreads);
+    size_t windowSize = max<size_t>(memoryBudget / 4, 1 << 20);
+    size_t chunkSize = max<size_t>(memoryBudget / 32 / pool.size(), 64 << 10);
+
+    // pass 1: count elements per chunk, a window of text at a time. Finding
+    // a line end maps the pages around it, so each window is dropped once it
+    // is counted, and its chunks are boiled down to spans and name totals.
+    const char *text = file.begin();
+    vector<ChunkSpan> spans;
+    vector<size_t> textWindows(1, 0);
+    vector<string> names;
+    unordered_map<string, uint32_t> nameIds;
+    vector<size_t> nameTriangles; // triangles after a usemtl, per name
+    size_t unnamedTriangles = 0;  // and before the first one
+    ObjTotals totals;
+    uint32_t currentName = NO_NAME;
+    string mtlFilename;
+    auto nameId = [&](const string &name) {
+        auto inserted = nameIds.emplace(name, (uint32_t)names.size());
+        if (inserted.second)
+        {
+            names.push_back(name);
+            nameTriangles.push_back(0);
+        }
+        return inserted.first->second;
+    };
+    for (const ObjChunk &window : splitChunks(file.begin(), file.end(), max<size_t>(1, file.size() / windowSize)))
+    {
+        if (cancelled())
+            return false;
+        vector<ObjChunk> chunks = splitChunks(window.begin, window.end, max<size_t>(1, (window.end - window.begin) / chunkSize));
+        pool.parallelFor(chunks.size(), [&](size_t i) { countChunk(chunks[i]); });
+        for (const ObjChunk &chunk : chunks)
+        {
+            spans.push_back({(size_t)(chunk.begin - text), totals.numVertices, totals.numNormals, totals.numTriangles, currentName});
+            totals.numVertices += chunk.numVertices;
+            totals.numNormals += chunk.numNormals;
+            totals.numTriangles += chunk.numTriangles;
+            if (currentName == NO_NAME)
+                unnamedTriangles += chunk.leadingTriangles;
+            else
+                nameTriangles[currentName] += chunk.leadingTriangles;
+            for (const auto &run : chunk.materialTriangles)
+                nameTriangles[nameId(run.first)] += run.second;
+            if (chunk.setsMaterial)
+                currentName = nameId(chunk.lastMaterial);
+            if (mtlFilename.empty())
+                mtlFilename = chunk.mtlFilename;
+        }
+        textWindows.push_back(spans.size());
+        file.release(window.begin, window.end);
+    }
+    spans.push_back({file.size(), totals.numVertices, totals.numNormals, totals.numTriangles, currentName});
+    if (totals.numTriangles == 0)
+    {
+        cerr << "No triangles in " << filename << endl;
+        return false;
+    }
+
+    // the material table is needed to resolve the names
+    MaterialIndex materialIndex;
+    totals.defaultMaterial = loadObjMaterials(filename, mtlFilename, mesh.mtlFilename, mesh.materials, materialIndex);
+    vector<uint32_t> nameMaterials(names.size());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        MaterialIndex::const_iterator it = materialIndex.find(names[i]);
+        nameMaterials[i] = it != materialIndex.end() ? it->second : totals.defaultMaterial;
+    }
+
+    // every material owns a fixed range of the index buffer, sized by its
+    // counted triangles, which the windows fill in file order
+    size_t numMaterials = totals.defaultMaterial + 1;
+    vector<size_t> materialFirst(numMaterials + 1, 0);
+    materialFirst[totals.defaultMaterial + 1] += unnamedTriangles * 3;
+    for (size_t i = 0; i < names.size(); i++)
+        materialFirst[nameMaterials[i] + 1] += nameTriangles[i] * 3;
+    for (size_t m = 0; m < numMaterials; m++)
+        materialFirst[m + 1] += materialFirst[m];
+    vector<Material> sinkMaterials = mesh.materials;
+    addDefaultMaterial(sinkMaterials);
+    sink.setMaterials(sinkMaterials);
+
+    // pass 2: positions and normals; faces may refer to any earlier chunk, so
+    // they go to a temporary file rather than into memory
+    SpillFile spill;
+    string spillPrefix = spillDirectory() + "/" + filename.substr(filename.find_last_of('/') + 1) + ".spill";
+    if (!spill.create(spillPrefix, (totals.numVertices + totals.numNormals) * sizeof(glm::vec3)))
+    {
+        cerr << "streamObj: cannot create a spill file in " << spillDirectory() << " for " << filename << endl;
+        return false;
+    }
+    glm::vec3 *vertices = (glm::vec3 *)spill.data();
+    glm::vec3 *normals = vertices + totals.numVertices;
+    for (size_t w = 0; w + 1 < textWindows.size(); w++)
+    {
+        if (cancelled())
+            return false;
+        size_t first = textWindows[w], last = textWindows[w + 1];
+        vector<ObjChunk> chunks = expandSpans(spans, first, last, text, nameMaterials, totals.defaultMaterial);
+        pool.parallelFor(chunks.size(), [&](size_t i) { parseChunkAttributes(chunks[i], vertices, normals); });
+        file.release(text + spans[first].offset, text + spans[last].offset);
+        spill.release();
+    }
+
+    // one vertex per position or normal, whichever there are more of, and a
+    // margin for those repeated at window borders; faces without normals
+    // need three of their own
+    size_t estimatedVertices = totals.numNormals == 0 ? totals.numTriangles * 3 : max(totals.numVertices, totals.numNormals) * 9 / 8;
+    if (!sink.reserve(estimatedVertices, materialFirst[numMaterials]))
+    {
+        // a sink that is being cancelled refuses data as well
+        if (!cancelled())
+            cerr << "streamObj: cannot allocate buffers for " << filename << endl;
+        return false;
+    }
+
+    // pass 3: per window, resolve the faces, emit one vertex per (v, vn) pair
+    // and hand vertices and indices to the sink
+    vector<size_t> faceWindows = splitWindows(spans.size() - 1, memoryBudget / 2, [&](size_t i) {
+        return (spans[i + 1].offset - spans[i].offset) + (spans[i + 1].triangleBase - spans[i].triangleBase) * STREAM_BYTES_PER_TRIANGLE;
+    });
+    vector<size_t> materialNext(materialFirst.begin(), materialFirst.end() - 1);
+    vector<glm::vec3> boundsMin(numMaterials, glm::vec3(INFINITY)), boundsMax(numMaterials, glm::vec3(-INFINITY));
+    vector<CornerKey> keys;
+    vector<uint32_t> triangleMaterials, order;
+    vector<size_t> materialStart, next;
+    unordered_map<uint64_t, uint32_t> emitted;
+    vector<float> windowVertices;
+    vector<unsigned int> windowIndices;
+    vector<size_t> windowRuns; // per material, where its indices start in windowIndices
+    size_t numVertices = 0, skippedTriangles = 0, unknownMaterials = 0;
+    bool ok = true;
+    for (size_t w = 0; w + 1 < faceWindows.size() && ok; w++)
+    {
+        if (cancelled())
+            return false;
+        size_t first = faceWindows[w], last = faceWindows[w + 1];
+        size_t triangleBase = spans[first].triangleBase;
+        size_t numTriangles = spans[last].triangleBase - triangleBase;
+        keys.resize(numTriangles * 3);
+        triangleMaterials.resize(numTriangles);
+        vector<ObjChunk> chunks = expandSpans(spans, first, last, text, nameMaterials, totals.defaultMaterial);
+        pool.parallelFor(chunks.size(), [&](size_t i) {
+            ObjChunk &chunk = chunks[i];
+            size_t offset = chunk.triangleBase - triangleBase;
+            parseChunkFaces(chunk, materialIndex, totals.defaultMaterial, keys.data() + offset * 3, triangleMaterials.data() + offset);
+        });
+        for (const ObjChunk &chunk : chunks)
+            unknownMaterials += chunk.unknownMaterials;
+
+        // group the window's triangles by material, as loadObj does the file's
+        materialStart.assign(numMaterials + 1, 0);
+        for (uint32_t material : triangleMaterials)
+            materialStart[material + 1]++;
+        for (size_t m = 0; m < numMaterials; m++)
+            materialStart[m + 1] += materialStart[m];
+        order.resize(numTriangles);
+        next.assign(materialStart.begin(), materialStart.end() - 1);
+        for (size_t t = 0; t < numTriangles; t++)
+            order[next[triangleMaterials[t]]++] = (uint32_t)t;
+
+        emitted.clear();
+        windowVertices.clear();
+        windowIndices.clear();
+        windowRuns.assign(numMaterials + 1, 0);
+        for (size_t m = 0; m < numMaterials; m++)
+        {
+            windowRuns[m] = windowIndices.size();
+            for (size_t i = materialStart[m]; i < materialStart[m + 1]; i++)
+            {
+                const CornerKey *corners = &keys[(size_t)order[i] * 3];
+                if (corners[0].v == NO_INDEX)
+                {
+                    skippedTriangles++;
+                    continue;
+                }
+
+                // faces without vn get the flat face normal, which is never shared
+                bool flat = corners[0].n == NO_INDEX;
+                glm::vec3 flatNormal;
+                if (flat)
+                {
+                    const glm::vec3 &p0 = vertices[corners[0].v];
+                    flatNormal = glm::normalize(glm::cross(vertices[corners[1].v] - p0, vertices[corners[2].v] - p0));
+                }
+
+                for (int k = 0; k < 3; k++)
+                {
+                    const glm::vec3 &position = vertices[corners[k].v];
+                    boundsMin[m] = glm::min(boundsMin[m], position);
+                    boundsMax[m] = glm::max(boundsMax[m], position);
+                    uint32_t vertex = (uint32_t)(numVertices + windowVertices.size() / 6);
+                    if (flat)
+                        pushVertex(windowVertices, position, flatNormal);
+                    else
+                    {
+                        auto inserted = emitted.emplace((uint64_t)corners[k].v << 32 | corners[k].n, vertex);
+                        if (inserted.second)
+                            pushVertex(windowVertices, position, normals[corners[k].n]);
+                        vertex = inserted.first->second;
+                    }
+                    windowIndices.push_back(vertex);
+                }
+            }
+        }
+        windowRuns[numMaterials] = windowIndices.size();
+
+        // the vertices go first, so the indices never refer past what the sink has
+        if (!windowVertices.empty())
+            ok = sink.writeVertices(numVertices, windowVertices.data(), windowVertices.size() / 6);
+        numVertices += windowVertices.size() / 6;
+        for (size_t m = 0; m < numMaterials && ok; m++)
+        {
+            size_t count = windowRuns[m + 1] - windowRuns[m];
+            if (count == 0)
+                continue;
+            SubMesh submesh;
+            submesh.first = (unsigned int)materialFirst[m];
+            submesh.count = (unsigned int)(materialNext[m] + count - materialFirst[m]);
+            submesh.materialIndex = (unsigned int)m;
+            submesh.boundsMin = boundsMin[m];
+            submesh.boundsMax = boundsMax[m];
+            ok = sink.writeIndices(materialNext[m], windowIndices.data() + windowRuns[m], count, submesh);
+            materialNext[m] += count;
+        }
+
+        file.release(text + spans[first].offset, text + spans[last].offset);
+        spill.release();
+    }
+    if (!ok)
+    {
+        if (!cancelled())
+            cerr << "streamObj: the buffers did not take the data of " << filename << endl;
+        return false;
+    }
+
+    if (unknownMaterials > 0)
+        cerr << "Warning: " << unknownMaterials << " usemtl statements name undefined materials in " << filename << endl;
+    if (skippedTriangles > 0)
+        cerr << "Warning: skipped " << skippedTriangles << " triangles with invalid indices in " << filename << endl;
+
+    // skipped triangles leave the end of their material's range unused
+    size_t numIndices = 0;
+    for (size_t m = 0; m < numMaterials; m++)
+    {
+        if (materialNext[m] == materialFirst[m])
+            continue;
+        SubMesh submesh;
+        submesh.first = (unsigned int)materialFirst[m];
+        submesh.count = (unsigned int)(materialNext[m] - materialFirst[m]);
+        submesh.materialIndex = (unsigned int)m;
+        submesh.boundsMin = boundsMin[m];
+        submesh.boundsMax = boundsMax[m];
+        mesh.submeshes.push_back(submesh);
+        numIndices += submesh.count;
+    }
+    if (mesh.submeshes.empty())
+    {
+        cerr << "No triangles in " << filename << endl;
+        return false;
+    }
+    if (mesh.submeshes.back().materialIndex == totals.defaultMaterial)
+        addDefaultMaterial(mesh.materials);
+    mesh.numVertices = numVertices;
+    mesh.numIndices = materialFirst[numMaterials];
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    double megabytes = file.size() / (1024.0 * 1024.0);
+    cout << "streamObj: " << filename << ", " << megabytes << " MB in " << seconds * 1000.0 << " ms ("
+         << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s, " << pool.size() << " threads, "
+         << faceWindows.size() - 1 << " windows), " << numIndices / 3 << " triangles, " << numVertices << " vertices, "
+         << mesh.submeshes.size() << " material groups; budget " << memoryBudget / (1024 * 1024) << " MB plus "
+         << spans.size() * sizeof(ChunkSpan) / 1024 << " KB of chunk spans, process peak RSS "
+         << peakResidentBytes() / (1024 * 1024) << " MB" << endl;
+    return true;
+}
@@ -0,0 +1,125 @@
+#ifndef OBJLOADER_H
+#define OBJLOADER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct Material
+{
+    glm::vec3 color;
+    float kd, ks, ka, ns;
+    std::string name;
+    Material()
+    {
+        color = glm::vec3(0.0f);
+        kd = 0.0f;
+        ks = 0.0f;
+        ka = 0.0f;
+        ns = 0.0f;
+    }
+    Material(glm::vec3 a, float b, float c, float d, float e)
+    {
+        color = a;
+        kd = b;
+        ks = c;
+        ka = d;
+        ns = e;
+    }
+};
+
+struct ObjLoadOptions
+{
+    // 0 = one thread per hardware thread, 1 = parse on the calling thread
+    unsigned int numThreads = 0;
+    // no timing report on stdout; warnings still go to stderr
+    bool quiet = false;
+    // loadObj gives up between passes once this turns true, returning an
+    // empty mesh without a message
+    const std::atomic<bool> *cancel = nullptr;
+};
+
+// Triangles drawn with one material: indices [first, first + count).
+struct SubMesh
+{
+    unsigned int first, count;
+    unsigned int materialIndex;
+    glm::vec3 boundsMin, boundsMax; // object-space box of the triangles
+};
+
+// A simplified version of a mesh: the same submeshes in the same order,
+// over the same vertices, with fewer indices.
+struct MeshLod
+{
+    std::vector<SubMesh> submeshes;
+    float error; // how far, in object units, the surface may be off
+};
+
+// Indexed triangle mesh. Every unique (position, normal) pair of the OBJ is
+// stored once in vertices and referenced from indices.
+struct Mesh
+{
+    std::vector<float> vertices;       // interleaved position/normal, 6 floats per vertex
+    std::vector<unsigned int> indices; // 3 per triangle, grouped by material, then the LODs'
+    std::vector<SubMesh> submeshes;    // one per material, in material order
+    std::vector<MeshLod> lods;         // coarser with every level; empty until generateLods
+    std::vector<Material> materials;
+    std::string mtlFilename; // MTL the materials came from, empty if none
+
+    size_t numVertices() const { return vertices.size() / 6; }
+    size_t numTriangles() const { return indices.size() / 3; } // all levels
+    // 16-bit indices are enough to address every vertex
+    bool useShortIndices() const { return numVertices() <= 65536; }
+};
+
+// Loads a Wavefront OBJ (and the MTL it references) into an indexed mesh.
+// The file is memory mapped and tokenized in place, split into
+// newline-aligned chunks that are parsed in parallel; parse throughput is
+// reported on stdout.
+Mesh loadObj(std::string filename, const ObjLoadOptions &options = ObjLoadOptions());
+
+// Receives the buffers of a streamed mesh piece by piece; vertices are 6
+// floats like Mesh::vertices, indices 32 bits. Vertices are written before
+// any indices that use them, so what has arrived can already be drawn.
+class MeshSink
+{
+public:
+    virtual ~MeshSink() {}
+    // The materials usemtl refers to, with the default one for other faces
+    // appended; called once, before reserve().
+    virtual void setMaterials(const std::vector<Material> &) {}
+    // Called once before any data. The vertex count is an estimate that
+    // writeVertices may run past; indices never reach numIndices.
+    virtual bool reserve(size_t estimatedVertices, size_t numIndices) = 0;
+    virtual bool writeVertices(size_t first, const float *vertices, size_t count) = 0;
+    // submesh is the range of the indices' material as it stands with them in
+    virtual bool writeIndices(size_t first, const unsigned int *indices, size_t count, const SubMesh &submesh) = 0;
+    // asked between windows of every pass; true abandons the load
+    virtual bool cancelled() const { return false; }
+};
+
+// What stays in memory of a streamed mesh: its buffers went to the sink.
+struct StreamedMesh
+{
+    std::vector<SubMesh> submeshes; // one per material, ranges into the sink's indices
+    std::vector<Material> materials;
+    std::string mtlFilename;
+    size_t numVertices = 0, numIndices = 0; // written to the sink, and its index buffer size
+};
+
+// Loads an OBJ of any size within about memoryBudget bytes of memory: the
+// file is scanned in windows whose pages are dropped afterwards, positions
+// and normals are spilled to a temporary file in $TMPDIR (default /tmp),
+// and each window of faces is turned into vertices and indices that go to
+// sink right away.
+// Submeshes match loadObj's, but vertices are shared only within a window,
+// so a few are repeated at window borders. A sink that reports cancelled()
+// stops the load at the next window. Beyond the budget, each chunk of
+// the file (64 KB or more) keeps 40 bytes until the load ends, under 1 MB per
+// GB of OBJ, plus one counter per distinct usemtl name. Returns false if
+// nothing was loaded.
+bool streamObj(const std::string &filename, size_t memoryBudget, MeshSink &sink, StreamedMesh &mesh,
+               const ObjLoadOptions &options = ObjLoadOptions());
+
+#endif
@@ -0,0 +1,98 @@
+#include "quantize.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+    const float POSITION_STEPS = 65535.0f;
+    const float NORMAL_STEPS = 32767.0f;
+
+    float signNotZero(float v)
+    {
+        return v >= 0.0f ? 1.0f : -1.0f;
+    }
+
+    // what the GPU reads back from a normalized short
+    float decodeSnorm(int16_t c)
+    {
+        return max(c / NORMAL_STEPS, -1.0f);
+    }
+}
+
+glm::vec2 octEncode(const glm::vec3 &n)
+{
+    // project onto the octahedron |x| + |y| + |z| = 1, folding the lower half over the upper
+    float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+    if (l1 == 0.0f)
+        return glm::vec2(0.0f);
+    glm::vec2 e(n.x / l1, n.y / l1);
+    if (n.z < 0.0f)
+        e = glm::vec2((1.0f - fabs(e.y)) * signNotZero(e.x), (1.0f - fabs(e.x)) * signNotZero(e.y));
+    return e;
+}
+
+glm::vec3 octDecode(const glm::vec2 &e)
+{
+    // the same steps as octDecode in source.vs
+    glm::vec3 n(e.x, e.y, 1.0f - fabs(e.x) - fabs(e.y));
+    float t = max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+bool quantizeVertices(const float *vertices, size_t numVertices, float maxError, QuantizedMesh &out)
+{
+    if (numVertices == 0)
+        return false;
+    glm::vec3 boundsMin(vertices[0], vertices[1], vertices[2]), boundsMax = boundsMin;
+    for (size_t i = 1; i < numVertices; i++)
+    {
+        glm::vec3 p(vertices[i * 6], vertices[i * 6 + 1], vertices[i * 6 + 2]);
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+
+    // rounding is off by at most half a step per axis
+    glm::vec3 extent = boundsMax - boundsMin;
+    float diagonal = glm::length(extent);
+    float worstError = glm::length(extent / POSITION_STEPS * 0.5f);
+    if (diagonal > 0.0f && worstError > maxError * diagonal)
+        return false;
+
+    out.offset = boundsMin;
+    out.scale = glm::vec3(extent.x > 0.0f ? extent.x : 1.0f, extent.y > 0.0f ? extent.y : 1.0f, extent.z > 0.0f ? extent.z : 1.0f);
+    out.vertices.resize(numVertices);
+    out.positionError = 0.0f;
+    float minNormalCos = 1.0f;
+    for (size_t i = 0; i < numVertices; i++)
+    {
+        const float *v = vertices + i * 6;
+        QuantizedVertex &q = out.vertices[i];
+        glm::vec3 decoded;
+        for (int k = 0; k < 3; k++)
+        {
+            float t = (v[k] - out.offset[k]) / out.scale[k];
+            q.position[k] = (uint16_t)lround(min(max(t, 0.0f), 1.0f) * POSITION_STEPS);
+            decoded[k] = q.position[k] / POSITION_STEPS * out.scale[k] + out.offset[k];
+        }
+        q.position[3] = 0;
+        out.positionError = max(out.positionError, glm::length(decoded - glm::vec3(v[0], v[1], v[2])));
+
+        glm::vec3 normal(v[3], v[4], v[5]);
+        glm::vec2 e = octEncode(normal);
+        for (int k = 0; k < 2; k++)
+            q.normal[k] = (int16_t)lround(min(max(e[k], -1.0f), 1.0f) * NORMAL_STEPS);
+        float length = glm::length(normal);
+        if (length > 0.0f)
+        {
+            glm::vec3 back = octDecode(glm::vec2(decodeSnorm(q.normal[0]), decodeSnorm(q.normal[1])));
+            minNormalCos = min(minNormalCos, glm::dot(back, normal / length));
+        }
+    }
+    out.normalError = glm::degrees(acos(min(max(minNormalCos, -1.0f), 1.0f)));
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Compact vertex for the GPU, 12 bytes instead of 24: the position in
+// 16-bit steps across the mesh bounds, read as normalized unsigned shorts,
+// and the normal octahedron-encoded into two normalized shorts. source.vs
+// decodes both.
+struct QuantizedVertex
+{
+    uint16_t position[4]; // xyz, w pads the normal to 4-byte alignment
+    int16_t normal[2];
+};
+
+struct QuantizedMesh
+{
+    std::vector<QuantizedVertex> vertices;
+    // position = decoded (0..1 per axis) * scale + offset
+    glm::vec3 scale, offset;
+    float positionError; // largest distance between a decoded and the original position
+    float normalError;   // largest angle between a decoded and the original normal, degrees
+};
+
+// unit vector -> point in [-1, 1]^2, and back
+glm::vec2 octEncode(const glm::vec3 &n);
+glm::vec3 octDecode(const glm::vec2 &e);
+
+// Quantizes interleaved position/normal vertices. maxError is the position
+// error allowed, as a fraction of the bounds' diagonal; returns false,
+// leaving the floats to be used, if 16-bit steps cannot meet it.
+bool quantizeVertices(const float *vertices, size_t numVertices, float maxError, QuantizedMesh &out);
+
+#endif
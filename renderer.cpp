@@ -0,0 +1,1116 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include "glm/gtc/matrix_transform.hpp"
+
+using namespace std;
+
+namespace
+{
+    // attribute locations of the per-instance data in source.vs
+    const GLuint INSTANCE_MODEL_ATTRIBUTE = 2;  // mat4, 4 locations
+    const GLuint INSTANCE_NORMAL_ATTRIBUTE = 6; // mat3, 3 locations
+    const GLuint INSTANCE_TINT_ATTRIBUTE = 9;
+    // material index in source.vs and cpu.vs: per instance with a
+    // multi-draw, otherwise a constant set before each draw
+    const GLuint MATERIAL_ATTRIBUTE = 10;
+
+    // the depth pre-pass pairs it with the shading programs' vertex shaders
+    const char *const DEPTH_FRAGMENT_SHADER = "depth.fs";
+
+    // the attribute offsets below assume tightly packed members
+    static_assert(sizeof(InstanceData) == sizeof(glm::mat4) + sizeof(glm::mat3) + sizeof(glm::vec4), "InstanceData must be packed");
+
+    // Points the instance attributes of the bound VAO at buffer, starting at
+    // instance first and advancing once per instance. GL 3.3 has no base
+    // instance for instanced draws, so this is how a draw picks its range.
+    void bindInstanceAttributes(GLuint buffer, size_t first = 0)
+    {
+        const GLsizei stride = sizeof(InstanceData);
+        const size_t modelOffset = first * sizeof(InstanceData);
+        const size_t normalOffset = modelOffset + sizeof(glm::mat4);
+        const size_t tintOffset = normalOffset + sizeof(glm::mat3);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (GLuint i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(INSTANCE_MODEL_ATTRIBUTE + i);
+            glVertexAttribPointer(INSTANCE_MODEL_ATTRIBUTE + i, 4, GL_FLOAT, GL_FALSE, stride, (char *)(modelOffset + i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(INSTANCE_MODEL_ATTRIBUTE + i, 1);
+        }
+        for (GLuint i = 0; i < 3; i++)
+        {
+            glEnableVertexAttribArray(INSTANCE_NORMAL_ATTRIBUTE + i);
+            glVertexAttribPointer(INSTANCE_NORMAL_ATTRIBUTE + i, 3, GL_FLOAT, GL_FALSE, stride, (char *)(normalOffset + i * sizeof(glm::vec3)));
+            glVertexAttribDivisor(INSTANCE_NORMAL_ATTRIBUTE + i, 1);
+        }
+        glEnableVertexAttribArray(INSTANCE_TINT_ATTRIBUTE);
+        glVertexAttribPointer(INSTANCE_TINT_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, stride, (char *)tintOffset);
+        glVertexAttribDivisor(INSTANCE_TINT_ATTRIBUTE, 1);
+    }
+
+    // Takes a streamed mesh into the vertex and index buffers as it is parsed.
+    // The index buffer is sized exactly up front; the vertex buffer only by
+    // estimate, and grows in place through a temporary copy if that is short.
+    class BufferSink : public MeshSink
+    {
+    public:
+        BufferSink(GLuint vertexBuffer, GLuint indexBuffer) : vbo(vertexBuffer), ebo(indexBuffer) {}
+
+        bool reserve(size_t estimatedVertices, size_t numIndices) override
+        {
+            glGetError();
+            vertexCapacity = estimatedVertices;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferData(GL_ARRAY_BUFFER, vertexCapacity * VERTEX_BYTES, NULL, GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+            return glGetError() == GL_NO_ERROR;
+        }
+
+        bool writeVertices(size_t first, const float *vertices, size_t count) override
+        {
+            if (first + count > vertexCapacity && !grow(max(first + count, vertexCapacity + vertexCapacity / 2)))
+                return false;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferSubData(GL_ARRAY_BUFFER, first * VERTEX_BYTES, count * VERTEX_BYTES, vertices);
+            vertexEnd = max(vertexEnd, first + count);
+            return true;
+        }
+
+        bool writeIndices(size_t first, const unsigned int *indices, size_t count, const SubMesh &) override
+        {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, first * sizeof(unsigned int), count * sizeof(unsigned int), indices);
+            return true;
+        }
+
+    private:
+        static const size_t VERTEX_BYTES = 6 * sizeof(float);
+
+        // reallocates vbo, keeping its name (and so the VAO's attribute
+        // pointers) and the vertices written so far
+        bool grow(size_t capacity)
+        {
+            GLuint temp;
+            glGenBuffers(1, &temp);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+            glBufferData(GL_COPY_WRITE_BUFFER, vertexEnd * VERTEX_BYTES, NULL, GL_STREAM_COPY);
+            glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertexEnd * VERTEX_BYTES);
+            glBufferData(GL_COPY_READ_BUFFER, capacity * VERTEX_BYTES, NULL, GL_STATIC_DRAW);
+            glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, vertexEnd * VERTEX_BYTES);
+            glDeleteBuffers(1, &temp);
+            cout << "streamObj: vertex buffer grown from " << vertexCapacity << " to " << capacity << " vertices" << endl;
+            vertexCapacity = capacity;
+            return glGetError() == GL_NO_ERROR;
+        }
+
+        GLuint vbo, ebo;
+        size_t vertexCapacity = 0, vertexEnd = 0;
+    };
+}
+
+glm::mat4 viewMatrix(const ViewParams &params)
+{
+    return glm::lookAt(params.cameraPos, params.cameraTarget, params.cameraUp);
+}
+
+glm::mat4 modelMatrix(const ViewParams &params)
+{
+    glm::mat4 model = glm::mat4(1.0f);
+    // rotate
+    model = glm::rotate(model, glm::radians(params.rotX), glm::vec3(1.0f, 0.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(params.rotY), glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(params.rotZ), glm::vec3(0.0f, 0.0f, 1.0f));
+    // scale
+    return glm::scale(model, glm::vec3(params.scale));
+}
+
+bool Renderer::load(const string &objFilename, const string &vertexFilename, const string &fragmentFilename)
+{
+    // uniform locations and block bindings are resolved once here
+    shader = shaders.get(vertexFilename, fragmentFilename);
+    if (shader == nullptr)
+        return false;
+    createObjects();
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    if (streamBudget > 0)
+    {
+        // parsed window by window straight into the buffers, which are all
+        // that is kept of the mesh besides its submeshes
+        BufferSink sink(VBO, EBO);
+        StreamedMesh streamed;
+        if (!streamObj(objFilename, streamBudget, sink, streamed))
+            return false;
+        meshBuffers.assign(std::move(streamed));
+    }
+    // reuse the binary mesh cache while it matches the OBJ/MTL on disk
+    else if (!loadMesh(objFilename, meshBuffers))
+        return false;
+    uploadMesh();
+    setInstances(vector<InstanceData>());
+    return true;
+}
+
+bool Renderer::load(MeshBuffers &&mesh, const string &vertexFilename, const string &fragmentFilename)
+{
+    shader = shaders.get(vertexFilename, fragmentFilename);
+    if (shader == nullptr)
+        return false;
+    if (VAO == 0)
+        createObjects();
+
+    meshBuffers = std::move(mesh);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    uploadMesh();
+    setInstances(vector<InstanceData>());
+    return true;
+}
+
+bool Renderer::loadScene(const string &manifestFilename, const string &vertexFilename, const string &fragmentFilename)
+{
+    shader = shaders.get(vertexFilename, fragmentFilename);
+    if (shader == nullptr)
+        return false;
+    createObjects();
+
+    Scene scene;
+    if (!::loadScene(manifestFilename, scene, MAX_MATERIALS))
+        return false;
+    meshBuffers.assign(std::move(scene.mesh));
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    uploadMesh();
+    models = std::move(scene.models);
+    setInstances(scene.instances, scene.instanceModels);
+    return true;
+}
+
+void Renderer::uploadMesh()
+{
+    // with the VAO and VBO bound; a streamed mesh is in the buffers already
+    QuantizedMesh quantized;
+    quantizedVertices = false;
+    if (meshBuffers.vertices() != nullptr)
+    {
+        quantizedVertices = quantize && quantizeVertices(meshBuffers.vertices(), meshBuffers.numVertices(), quantizeError, quantized);
+        if (quantize && !quantizedVertices)
+            cout << "quantize: 16 bits cannot meet an error of " << quantizeError << " of the bounds, keeping floats" << endl;
+        if (quantizedVertices)
+            glBufferData(GL_ARRAY_BUFFER, quantized.vertices.size() * sizeof(QuantizedVertex), quantized.vertices.data(), GL_STATIC_DRAW);
+        else
+            glBufferData(GL_ARRAY_BUFFER, meshBuffers.vertexBytes(), meshBuffers.vertices(), GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshBuffers.indexBytes(), meshBuffers.indices(), GL_STATIC_DRAW);
+    }
+    indexType = meshBuffers.shortIndices() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    indexSize = meshBuffers.shortIndices() ? sizeof(unsigned short) : sizeof(unsigned int);
+    setVertexFormat(quantizedVertices ? &quantized : nullptr);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    uploadMaterials(materialUBO, meshBuffers.materials);
+}
+
+bool Renderer::beginLoad(const string &objFilename, const string &vertexFilename, const string &fragmentFilename)
+{
+    shader = shaders.get(vertexFilename, fragmentFilename);
+    if (shader == nullptr)
+        return false;
+    createObjects();
+
+    // batches always carry floats and 32-bit indices
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    quantizedVertices = false;
+    setVertexFormat(nullptr);
+    indexType = GL_UNSIGNED_INT;
+    indexSize = sizeof(unsigned int);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    // nothing to draw until the first batches are in
+    setInstances(vector<InstanceData>());
+    uploadSink.reset(new BufferSink(VBO, EBO));
+    loader.reset(new AsyncMeshLoader());
+    loader->start(objFilename, streamBudget);
+    return true;
+}
+
+LoadStatus Renderer::pollLoad(double maxSeconds)
+{
+    if (!loader)
+        return LOAD_FAILED;
+    auto start = chrono::steady_clock::now();
+
+    // the element buffer binding belongs to the VAO
+    glBindVertexArray(VAO);
+    LoadStatus status = LOAD_PENDING;
+    bool rangesChanged = false, previewComplete = false;
+    unique_ptr<LoadBatch> batch;
+    bool replaces = false;
+    while (status == LOAD_PENDING && !previewComplete && loader->poll(batch))
+    {
+        bool ok = true;
+        switch (batch->kind)
+        {
+        case LoadBatch::MATERIALS:
+            meshBuffers.materials = batch->materials;
+            uploadMaterials(materialUBO, meshBuffers.materials);
+            break;
+        case LoadBatch::RESERVE:
+            ok = uploadSink->reserve(batch->first, batch->count);
+            break;
+        case LoadBatch::VERTICES:
+            ok = uploadSink->writeVertices(batch->first, batch->vertices.data(), batch->count);
+            break;
+        case LoadBatch::INDICES:
+            ok = uploadSink->writeIndices(batch->first, batch->indices.data(), batch->count, batch->submesh);
+            if (batch->submesh.count > 0)
+            {
+                // the submesh of the batch's material, as far as it has arrived
+                vector<SubMesh> &submeshes = meshBuffers.submeshes;
+                auto it = lower_bound(submeshes.begin(), submeshes.end(), batch->submesh, [](const SubMesh &a, const SubMesh &b) {
+                    return a.materialIndex < b.materialIndex;
+                });
+                if (it != submeshes.end() && it->materialIndex == batch->submesh.materialIndex)
+                    *it = batch->submesh;
+                else
+                    submeshes.insert(it, batch->submesh);
+                rangesChanged = true;
+            }
+            break;
+        case LoadBatch::PREVIEW:
+            // the loader refines the mesh once this frame has drawn it
+            previewComplete = true;
+            break;
+        case LoadBatch::FINISHED:
+            status = LOAD_DONE;
+            replaces = batch->replaces;
+            break;
+        case LoadBatch::FAILED:
+            status = LOAD_FAILED;
+            break;
+        }
+        if (!ok)
+            status = LOAD_FAILED;
+        if (chrono::duration<double>(chrono::steady_clock::now() - start).count() >= maxSeconds)
+            break;
+    }
+    glBindVertexArray(0);
+
+    if (status == LOAD_DONE && replaces)
+    {
+        // refined after the preview: new vertex order and LODs, uploaded whole
+        meshBuffers = std::move(loader->mesh());
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        uploadMesh();
+        setInstances(vector<InstanceData>());
+    }
+    else if (status == LOAD_DONE)
+    {
+        // the final mesh: LODs, and the vertices for the CPU transform. Its
+        // indices may be 16 bits, but the buffer holds the 32-bit batches.
+        meshBuffers = std::move(loader->mesh());
+        uploadMaterials(materialUBO, meshBuffers.materials);
+        setInstances(vector<InstanceData>());
+    }
+    else if (rangesChanged)
+    {
+        // boxes and draw ranges follow the submeshes; instances are set once
+        // the load is done, so until then there is the single identity one
+        setInstances(vector<InstanceData>());
+    }
+    if (status != LOAD_PENDING)
+    {
+        loader.reset();
+        uploadSink.reset();
+    }
+    return status;
+}
+
+void Renderer::createObjects()
+{
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+    glBindVertexArray(VAO);
+    // the element buffer binding is recorded in the VAO
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+    // per-instance attributes, filled by setInstances
+    glGenBuffers(1, &instanceVBO);
+    bindInstanceAttributes(instanceVBO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    // uniform buffers: camera/light rewritten every frame, materials uploaded once
+    glGenBuffers(1, &frameUBO);
+    glGenBuffers(1, &materialUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialUBO);
+    // no point lights until setPointLights
+    ClusterUniforms noClusters = {};
+    glGenBuffers(1, &clusterUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, clusterUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterUniforms), &noClusters, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_BLOCK_BINDING, clusterUBO);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+}
+
+void Renderer::setVertexFormat(const QuantizedMesh *quantized)
+{
+    if (quantized != nullptr)
+    {
+        // position as 0..1 across the bounds, normal as an octahedron point in -1..1
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), (char *)offsetof(QuantizedVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), (char *)offsetof(QuantizedVertex, normal));
+        cout << "quantize: " << sizeof(QuantizedVertex) << " byte vertices, " << meshBuffers.vertexBytes() / 1024 << " KB -> "
+             << quantized->vertices.size() * sizeof(QuantizedVertex) / 1024 << " KB, position error " << quantized->positionError
+             << ", normal error " << quantized->normalError << " degrees" << endl;
+    }
+    else
+    {
+        // position attribute
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
+        // normal attribute
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (char *)(3 * sizeof(float)));
+    }
+
+    positionScale = quantized != nullptr ? quantized->scale : glm::vec3(1.0f);
+    positionOffset = quantized != nullptr ? quantized->offset : glm::vec3(0.0f);
+    setDecodeUniforms();
+}
+
+void Renderer::setDecodeUniforms()
+{
+    // how source.vs decodes the vertices; program state, so set once per
+    // program that is switched to or relinked
+    for (ShaderProgram *program : {shader, depthShader})
+    {
+        if (program == nullptr)
+            continue;
+        program->use();
+        glUniform3fv(program->uniform(UNIFORM_POSITION_SCALE), 1, &positionScale[0]);
+        glUniform3fv(program->uniform(UNIFORM_POSITION_OFFSET), 1, &positionOffset[0]);
+        glUniform1i(program->uniform(UNIFORM_OCT_NORMALS), quantizedVertices ? 1 : 0);
+    }
+}
+
+bool Renderer::setDepthPrepass(bool enabled)
+{
+    if (enabled && depthShader == nullptr)
+    {
+        // the same vertex shader as the shaded pass, so both passes produce
+        // the same depths and GL_EQUAL holds exactly for the visible ones
+        depthShader = shaders.get(shader->vertexFilename(), DEPTH_FRAGMENT_SHADER);
+        if (depthShader == nullptr)
+            return false;
+        setDecodeUniforms();
+    }
+    if (enabled && cpuShader != nullptr && cpuDepthShader == nullptr)
+    {
+        cpuDepthShader = shaders.get(cpuShader->vertexFilename(), DEPTH_FRAGMENT_SHADER);
+        if (cpuDepthShader == nullptr)
+            return false;
+    }
+    depthPrepass = enabled;
+    return true;
+}
+
+void Renderer::setFragmentCounting(bool enabled)
+{
+    if (enabled && !fragmentCounter)
+    {
+        fragmentCounter.reset(new FragmentCounter());
+        fragmentCounter->init();
+    }
+    else if (!enabled && fragmentCounter)
+    {
+        // waits for the frames still in flight, so the totals are complete
+        fragmentCounter->release();
+        countedFragments = fragmentCounter->stats();
+        fragmentCounter.reset();
+    }
+}
+
+const FragmentStats &Renderer::fragmentStats() const
+{
+    return fragmentCounter ? fragmentCounter->stats() : countedFragments;
+}
+
+bool Renderer::setFragmentShader(const string &fragmentFilename)
+{
+    ShaderProgram *nextShader = shaders.get(shader->vertexFilename(), fragmentFilename);
+    ShaderProgram *nextCpuShader = cpuShader != nullptr ? shaders.get(cpuShader->vertexFilename(), fragmentFilename) : nullptr;
+    if (nextShader == nullptr || (cpuShader != nullptr && nextCpuShader == nullptr))
+        return false;
+    shader = nextShader;
+    cpuShader = nextCpuShader;
+    setDecodeUniforms();
+    return true;
+}
+
+bool Renderer::reloadShaders()
+{
+    vector<ShaderProgram *> reloaded = shaders.reloadChanged();
+    if (find(reloaded.begin(), reloaded.end(), shader) != reloaded.end() || find(reloaded.begin(), reloaded.end(), depthShader) != reloaded.end())
+        setDecodeUniforms();
+    for (ShaderProgram *program : reloaded)
+        cout << "shader: reloaded " << program->vertexFilename() << " + " << program->fragmentFilename() << endl;
+    return !reloaded.empty();
+}
+
+void Renderer::upload(const ViewParams &params, const Light &light)
+{
+    ShaderProgram &active = program();
+    active.use();
+
+    glm::mat4 view = viewMatrix(params);
+    glm::mat4 model = modelMatrix(params);
+
+    // send camera and light to the shaders in one block
+    FrameUniforms frame;
+    frame.view = view;
+    frame.projection = params.projection;
+    frame.lightPosition = glm::vec4(light.position, 1.0f);
+    frame.lightColor = glm::vec4(light.color, light.intensity);
+    frame.viewPosition = glm::vec4(params.cameraPos, 1.0f);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // send final matrices to vertex shader; these are the same for every
+    // vertex of the draw, so they are not rebuilt per vertex on the GPU
+    glm::mat4 mvp = params.projection * view * model;
+    if (!pointLights.empty())
+        assignLights(view, params.projection);
+    // a multi-draw needs every group in its own range, for its materials
+    if (culling || multiDraw || (lodThreshold > 0.0f && !meshBuffers.lods.empty()))
+        selectDraws(params, mvp);
+    if (useCpuTransform)
+        transformOnCpu(mvp);
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    glUniformMatrix4fv(active.uniform(UNIFORM_MODEL), 1, GL_FALSE, &model[0][0]);
+    glUniformMatrix4fv(active.uniform(UNIFORM_MVP), 1, GL_FALSE, &mvp[0][0]);
+    glUniformMatrix3fv(active.uniform(UNIFORM_NORMAL_MATRIX), 1, GL_FALSE, &normalMatrix[0][0]);
+    if (depthPrepass)
+    {
+        ShaderProgram &depth = depthProgram();
+        depth.use();
+        glUniformMatrix4fv(depth.uniform(UNIFORM_MVP), 1, GL_FALSE, &mvp[0][0]);
+    }
+}
+
+void Renderer::draw()
+{
+    glClearColor(CLEAR_COLOR.r, CLEAR_COLOR.g, CLEAR_COLOR.b, CLEAR_COLOR.a);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glBindVertexArray(useCpuTransform ? cpuVAO : VAO);
+
+    // every material group of every level is one command or draw
+    size_t numSubmeshes = meshBuffers.submeshes.size();
+    drawCommandList.clear();
+    drawMaterials.clear();
+    for (size_t slot = 0; slot < drawCount.size(); slot++)
+    {
+        const SubMesh &submesh = levelSubmeshes(slot / numSubmeshes)[slot % numSubmeshes];
+        if (drawCount[slot] == 0 || submesh.count == 0)
+            continue;
+        DrawCommand command = {submesh.count, (GLuint)drawCount[slot], submesh.first, 0, (GLuint)drawFirst[slot]};
+        drawCommandList.push_back(command);
+        drawMaterials.push_back((GLint)min(submesh.materialIndex, MAX_MATERIALS - 1));
+    }
+    lastDrawCommands = drawCommandList.size();
+    lastDrawCalls = 0;
+
+    if (fragmentCounter)
+        fragmentCounter->beginFrame();
+    if (depthPrepass)
+    {
+        // depth only, so the shaded pass below runs its fragment shader
+        // once per pixel instead of once per overlapping layer
+        depthProgram().use();
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        if (fragmentCounter)
+            fragmentCounter->beginPass(PASS_DEPTH);
+        submitDraws();
+        if (fragmentCounter)
+            fragmentCounter->endPass();
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    program().use();
+    if (fragmentCounter)
+        fragmentCounter->beginPass(PASS_SHADE);
+    submitDraws();
+    if (fragmentCounter)
+    {
+        fragmentCounter->endPass();
+        fragmentCounter->endFrame();
+    }
+    if (depthPrepass)
+    {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    glBindVertexArray(0);
+}
+
+void Renderer::submitDraws()
+{
+    if (multiDraw && !useCpuTransform)
+    {
+        // the instance and material attributes start at each command's
+        // base instance, so one call covers the whole visible set
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        if (drawCommandList != uploadedCommands)
+        {
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, max<size_t>(drawCommandList.size(), 1) * sizeof(DrawCommand), NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, drawCommandList.size() * sizeof(DrawCommand), drawCommandList.data());
+            uploadedCommands = drawCommandList;
+        }
+        bindInstanceAttributes(instanceVBO);
+        if (!drawCommandList.empty())
+            glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, 0, (GLsizei)drawCommandList.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        lastDrawCalls += drawCommandList.empty() ? 0 : 1;
+    }
+    else
+    {
+        for (size_t i = 0; i < drawCommandList.size(); i++)
+        {
+            // the material itself already sits in the Materials block; with
+            // the attribute array off, every vertex reads this value
+            const DrawCommand &command = drawCommandList[i];
+            const void *offset = (const void *)(command.firstIndex * indexSize);
+            glVertexAttribI1i(MATERIAL_ATTRIBUTE, drawMaterials[i]);
+            if (useCpuTransform)
+                glDrawElements(GL_TRIANGLES, command.count, indexType, offset);
+            else
+            {
+                bindInstanceAttributes(instanceVBO, command.baseInstance);
+                glDrawElementsInstanced(GL_TRIANGLES, command.count, indexType, offset, command.instanceCount);
+            }
+        }
+        lastDrawCalls += drawCommandList.size();
+    }
+}
+
+void Renderer::setInstances(const vector<InstanceData> &newInstances)
+{
+    // the whole mesh is the one model
+    ModelRange whole;
+    whole.firstSubmesh = 0;
+    whole.numSubmeshes = (unsigned int)meshBuffers.submeshes.size();
+    for (const MeshLod &lod : meshBuffers.lods)
+        whole.lodErrors.push_back(lod.error);
+    models.assign(1, whole);
+    setInstances(newInstances, vector<uint32_t>(max<size_t>(newInstances.size(), 1), 0));
+}
+
+void Renderer::setInstances(const vector<InstanceData> &newInstances, const vector<uint32_t> &newInstanceModels)
+{
+    instances = newInstances;
+    instanceModels = newInstanceModels;
+    if (instances.empty())
+        instances.push_back(identityInstance());
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    const vector<SubMesh> &submeshes = meshBuffers.submeshes;
+    itemInstances.clear();
+    itemSubmeshes.clear();
+    itemBoxes.clear();
+    itemTriangles = 0;
+    instanceScales.resize(instances.size());
+    for (size_t instance = 0; instance < instances.size(); instance++)
+    {
+        const glm::mat4 &model = instances[instance].model;
+        const ModelRange &range = models[instanceModels[instance]];
+        for (unsigned int i = range.firstSubmesh; i < range.firstSubmesh + range.numSubmeshes; i++)
+        {
+            Aabb local(submeshes[i].boundsMin, submeshes[i].boundsMax);
+            itemInstances.push_back((uint32_t)instance);
+            itemSubmeshes.push_back(i);
+            itemBoxes.push_back(transformBox(model, local));
+            itemTriangles += submeshes[i].count / 3;
+        }
+        instanceScales[instance] = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    }
+    resetDraws();
+    if (culling)
+        setCulling(true, cullPool->size());
+}
+
+void Renderer::resetDraws()
+{
+    // every instance at full detail, until the next selection says
+    // otherwise: each submesh draws the run of instances of its model
+    size_t numSlots = (meshBuffers.lods.size() + 1) * meshBuffers.submeshes.size();
+    drawFirst.assign(numSlots, 0);
+    drawCount.assign(numSlots, 0);
+    for (size_t instance = 0; instance < instances.size(); instance++)
+    {
+        const ModelRange &range = models[instanceModels[instance]];
+        for (unsigned int i = range.firstSubmesh; i < range.firstSubmesh + range.numSubmeshes; i++)
+        {
+            if (drawCount[i] == 0)
+                drawFirst[i] = (GLsizei)instance;
+            drawCount[i]++;
+        }
+    }
+    uploadedItems.clear();
+}
+
+bool Renderer::setMultiDraw(bool enabled)
+{
+    multiDraw = enabled && GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+    if (multiDraw && indirectBuffer == 0)
+    {
+        glGenBuffers(1, &indirectBuffer);
+        glGenBuffers(1, &materialVBO);
+    }
+    glBindVertexArray(VAO);
+    if (multiDraw)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, materialVBO);
+        glEnableVertexAttribArray(MATERIAL_ATTRIBUTE);
+        glVertexAttribIPointer(MATERIAL_ATTRIBUTE, 1, GL_INT, sizeof(GLint), 0);
+        glVertexAttribDivisor(MATERIAL_ATTRIBUTE, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    else
+        glDisableVertexAttribArray(MATERIAL_ATTRIBUTE);
+    glBindVertexArray(0);
+    // the packed instances need their materials next to them
+    uploadedItems.clear();
+    uploadedCommands.clear();
+    return multiDraw;
+}
+
+void Renderer::setCulling(bool enabled, unsigned int numThreads)
+{
+    culling = enabled;
+    if (!culling)
+    {
+        // back to the full buffer
+        bvh.clear();
+        setInstances(vector<InstanceData>(instances), vector<uint32_t>(instanceModels));
+        return;
+    }
+    if (!cullPool || (numThreads != 0 && cullPool->size() != numThreads))
+        cullPool.reset(new ThreadPool(numThreads));
+    auto start = chrono::steady_clock::now();
+    bvh.build(itemBoxes);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "culling: BVH over " << bvh.numItems() << " boxes, " << bvh.numNodes() << " nodes in "
+         << seconds * 1000.0 << " ms, " << cullPool->size() << " threads" << endl;
+}
+
+void Renderer::selectDraws(const ViewParams &params, const glm::mat4 &mvp)
+{
+    // The frustum of the full mvp is in the space the instance matrices map
+    // into, which is where the boxes were built, so the BVH never changes
+    // when only the camera or the global model matrix does.
+    size_t numSubmeshes = meshBuffers.submeshes.size();
+    size_t numLevels = meshBuffers.lods.size() + 1;
+    lastCull = CullStats();
+    if (culling)
+        lastCull.boxesTested = bvh.cull(extractFrustum(mvp), *cullPool, visibleItems);
+    else
+    {
+        visibleItems.resize(itemBoxes.size());
+        for (size_t i = 0; i < visibleItems.size(); i++)
+            visibleItems[i] = (uint32_t)i;
+    }
+
+    // Pick each item's level from how many pixels the LOD errors cover at
+    // the nearest the box can be to the camera. Clip w is the view depth.
+    drawnItems.resize(visibleItems.size());
+    GLint viewport[4] = {0, 0, 0, 0};
+    if (lodThreshold > 0.0f && numLevels > 1)
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    float pixelsPerUnit = params.projection[1][1] * viewport[3] * 0.5f * params.scale;
+    for (size_t i = 0; i < visibleItems.size(); i++)
+    {
+        uint32_t item = visibleItems[i];
+        size_t level = 0;
+        if (pixelsPerUnit > 0.0f)
+        {
+            const Aabb &box = itemBoxes[item];
+            float w = (mvp * glm::vec4(box.center(), 1.0f)).w;
+            float radius = glm::length(box.max - box.min) * 0.5f * params.scale;
+            float depth = w - radius;
+            if (depth > 0.0f)
+            {
+                uint32_t instance = itemInstances[item];
+                const vector<float> &errors = models[instanceModels[instance]].lodErrors;
+                float scale = instanceScales[instance] * pixelsPerUnit / depth;
+                while (level + 1 < numLevels && errors[level] * scale <= lodThreshold)
+                    level++;
+            }
+        }
+        drawnItems[i] = (uint32_t)(item * numLevels + level);
+    }
+
+    // group the instances by level and submesh; every group is one draw
+    fill(drawCount.begin(), drawCount.end(), 0);
+    for (uint32_t drawn : drawnItems)
+    {
+        size_t level = drawn % numLevels, submesh = itemSubmeshes[drawn / numLevels];
+        drawCount[level * numSubmeshes + submesh]++;
+        lastCull.drawnTriangles += levelSubmeshes(level)[submesh].count / 3;
+    }
+    vector<size_t> next(drawCount.size(), 0);
+    for (size_t slot = 0, first = 0; slot < drawCount.size(); slot++)
+    {
+        drawFirst[slot] = (GLsizei)first;
+        next[slot] = first;
+        first += drawCount[slot];
+    }
+
+    // the buffer only changes when the selection does
+    if (drawnItems != uploadedItems)
+    {
+        visibleInstances.resize(drawnItems.size());
+        visibleMaterials.resize(multiDraw ? drawnItems.size() : 0);
+        for (uint32_t drawn : drawnItems)
+        {
+            size_t level = drawn % numLevels, item = drawn / numLevels;
+            size_t submesh = itemSubmeshes[item];
+            size_t packed = next[level * numSubmeshes + submesh]++;
+            visibleInstances[packed] = instances[itemInstances[item]];
+            if (multiDraw)
+                visibleMaterials[packed] = (GLint)min(meshBuffers.submeshes[submesh].materialIndex, MAX_MATERIALS - 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // orphan the old storage rather than wait for draws still reading it
+        glBufferData(GL_ARRAY_BUFFER, max<size_t>(visibleInstances.size(), 1) * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, visibleInstances.size() * sizeof(InstanceData), visibleInstances.data());
+        if (multiDraw)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, materialVBO);
+            glBufferData(GL_ARRAY_BUFFER, max<size_t>(visibleMaterials.size(), 1) * sizeof(GLint), NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, visibleMaterials.size() * sizeof(GLint), visibleMaterials.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        uploadedItems = drawnItems;
+    }
+
+    size_t visibleTriangles = 0;
+    for (uint32_t item : visibleItems)
+        visibleTriangles += meshBuffers.submeshes[itemSubmeshes[item]].count / 3;
+    lastCull.objects = itemBoxes.size();
+    lastCull.culledObjects = itemBoxes.size() - visibleItems.size();
+    lastCull.triangles = itemTriangles;
+    lastCull.culledTriangles = lastCull.triangles - visibleTriangles;
+    totalCull.objects += lastCull.objects;
+    totalCull.culledObjects += lastCull.culledObjects;
+    totalCull.triangles += lastCull.triangles;
+    totalCull.culledTriangles += lastCull.culledTriangles;
+    totalCull.drawnTriangles += lastCull.drawnTriangles;
+    totalCull.boxesTested += lastCull.boxesTested;
+    culledFrames++;
+}
+
+void Renderer::setPointLights(const vector<PointLight> &lights, unsigned int numThreads)
+{
+    pointLights = lights;
+    ClusterUniforms noClusters = {};
+    glBindBuffer(GL_UNIFORM_BUFFER, clusterUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClusterUniforms), &noClusters);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    if (pointLights.empty())
+    {
+        lightClusters.reset();
+        return;
+    }
+    if (!lightClusters)
+        lightClusters.reset(new LightClusters(numThreads));
+
+    if (lightBuffers[0] == 0)
+    {
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+        glGenBuffers(3, lightBuffers);
+        glGenTextures(3, lightTextures);
+        const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        const GLenum units[3] = {LIGHT_TEXTURE_UNIT, CLUSTER_TEXTURE_UNIT, LIGHT_INDEX_TEXTURE_UNIT};
+        for (int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, lightBuffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, lightTextures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], lightBuffers[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // the lights stay put in the world; only their clusters change per frame
+    size_t maxLights = (size_t)maxTextureBufferSize / 2;
+    if (pointLights.size() > maxLights)
+    {
+        cout << "lights: " << pointLights.size() << " point lights, only " << maxLights << " fit a buffer texture" << endl;
+        pointLights.resize(maxLights);
+    }
+    vector<glm::vec4> texels;
+    texels.reserve(pointLights.size() * 2);
+    for (const PointLight &light : pointLights)
+    {
+        texels.push_back(glm::vec4(light.position, light.radius));
+        texels.push_back(glm::vec4(light.color * light.intensity, 1.0f));
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffers[0]);
+    glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(glm::vec4), texels.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    lightFrames = totalLightIndices = totalLitClusters = maxClusterLights = 0;
+    totalAssignMs = 0.0;
+}
+
+void Renderer::assignLights(const glm::mat4 &view, const glm::mat4 &projection)
+{
+    auto start = chrono::steady_clock::now();
+    lightClusters->assign(pointLights, view, projection, (size_t)maxTextureBufferSize);
+    totalAssignMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (lightClusters->truncated() && !reportedTruncation)
+    {
+        cout << "lights: more cluster entries than a buffer texture holds, the farthest clusters lose lights" << endl;
+        reportedTruncation = true;
+    }
+
+    // both lists are rewritten whole, so the old storage is orphaned
+    const vector<uint32_t> &clusters = lightClusters->clusters();
+    const vector<uint32_t> &indices = lightClusters->indices();
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffers[1]);
+    glBufferData(GL_TEXTURE_BUFFER, clusters.size() * sizeof(uint32_t), clusters.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffers[2]);
+    glBufferData(GL_TEXTURE_BUFFER, max<size_t>(indices.size(), 1) * sizeof(uint32_t), indices.empty() ? NULL : indices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // the clusters split whatever the viewport is
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    ClusterUniforms uniforms;
+    uniforms.counts = glm::uvec4(LightClusters::CLUSTERS_X, LightClusters::CLUSTERS_Y, LightClusters::CLUSTERS_Z, (unsigned int)pointLights.size());
+    uniforms.params = glm::vec4((float)viewport[2] / LightClusters::CLUSTERS_X, (float)viewport[3] / LightClusters::CLUSTERS_Y,
+                                lightClusters->sliceScale(), lightClusters->sliceBias());
+    glBindBuffer(GL_UNIFORM_BUFFER, clusterUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClusterUniforms), &uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    lightFrames++;
+    totalLightIndices += indices.size();
+    for (size_t i = 1; i < clusters.size(); i += 2)
+    {
+        totalLitClusters += clusters[i] > 0 ? 1 : 0;
+        maxClusterLights = max<size_t>(maxClusterLights, clusters[i]);
+    }
+}
+
+void Renderer::reportLights(ostream &out) const
+{
+    if (lightFrames == 0)
+        return;
+    double litClusters = (double)totalLitClusters / lightFrames;
+    out << "lights, average of " << lightFrames << " frames: " << pointLights.size() << " point lights in "
+        << LightClusters::CLUSTERS_X << "x" << LightClusters::CLUSTERS_Y << "x" << LightClusters::CLUSTERS_Z << " clusters, "
+        << litClusters << " clusters lit by " << (litClusters > 0.0 ? totalLightIndices / lightFrames / litClusters : 0.0)
+        << " lights on average and at most " << maxClusterLights << ", assigned in " << totalAssignMs / lightFrames
+        << " ms on " << lightClusters->numThreads() << " threads" << endl;
+}
+
+void Renderer::sceneBounds(glm::vec3 &boundsMin, glm::vec3 &boundsMax) const
+{
+    Aabb bounds = itemBoxes.empty() ? Aabb() : itemBoxes[0];
+    for (const Aabb &box : itemBoxes)
+        bounds.grow(box);
+    boundsMin = bounds.min;
+    boundsMax = bounds.max;
+}
+
+void Renderer::reportCulling(ostream &out) const
+{
+    if (culledFrames == 0)
+        return;
+    auto perFrame = [this](size_t total) { return (total + culledFrames / 2) / culledFrames; };
+    auto percent = [](size_t part, size_t whole) { return whole > 0 ? 100.0 * part / whole : 0.0; };
+    out << "culling, average of " << culledFrames << " frames: "
+        << perFrame(totalCull.culledObjects) << " of " << perFrame(totalCull.objects) << " objects ("
+        << percent(totalCull.culledObjects, totalCull.objects) << "%) and "
+        << perFrame(totalCull.culledTriangles) << " of " << perFrame(totalCull.triangles) << " triangles ("
+        << percent(totalCull.culledTriangles, totalCull.triangles) << "%) culled, "
+        << perFrame(totalCull.boxesTested) << " boxes tested; "
+        << perFrame(totalCull.drawnTriangles) << " triangles drawn after LOD selection ("
+        << percent(totalCull.drawnTriangles, totalCull.triangles) << "% of the full mesh)" << endl;
+}
+
+bool Renderer::initCpuTransform(const string &vertexFilename, const string &fragmentFilename, unsigned int numThreads)
+{
+    // cpu.vs reads the normal and position from the static buffer as floats
+    if (quantizedVertices)
+    {
+        cout << "cpu transform: needs the float vertex format, not --quantize" << endl;
+        return false;
+    }
+    if (meshBuffers.vertices() == nullptr)
+    {
+        cout << "cpu transform: needs the mesh in memory, not --stream" << endl;
+        return false;
+    }
+    cpuShader = shaders.get(vertexFilename, fragmentFilename);
+    if (cpuShader == nullptr)
+        return false;
+    if (depthPrepass && !setDepthPrepass(true))
+        return false;
+    cpuTransform.reset(new CpuTransform(numThreads));
+    cpuTransform->setPositions(meshBuffers.vertices(), meshBuffers.numVertices(), 6);
+
+    glGenVertexArrays(1, &cpuVAO);
+    glGenBuffers(1, &clipVBO);
+    glBindVertexArray(cpuVAO);
+
+    // clip-space positions, rewritten every frame
+    glBindBuffer(GL_ARRAY_BUFFER, clipVBO);
+    glBufferData(GL_ARRAY_BUFFER, cpuTransform->paddedVertices() * 4 * sizeof(float), NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
+
+    // normal and object-space position for the lighting stay in the static buffer
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (char *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    cout << "cpu transform: " << cpuTransform->instructionSet() << ", " << cpuTransform->numThreads() << " threads" << endl;
+    return true;
+}
+
+void Renderer::setCpuTransform(bool enabled)
+{
+    useCpuTransform = enabled && cpuTransform;
+}
+
+void Renderer::transformOnCpu(const glm::mat4 &mvp)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, clipVBO);
+    // invalidating lets the driver hand out fresh storage instead of waiting
+    // for draws that still read the previous frame's positions
+    void *mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, cpuTransform->paddedVertices() * 4 * sizeof(float),
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped != NULL)
+    {
+        cpuTransform->transform(mvp, (float *)mapped);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Renderer::benchmarkTransforms(const ViewParams &params, int iterations)
+{
+    if (!cpuTransform || iterations <= 0)
+        return;
+    glm::mat4 mvp = params.projection * viewMatrix(params) * modelMatrix(params);
+    double vertices = (double)meshBuffers.numVertices() * iterations;
+    auto secondsSince = [](chrono::steady_clock::time_point start) {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    // GPU: the vertex shader runs once per vertex and nothing is rasterized
+    shader->use();
+    glUniformMatrix4fv(shader->uniform(UNIFORM_MVP), 1, GL_FALSE, &mvp[0][0]);
+    glBindVertexArray(VAO);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glFinish();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        glDrawArrays(GL_POINTS, 0, (GLsizei)meshBuffers.numVertices());
+    glFinish();
+    double gpuSeconds = secondsSince(start);
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(0);
+
+    // CPU: the transform alone, then with mapping and handing the buffer to GL
+    vector<float> out(cpuTransform->paddedVertices() * 4);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        cpuTransform->transform(mvp, out.data());
+    double cpuSeconds = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        transformOnCpu(mvp);
+    glFinish();
+    double mappedSeconds = secondsSince(start);
+
+    cout << "transform benchmark: " << meshBuffers.numVertices() << " vertices x " << iterations << "\n"
+         << "  gpu vertex shader: " << vertices / gpuSeconds / 1e6 << " Mvertices/s\n"
+         << "  cpu " << cpuTransform->instructionSet() << " x " << cpuTransform->numThreads() << " threads: "
+         << vertices / cpuSeconds / 1e6 << " Mvertices/s, "
+         << vertices / mappedSeconds / 1e6 << " Mvertices/s into the mapped buffer" << endl;
+}
+
+void Renderer::release()
+{
+    // a load still running is cancelled before its buffers go
+    loader.reset();
+    uploadSink.reset();
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    glDeleteBuffers(1, &frameUBO);
+    glDeleteBuffers(1, &materialUBO);
+    glDeleteBuffers(1, &clusterUBO);
+    glDeleteBuffers(3, lightBuffers);
+    glDeleteTextures(3, lightTextures);
+    for (int i = 0; i < 3; i++)
+        lightBuffers[i] = lightTextures[i] = 0;
+    clusterUBO = 0;
+    pointLights.clear();
+    lightClusters.reset();
+    glDeleteVertexArrays(1, &cpuVAO);
+    glDeleteBuffers(1, &clipVBO);
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteBuffers(1, &materialVBO);
+    instanceVBO = indirectBuffer = materialVBO = 0;
+    multiDraw = false;
+    instances.clear();
+    itemBoxes.clear();
+    bvh.clear();
+    cullPool.reset();
+    culling = false;
+    VAO = VBO = EBO = frameUBO = materialUBO = 0;
+    cpuVAO = clipVBO = 0;
+    setFragmentCounting(false);
+    shaders.release();
+    shader = cpuShader = depthShader = cpuDepthShader = nullptr;
+    depthPrepass = false;
+    cpuTransform.reset();
+    useCpuTransform = false;
+}
@@ -0,0 +1,308 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <GL/glew.h>
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "asyncloader.h"
+#include "cputransform.h"
+#include "culling.h"
+#include "fragmentcounter.h"
+#include "instances.h"
+#include "lightclusters.h"
+#include "meshcache.h"
+#include "quantize.h"
+#include "scene.h"
+#include "shader.h"
+
+struct Light
+{
+    glm::vec3 position, color;
+    float intensity;
+
+    Light(glm::vec3 a, glm::vec3 b, float c)
+    {
+        position = a;
+        color = b;
+        intensity = c;
+    }
+};
+
+inline bool operator==(const Light &a, const Light &b)
+{
+    return a.position == b.position && a.color == b.color && a.intensity == b.intensity;
+}
+
+// background of every frame, in both renderers
+const glm::vec4 CLEAR_COLOR = glm::vec4(0.2f, 0.3f, 0.3f, 1.0f);
+
+// Everything a frame depends on besides the mesh: camera, projection and the
+// model's rotation (degrees) and scale
+struct ViewParams
+{
+    glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 10.0f);
+    glm::vec3 cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
+    glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    float rotX = 0.0f, rotY = 0.0f, rotZ = 0.0f;
+    float scale = 1.0f;
+};
+
+inline bool operator==(const ViewParams &a, const ViewParams &b)
+{
+    return a.cameraPos == b.cameraPos && a.cameraTarget == b.cameraTarget && a.cameraUp == b.cameraUp && a.projection == b.projection &&
+           a.rotX == b.rotX && a.rotY == b.rotY && a.rotZ == b.rotZ && a.scale == b.scale;
+}
+
+// the same transforms drive the GL and the software renderer
+glm::mat4 viewMatrix(const ViewParams &params);
+glm::mat4 modelMatrix(const ViewParams &params);
+
+// glMultiDrawElementsIndirect's command layout
+struct DrawCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+inline bool operator==(const DrawCommand &a, const DrawCommand &b)
+{
+    return a.count == b.count && a.instanceCount == b.instanceCount && a.firstIndex == b.firstIndex && a.baseVertex == b.baseVertex && a.baseInstance == b.baseInstance;
+}
+
+enum LoadStatus
+{
+    LOAD_PENDING,
+    LOAD_DONE,
+    LOAD_FAILED
+};
+
+// Owns the GL objects for one model and draws it into whatever framebuffer is
+// bound. The windowed and the headless path render through the same code.
+class Renderer
+{
+public:
+    Renderer() {}
+    Renderer(const Renderer &) = delete;
+    Renderer &operator=(const Renderer &) = delete;
+
+    // Compiles the shaders and uploads the model, from its .meshbin cache when
+    // that is current. Needs a current context; errors are printed.
+    bool load(const std::string &objFilename, const std::string &vertexFilename, const std::string &fragmentFilename);
+    // Like load, with a mesh loaded elsewhere, e.g. on another thread.
+    // Loading again replaces the model and reuses the GL objects.
+    bool load(MeshBuffers &&mesh, const std::string &vertexFilename, const std::string &fragmentFilename);
+
+    // Like load, but the model loads on a worker thread: this returns once
+    // the shaders are built, and pollLoad uploads what has arrived since.
+    // Until it reports LOAD_DONE, draw() renders the triangles that are in,
+    // without LODs, quantization or the CPU transform. An OBJ without a
+    // current cache is uploaded a second time at LOAD_DONE, refined.
+    bool beginLoad(const std::string &objFilename, const std::string &vertexFilename, const std::string &fragmentFilename);
+    // uploads arrived batches for up to maxSeconds; call once per frame
+    LoadStatus pollLoad(double maxSeconds);
+    bool loading() const { return loader != nullptr; }
+
+    // Loads every model of a scene manifest into the one vertex and index
+    // buffer and places its objects as instances. Like load otherwise.
+    bool loadScene(const std::string &manifestFilename, const std::string &vertexFilename, const std::string &fragmentFilename);
+
+    // Where linked programs are cached as driver binaries, so later runs
+    // skip GLSL compilation; "" compiles every time. Call before loading.
+    void setShaderCache(const std::string &directory) { shaders.setCacheDirectory(directory); }
+    // Draws with another fragment shader from now on, the CPU transform's
+    // program included. Programs stay loaded, so switching back is free.
+    // False, keeping the current one, if it does not build.
+    bool setFragmentShader(const std::string &fragmentFilename);
+    const std::string &fragmentShader() const { return shader->fragmentFilename(); }
+    // relinks the programs whose shader files changed on disk; true if any was
+    bool reloadShaders();
+
+    // With it on, draw() first lays down depth with color writes off and
+    // depth.fs, then shades with GL_EQUAL and depth writes off, so hidden
+    // fragments never run the lighting. Call after loading; the CPU
+    // transform gets a depth program too. False if depth.fs does not build.
+    bool setDepthPrepass(bool enabled);
+    bool depthPrepassEnabled() const { return depthPrepass; }
+    // Counts every frame's fragments with occlusion queries, read a few
+    // frames late; with the pre-pass that shows the shading it saves.
+    // Turning it off waits for the last frames and keeps their totals.
+    void setFragmentCounting(bool enabled);
+    const FragmentStats &fragmentStats() const;
+
+    // writes the frame uniforms for view and light and, with culling or LODs
+    // on, decides what draw() submits; call before draw
+    void upload(const ViewParams &view, const Light &light);
+    // clears the bound framebuffer and draws the model
+    void draw();
+
+    // Replaces the instance buffer: every draw renders all instances in one
+    // glDrawElementsInstanced per material. An empty list means one
+    // untransformed copy.
+    void setInstances(const std::vector<InstanceData> &instances);
+    // For a scene: instance i is a copy of model instanceModels[i] only.
+    // Instances of the same model must be next to each other.
+    void setInstances(const std::vector<InstanceData> &instances, const std::vector<uint32_t> &instanceModels);
+    size_t numInstances() const { return instances.size(); }
+
+    // With it on and GL 4.3 or ARB_multi_draw_indirect, draw() submits
+    // every (LOD level, submesh) group in one glMultiDrawElementsIndirect,
+    // each command with its own range of the instance buffer and a material
+    // index per instance, instead of a draw per group. Returns whether it
+    // is in use; call after loading.
+    bool setMultiDraw(bool enabled);
+    // commands and GL draw calls of the last frame
+    size_t drawCommands() const { return lastDrawCommands; }
+    size_t drawCalls() const { return lastDrawCalls; }
+
+    // Point lights besides the key light, for clustered.fs: every upload()
+    // assigns them to view-space clusters on numThreads threads and uploads
+    // the per-cluster lists as buffer textures. Other fragment shaders
+    // ignore them. An empty list turns them off.
+    void setPointLights(const std::vector<PointLight> &lights, unsigned int numThreads);
+    // cluster occupancy and assignment time, averaged over the frames so far
+    void reportLights(std::ostream &out) const;
+    // box around every instance of everything loaded, before the model matrix
+    void sceneBounds(glm::vec3 &boundsMin, glm::vec3 &boundsMax) const;
+
+    // Every (instance, submesh) pair gets a box in a BVH. With culling on,
+    // upload() tests it against the view frustum on numThreads threads and
+    // packs the instances that are still visible into the instance buffer,
+    // grouped by submesh; draw() skips everything else.
+    void setCulling(bool enabled, unsigned int numThreads);
+    const CullStats &cullStats() const { return lastCull; }
+    // averages over every culled frame so far
+    void reportCulling(std::ostream &out) const;
+
+    // Each (instance, submesh) is drawn at the coarsest LOD whose error,
+    // projected from the nearest point of its box, stays within pixels.
+    // 0 always draws the full mesh.
+    void setLodThreshold(float pixels) { lodThreshold = pixels; }
+
+    // Call before load(): uploads 12 byte vertices instead of 24, positions in
+    // 16-bit steps across the mesh bounds and octahedral normals, when that
+    // keeps the position error within maxError of the bounds' diagonal.
+    // The CPU transform needs the float format.
+    void setQuantization(bool enabled, float maxError)
+    {
+        quantize = enabled;
+        quantizeError = maxError;
+    }
+    bool quantized() const { return quantizedVertices; }
+
+    // Call before load(): with a budget, the OBJ is streamed into the GPU
+    // buffers within about that many bytes of memory, however large it is,
+    // instead of going through the .meshbin cache. There are no LODs, and the
+    // CPU transform and quantization need the mesh in memory. 0 turns it off.
+    void setStreaming(size_t memoryBudget) { streamBudget = memoryBudget; }
+
+    const MeshBuffers &mesh() const { return meshBuffers; }
+
+    // Prepares the CPU-side transform: SoA positions, a vertex buffer for
+    // clip-space positions and a program that takes them as they are.
+    bool initCpuTransform(const std::string &vertexFilename, const std::string &fragmentFilename, unsigned int numThreads);
+    // With it on, upload() transforms every vertex on the CPU straight into
+    // the mapped buffer and draw() renders from it. Needs initCpuTransform.
+    void setCpuTransform(bool enabled);
+
+    // Transforms all vertices iterations times on the GPU (as points with
+    // rasterization off) and on the CPU (into the mapped buffer), and prints
+    // the vertices per second of each. Needs initCpuTransform.
+    void benchmarkTransforms(const ViewParams &view, int iterations);
+
+    // deletes the GL objects; must run while the context is still current
+    void release();
+
+    size_t numTriangles() const { return meshBuffers.numTriangles(); }
+
+private:
+    // the program draw() uses
+    ShaderProgram &program() { return useCpuTransform ? *cpuShader : *shader; }
+    ShaderProgram &depthProgram() { return useCpuTransform ? *cpuDepthShader : *depthShader; }
+    // issues the frame's draw commands with the bound program
+    void submitDraws();
+    // the GL objects every load creates, and the vertex attributes of VBO
+    // (bound, with VAO) for floats or, given one, a quantized mesh
+    void createObjects();
+    void setVertexFormat(const QuantizedMesh *quantized);
+    void setDecodeUniforms();
+    void transformOnCpu(const glm::mat4 &mvp);
+    void uploadMesh();
+    void resetDraws();
+    void selectDraws(const ViewParams &params, const glm::mat4 &mvp);
+    void assignLights(const glm::mat4 &view, const glm::mat4 &projection);
+    const std::vector<SubMesh> &levelSubmeshes(size_t level) const
+    {
+        return level == 0 ? meshBuffers.submeshes : meshBuffers.lods[level - 1].submeshes;
+    }
+
+    ShaderManager shaders;
+    ShaderProgram *shader = nullptr;
+    ShaderProgram *cpuShader = nullptr;
+    ShaderProgram *depthShader = nullptr, *cpuDepthShader = nullptr;
+    bool depthPrepass = false;
+    std::unique_ptr<FragmentCounter> fragmentCounter;
+    FragmentStats countedFragments; // of the counter last turned off
+    std::unique_ptr<CpuTransform> cpuTransform;
+    bool useCpuTransform = false;
+    GLuint cpuVAO = 0, clipVBO = 0;
+    GLuint instanceVBO = 0;
+    std::vector<InstanceData> instances;
+    // one model when a single OBJ is loaded, otherwise the scene's
+    std::vector<ModelRange> models;
+    std::vector<uint32_t> instanceModels;
+
+    // Culling and LOD selection work on items, each (instance, submesh of
+    // its model) pair, with their boxes in instance space.
+    std::vector<uint32_t> itemInstances, itemSubmeshes;
+    size_t itemTriangles = 0;
+    std::vector<Aabb> itemBoxes;
+    std::vector<float> instanceScales;
+    Bvh bvh;
+    std::unique_ptr<ThreadPool> cullPool;
+    bool culling = false;
+    float lodThreshold = 0.0f;
+    std::vector<uint32_t> visibleItems;
+    // item * levels + level of everything drawn, and what the buffer holds
+    std::vector<uint32_t> drawnItems, uploadedItems;
+    std::vector<InstanceData> visibleInstances;
+    std::vector<GLint> visibleMaterials; // material of each packed instance's draw
+    // per level * submeshes.size() + submesh: the instance buffer range draw() renders
+    std::vector<GLsizei> drawFirst, drawCount;
+    CullStats lastCull, totalCull;
+    size_t culledFrames = 0;
+    MeshBuffers meshBuffers;
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    GLuint frameUBO = 0, materialUBO = 0, clusterUBO = 0;
+    std::vector<PointLight> pointLights;
+    std::unique_ptr<LightClusters> lightClusters;
+    // lights, clusterLights and lightIndices of clustered.fs
+    GLuint lightBuffers[3] = {}, lightTextures[3] = {};
+    GLint maxTextureBufferSize = 0;
+    size_t lightFrames = 0, totalLightIndices = 0, totalLitClusters = 0, maxClusterLights = 0;
+    double totalAssignMs = 0.0;
+    bool reportedTruncation = false;
+    bool multiDraw = false;
+    GLuint indirectBuffer = 0, materialVBO = 0;
+    std::vector<DrawCommand> drawCommandList, uploadedCommands;
+    std::vector<GLint> drawMaterials; // per command
+    size_t lastDrawCommands = 0, lastDrawCalls = 0;
+    bool quantize = false, quantizedVertices = false;
+    glm::vec3 positionScale = glm::vec3(1.0f), positionOffset = glm::vec3(0.0f);
+    float quantizeError = 0.0f;
+    size_t streamBudget = 0;
+    std::unique_ptr<AsyncMeshLoader> loader;
+    std::unique_ptr<MeshSink> uploadSink;
+    GLenum indexType = GL_UNSIGNED_INT;
+    size_t indexSize = sizeof(unsigned int);
+};
+
+#endif
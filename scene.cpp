@@ -0,0 +1,176 @@
+#include "scene.h"
+#include "meshcache.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+namespace
+{
+    // what a material looks like when drawn; its name does not matter
+    typedef array<float, 7> MaterialKey;
+    typedef map<MaterialKey, unsigned int> MaterialIndex;
+
+    MaterialKey materialKey(const Material &material)
+    {
+        return {material.color.r, material.color.g, material.color.b, material.kd, material.ks, material.ka, material.ns};
+    }
+
+    // Appends one model's buffers to the packed mesh. Its levels beyond
+    // numLevels - 1 LODs are dropped, missing ones repeat its coarsest. A
+    // material that looks like one already packed is shared with it.
+    ModelRange appendModel(const MeshBuffers &model, size_t numLevels, Mesh &packed, MaterialIndex &materialIndex)
+    {
+        ModelRange range;
+        range.firstSubmesh = (unsigned int)packed.submeshes.size();
+        range.numSubmeshes = (unsigned int)model.submeshes.size();
+
+        unsigned int baseVertex = (unsigned int)packed.numVertices();
+        unsigned int baseIndex = (unsigned int)packed.indices.size();
+        packed.vertices.insert(packed.vertices.end(), model.vertices(), model.vertices() + model.numVertices() * 6);
+        packed.indices.resize(baseIndex + model.numIndices());
+        for (size_t i = 0; i < model.numIndices(); i++)
+        {
+            unsigned int index = model.shortIndices() ? ((const unsigned short *)model.indices())[i] : ((const unsigned int *)model.indices())[i];
+            packed.indices[baseIndex + i] = baseVertex + index;
+        }
+        vector<unsigned int> materialRemap(model.materials.size());
+        for (size_t m = 0; m < model.materials.size(); m++)
+        {
+            auto inserted = materialIndex.emplace(materialKey(model.materials[m]), (unsigned int)packed.materials.size());
+            if (inserted.second)
+                packed.materials.push_back(model.materials[m]);
+            materialRemap[m] = inserted.first->second;
+        }
+
+        auto appendLevel = [&](const vector<SubMesh> &submeshes, vector<SubMesh> &out) {
+            for (SubMesh submesh : submeshes)
+            {
+                submesh.first += baseIndex;
+                submesh.materialIndex = materialRemap[submesh.materialIndex];
+                out.push_back(submesh);
+            }
+        };
+        appendLevel(model.submeshes, packed.submeshes);
+        for (size_t level = 1; level < numLevels; level++)
+        {
+            size_t own = min(level, model.lods.size());
+            appendLevel(own == 0 ? model.submeshes : model.lods[own - 1].submeshes, packed.lods[level - 1].submeshes);
+            float error = own == 0 ? 0.0f : model.lods[own - 1].error;
+            range.lodErrors.push_back(error);
+            packed.lods[level - 1].error = max(packed.lods[level - 1].error, error);
+        }
+        return range;
+    }
+}
+
+bool readSceneManifest(const string &manifestFilename, vector<SceneObject> &objects)
+{
+    ifstream in(manifestFilename);
+    if (!in.is_open())
+    {
+        cerr << "scene: cannot open " << manifestFilename << endl;
+        return false;
+    }
+    objects.clear();
+    string line;
+    for (int lineNumber = 1; getline(in, line); lineNumber++)
+    {
+        istringstream fields(line);
+        SceneObject object;
+        if (!(fields >> object.objFilename) || object.objFilename[0] == '#')
+            continue;
+        bool ok = (bool)(fields >> object.position.x >> object.position.y >> object.position.z);
+        float value;
+        if (ok && fields >> value)
+        {
+            object.scale = value;
+            if (fields >> value)
+                object.rotationY = value;
+        }
+        // whatever did not parse as a number is left over
+        fields.clear();
+        string rest;
+        if (!ok || fields >> rest)
+        {
+            cerr << "scene: " << manifestFilename << ":" << lineNumber << ": expected model.obj x y z [scale [degrees]], got: " << line << endl;
+            return false;
+        }
+        objects.push_back(object);
+    }
+    return true;
+}
+
+bool loadScene(const string &manifestFilename, Scene &scene, size_t maxMaterials)
+{
+    vector<SceneObject> objects;
+    if (!readSceneManifest(manifestFilename, objects))
+        return false;
+    auto start = chrono::steady_clock::now();
+
+    // each OBJ once, in order of first use
+    map<string, uint32_t> modelIndex;
+    vector<MeshBuffers> models;
+    scene = Scene();
+    for (const SceneObject &object : objects)
+    {
+        if (modelIndex.count(object.objFilename) != 0)
+            continue;
+        models.emplace_back();
+        if (!loadMesh(object.objFilename, models.back()))
+            return false;
+        modelIndex.emplace(object.objFilename, (uint32_t)scene.modelFiles.size());
+        scene.modelFiles.push_back(object.objFilename);
+    }
+
+    size_t numLevels = 1;
+    for (const MeshBuffers &model : models)
+        numLevels = max(numLevels, model.lods.size() + 1);
+    scene.mesh.lods.resize(numLevels - 1);
+    for (MeshLod &lod : scene.mesh.lods)
+        lod.error = 0.0f;
+    MaterialIndex materialIndex;
+    for (const MeshBuffers &model : models)
+        scene.models.push_back(appendModel(model, numLevels, scene.mesh, materialIndex));
+    if (scene.mesh.materials.size() > maxMaterials)
+    {
+        cerr << "scene: " << manifestFilename << " uses " << scene.mesh.materials.size() << " different materials, more than the "
+             << maxMaterials << " the shaders can hold" << endl;
+        return false;
+    }
+
+    // objects of the same model next to each other, so each submesh draws
+    // one contiguous range of the instance buffer
+    vector<size_t> order(objects.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return modelIndex[objects[a].objFilename] < modelIndex[objects[b].objFilename];
+    });
+    for (size_t i : order)
+    {
+        const SceneObject &object = objects[i];
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), object.position);
+        model = glm::rotate(model, glm::radians(object.rotationY), glm::vec3(0.0f, 1.0f, 0.0f));
+        model = glm::scale(model, glm::vec3(object.scale));
+        InstanceData instance = identityInstance();
+        instance.model = model;
+        instance.normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        scene.instances.push_back(instance);
+        scene.instanceModels.push_back(modelIndex[object.objFilename]);
+    }
+
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "scene: " << manifestFilename << ", " << objects.size() << " objects of " << models.size() << " models, "
+         << scene.mesh.numVertices() << " vertices, " << scene.mesh.submeshes.size() << " submeshes and "
+         << scene.mesh.materials.size() << " materials in shared buffers, "
+         << numLevels << " levels, packed in " << ms << " ms" << endl;
+    return true;
+}
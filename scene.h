@@ -0,0 +1,55 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "instances.h"
+#include "objloader.h"
+
+// A scene manifest places objects, one per line:
+//
+//     path/to/model.obj  x y z  [scale  [degrees about Y]]
+//
+// Blank lines and lines starting with # are skipped. Paths are relative to
+// the working directory, like the model argument.
+struct SceneObject
+{
+    std::string objFilename;
+    glm::vec3 position;
+    float scale = 1.0f;
+    float rotationY = 0.0f; // degrees
+};
+
+// Prints the offending line and returns false on anything malformed.
+bool readSceneManifest(const std::string &manifestFilename, std::vector<SceneObject> &objects);
+
+// The submeshes of one model within a packed mesh. A model with fewer LODs
+// than the packed mesh repeats its coarsest level in the levels past its own.
+struct ModelRange
+{
+    unsigned int firstSubmesh, numSubmeshes;
+    std::vector<float> lodErrors; // per LOD level of the packed mesh
+};
+
+// Every model a manifest uses, packed one after another into a single mesh
+// so that all of them share one vertex and one index buffer, and its objects
+// as instances of those models.
+struct Scene
+{
+    Mesh mesh;                           // indices already offset to the model's vertices
+    std::vector<ModelRange> models;      // in order of first use
+    std::vector<std::string> modelFiles; // parallel to models
+    std::vector<InstanceData> instances; // grouped by model
+    std::vector<uint32_t> instanceModels;
+};
+
+// Reads the manifest and loads each OBJ it names once, through the mesh
+// cache like a single model. Materials that look the same are shared across
+// models. Returns false if any model fails, or if more than maxMaterials
+// different materials remain.
+bool loadScene(const std::string &manifestFilename, Scene &scene, size_t maxMaterials);
+
+#endif
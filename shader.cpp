@@ -0,0 +1,214 @@
+#include "shader.h"
+#include "shadercache.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+    const char *const uniformNames[NUM_SHADER_UNIFORMS] = {
+        "model",
+        "mvp",
+        "normalMatrix",
+        "positionScale",
+        "positionOffset",
+        "octNormals",
+    };
+
+    bool readFile(const string &filename, string &text)
+    {
+        ifstream in(filename);
+        if (!in.is_open())
+            return false;
+        stringstream buffer;
+        buffer << in.rdbuf();
+        text = buffer.str();
+        return true;
+    }
+
+    // modification time in nanoseconds, 0 if the file is missing
+    int64_t modificationTime(const string &filename)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0)
+            return 0;
+        return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    GLuint compileShader(GLenum type, const string &filename, const string &text)
+    {
+        const char *kind = type == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT";
+        GLchar const *source = text.c_str();
+
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        // check for shader compile errors
+        int success;
+        char infoLog[512];
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(shader, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::" << kind << "::COMPILATION_FAILED " << filename << "\n"
+                      << infoLog << std::endl;
+            glDeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+}
+
+void ShaderProgram::release()
+{
+    if (program != 0)
+        glDeleteProgram(program);
+    program = 0;
+}
+
+bool ShaderProgram::load(const string &vertexFilename, const string &fragmentFilename, const string &cacheDir)
+{
+    // remembered first, so a failed load is retried by reload()
+    vertexFile = vertexFilename;
+    fragmentFile = fragmentFilename;
+    cacheDirectory = cacheDir;
+    vertexTime = modificationTime(vertexFilename);
+    fragmentTime = modificationTime(fragmentFilename);
+
+    string vertexSource, fragmentSource;
+    if (!readFile(vertexFilename, vertexSource))
+    {
+        std::cout << "ERROR::SHADER::VERTEX::FILE_NOT_FOUND " << vertexFilename << std::endl;
+        return false;
+    }
+    if (!readFile(fragmentFilename, fragmentSource))
+    {
+        std::cout << "ERROR::SHADER::FRAGMENT::FILE_NOT_FOUND " << fragmentFilename << std::endl;
+        return false;
+    }
+
+    auto start = chrono::steady_clock::now();
+    GLuint linked = glCreateProgram();
+    bool useCache = !cacheDirectory.empty() && programBinariesSupported();
+    uint64_t key = useCache ? programCacheKey(vertexSource, fragmentSource) : 0;
+    bool cached = useCache && loadProgramBinary(cacheDirectory, key, linked);
+    if (!cached)
+    {
+        GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexFilename, vertexSource);
+        GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentFilename, fragmentSource);
+        if (vertexShader == 0 || fragmentShader == 0)
+        {
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+            glDeleteProgram(linked);
+            return false;
+        }
+
+        // link shaders
+        glAttachShader(linked, vertexShader);
+        glAttachShader(linked, fragmentShader);
+        if (useCache)
+            glProgramParameteri(linked, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(linked);
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        // check for linking errors
+        int success;
+        char infoLog[512];
+        glGetProgramiv(linked, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(linked, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                      << infoLog << std::endl;
+            glDeleteProgram(linked);
+            return false;
+        }
+        if (useCache)
+            saveProgramBinary(cacheDirectory, key, linked);
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "shader: " << vertexFilename << " + " << fragmentFilename << (cached ? " from the binary cache in " : " compiled in ") << ms << " ms" << endl;
+
+    if (program != 0)
+        glDeleteProgram(program);
+    program = linked;
+
+    for (int i = 0; i < NUM_SHADER_UNIFORMS; i++)
+        locations[i] = glGetUniformLocation(program, uniformNames[i]);
+
+    GLuint frameBlock = glGetUniformBlockIndex(program, "FrameData");
+    if (frameBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, frameBlock, FRAME_BLOCK_BINDING);
+    GLuint materialBlock = glGetUniformBlockIndex(program, "Materials");
+    if (materialBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, materialBlock, MATERIAL_BLOCK_BINDING);
+    GLuint clusterBlock = glGetUniformBlockIndex(program, "Clusters");
+    if (clusterBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, clusterBlock, CLUSTER_BLOCK_BINDING);
+
+    // samplers are program state too; -1 for programs without them is ignored
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "lights"), LIGHT_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "clusterLights"), CLUSTER_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "lightIndices"), LIGHT_INDEX_TEXTURE_UNIT);
+    return true;
+}
+
+bool ShaderProgram::sourcesChanged() const
+{
+    return modificationTime(vertexFile) != vertexTime || modificationTime(fragmentFile) != fragmentTime;
+}
+
+ShaderProgram *ShaderManager::get(const string &vertexFilename, const string &fragmentFilename)
+{
+    for (const unique_ptr<ShaderProgram> &program : programs)
+    {
+        if (program->vertexFilename() == vertexFilename && program->fragmentFilename() == fragmentFilename)
+            return program->id() != 0 ? program.get() : nullptr;
+    }
+    // kept even when it fails, so a fix on disk is picked up by reloadChanged
+    programs.emplace_back(new ShaderProgram());
+    ShaderProgram *program = programs.back().get();
+    return program->load(vertexFilename, fragmentFilename, cacheDirectory) ? program : nullptr;
+}
+
+vector<ShaderProgram *> ShaderManager::reloadChanged()
+{
+    vector<ShaderProgram *> reloaded;
+    for (const unique_ptr<ShaderProgram> &program : programs)
+    {
+        if (program->sourcesChanged() && program->reload())
+            reloaded.push_back(program.get());
+    }
+    return reloaded;
+}
+
+void ShaderManager::release()
+{
+    for (const unique_ptr<ShaderProgram> &program : programs)
+        program->release();
+    programs.clear();
+}
+
+void uploadMaterials(GLuint ubo, const vector<Material> &materials)
+{
+    if (materials.size() > MAX_MATERIALS)
+        cerr << "Warning: " << materials.size() << " materials, only the first " << MAX_MATERIALS << " are used" << endl;
+
+    vector<MaterialUniforms> data(MAX_MATERIALS);
+    for (size_t i = 0; i < materials.size() && i < MAX_MATERIALS; i++)
+    {
+        const Material &mat = materials[i];
+        data[i].color = glm::vec4(mat.color, 1.0f);
+        data[i].coefficients = glm::vec4(mat.ka, mat.kd, mat.ks, mat.ns);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, data.size() * sizeof(MaterialUniforms), data.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
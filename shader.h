@@ -0,0 +1,136 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "objloader.h"
+
+// Uniforms set per draw. Their locations are looked up once after linking;
+// a program that does not use one gets -1, which GL ignores.
+enum ShaderUniform
+{
+    UNIFORM_MODEL,
+    UNIFORM_MVP,
+    UNIFORM_NORMAL_MATRIX,
+    UNIFORM_POSITION_SCALE,
+    UNIFORM_POSITION_OFFSET,
+    UNIFORM_OCT_NORMALS,
+    NUM_SHADER_UNIFORMS
+};
+
+// Binding points of the uniform blocks shared by every program
+enum UniformBlockBinding
+{
+    FRAME_BLOCK_BINDING = 0,
+    MATERIAL_BLOCK_BINDING = 1,
+    CLUSTER_BLOCK_BINDING = 2
+};
+
+// Texture units of the buffer textures clustered.fs reads its point lights
+// from; the samplers are pointed at them when a program is linked
+enum TextureUnit
+{
+    LIGHT_TEXTURE_UNIT = 0,       // lights: position and radius, color * intensity
+    CLUSTER_TEXTURE_UNIT = 1,     // clusterLights: first and count per cluster
+    LIGHT_INDEX_TEXTURE_UNIT = 2  // lightIndices: the lists they point into
+};
+
+// Must match MAX_MATERIALS in the fragment shaders: 512 entries of 32 bytes
+// fill the 16 KB every GL 3.3 implementation supports for a uniform block.
+const unsigned int MAX_MATERIALS = 512;
+
+// std140 mirror of the FrameData block: camera and light, written once per frame
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 lightPosition; // xyz
+    glm::vec4 lightColor;    // rgb, w = intensity
+    glm::vec4 viewPosition;  // camera position in world space
+};
+
+// std140 mirror of the Clusters block: how clustered.fs finds its cluster,
+// written once per frame while there are point lights
+struct ClusterUniforms
+{
+    glm::uvec4 counts; // clusters along x, y and depth; w = number of lights
+    glm::vec4 params;  // pixels per cluster in x and y, then the scale and
+                       // bias that turn log(view depth) into a depth slice
+};
+
+// std140 mirror of one entry of the Materials block
+struct MaterialUniforms
+{
+    glm::vec4 color;        // rgb
+    glm::vec4 coefficients; // ka, kd, ks, ns
+};
+
+class ShaderProgram
+{
+public:
+    ShaderProgram() {}
+    ShaderProgram(const ShaderProgram &) = delete;
+    ShaderProgram &operator=(const ShaderProgram &) = delete;
+
+    // Compiles and links the two shader files, resolves uniform locations and
+    // binds the uniform blocks. Errors are printed and false is returned,
+    // leaving a program loaded before as it was. With a cache directory the
+    // linked binary is restored from there when the sources and driver
+    // match, and saved there when they did not.
+    bool load(const std::string &vertexFilename, const std::string &fragmentFilename, const std::string &cacheDirectory = std::string());
+    // load() again from the same files
+    bool reload() { return load(vertexFile, fragmentFile, cacheDirectory); }
+    // true once either file was modified after it was last loaded
+    bool sourcesChanged() const;
+
+    // deletes the program; must run while the context is still current
+    void release();
+
+    void use() const { glUseProgram(program); }
+    GLint uniform(ShaderUniform which) const { return locations[which]; }
+    GLuint id() const { return program; }
+    const std::string &vertexFilename() const { return vertexFile; }
+    const std::string &fragmentFilename() const { return fragmentFile; }
+
+private:
+    GLuint program = 0;
+    GLint locations[NUM_SHADER_UNIFORMS];
+    std::string vertexFile, fragmentFile, cacheDirectory;
+    int64_t vertexTime = 0, fragmentTime = 0; // modification times, nanoseconds
+};
+
+// Every program loaded so far, by vertex and fragment file, so switching
+// back to one is free; all of them go through one binary cache directory.
+class ShaderManager
+{
+public:
+    // "" turns the binary cache off; call before the first get()
+    void setCacheDirectory(const std::string &directory) { cacheDirectory = directory; }
+
+    // the program linked from the two files, loaded on first use; nullptr
+    // after printing the errors if it does not build
+    ShaderProgram *get(const std::string &vertexFilename, const std::string &fragmentFilename);
+
+    // Relinks every program whose files changed since they were loaded and
+    // returns those that were. One that no longer builds keeps its old
+    // binary, and is tried again after the next change.
+    std::vector<ShaderProgram *> reloadChanged();
+
+    // deletes every program; must run while the context is still current
+    void release();
+
+private:
+    std::vector<std::unique_ptr<ShaderProgram>> programs;
+    std::string cacheDirectory;
+};
+
+// Fills the Materials uniform block; at most MAX_MATERIALS entries are used.
+void uploadMaterials(GLuint ubo, const std::vector<Material> &materials);
+
+#endif
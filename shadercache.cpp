@@ -0,0 +1,125 @@
+#include "shadercache.h"
+#include "hash.h"
+#include "mappedfile.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    const char PROGBIN_MAGIC[8] = {'P', 'R', 'O', 'G', 'B', 'I', 'N', '\0'};
+    const uint32_t PROGBIN_VERSION = 1;
+
+    struct ProgramBinaryHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t format; // GLenum from glGetProgramBinary
+        uint64_t key;    // repeated, so a renamed file is not trusted
+        uint64_t size;
+        uint64_t payloadHash;
+    };
+
+    string cacheFilename(const string &cacheDirectory, uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.progbin", (unsigned long long)key);
+        return cacheDirectory + name;
+    }
+
+    string glString(GLenum name)
+    {
+        const GLubyte *text = glGetString(name);
+        return text != NULL ? (const char *)text : "";
+    }
+}
+
+bool programBinariesSupported()
+{
+    if (!GLEW_ARB_get_program_binary)
+        return false;
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    return numFormats > 0;
+}
+
+uint64_t programCacheKey(const string &vertexSource, const string &fragmentSource)
+{
+    // a binary is only valid for the driver build that produced it
+    string driver = glString(GL_VENDOR) + '\n' + glString(GL_RENDERER) + '\n' + glString(GL_VERSION);
+    uint64_t key = hashBytes(driver.data(), driver.size(), PROGBIN_VERSION);
+    key = hashBytes(vertexSource.data(), vertexSource.size(), key);
+    return hashBytes(fragmentSource.data(), fragmentSource.size(), key);
+}
+
+bool loadProgramBinary(const string &cacheDirectory, uint64_t key, GLuint program)
+{
+    MappedFile file(cacheFilename(cacheDirectory, key));
+    if (!file.isOpen() || file.size() < sizeof(ProgramBinaryHeader))
+        return false;
+    ProgramBinaryHeader header;
+    memcpy(&header, file.begin(), sizeof(header));
+    const char *binary = file.begin() + sizeof(header);
+    if (memcmp(header.magic, PROGBIN_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGBIN_VERSION || header.key != key ||
+        header.size != file.size() - sizeof(header) || hashBytes(binary, header.size) != header.payloadHash)
+        return false;
+
+    // a driver may still refuse a binary it wrote, after an update that kept
+    // its version string; the caller then compiles from source
+    glGetError();
+    glProgramBinary(program, header.format, binary, (GLsizei)header.size);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return glGetError() == GL_NO_ERROR && linked == GL_TRUE;
+}
+
+bool saveProgramBinary(const string &cacheDirectory, uint64_t key, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+    vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    ProgramBinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROGBIN_MAGIC, sizeof(header.magic));
+    header.version = PROGBIN_VERSION;
+    header.format = format;
+    header.key = key;
+    header.size = (uint64_t)length;
+    header.payloadHash = hashBytes(binary.data(), header.size);
+
+    if (mkdir(cacheDirectory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        cerr << "shadercache: cannot create " << cacheDirectory << endl;
+        return false;
+    }
+    // written aside and renamed, so another instance never maps half a file
+    string filename = cacheFilename(cacheDirectory, key);
+    string tempFilename = filename + ".tmp" + to_string(getpid());
+    FILE *file = fopen(tempFilename.c_str(), "wb");
+    if (file == NULL)
+    {
+        cerr << "shadercache: cannot write " << tempFilename << endl;
+        return false;
+    }
+    bool ok = fwrite(&header, 1, sizeof(header), file) == sizeof(header) && fwrite(binary.data(), 1, header.size, file) == header.size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempFilename.c_str(), filename.c_str()) != 0)
+    {
+        cerr << "shadercache: failed to write " << filename << endl;
+        unlink(tempFilename.c_str());
+        return false;
+    }
+    return true;
+}
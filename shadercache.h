@@ -0,0 +1,28 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+
+// Linked programs saved with glGetProgramBinary, so later runs skip GLSL
+// compilation. Each program is one file in a cache directory, named after a
+// hash of both sources and the driver's vendor, renderer and version, so
+// editing a shader or updating the driver simply misses.
+
+// false when the context cannot save or restore program binaries
+bool programBinariesSupported();
+
+// the key for a program from these sources on the current context's driver
+uint64_t programCacheKey(const std::string &vertexSource, const std::string &fragmentSource);
+
+// Links program from the binary cached under key. False, with program left
+// unlinked, if there is none or the driver rejects it.
+bool loadProgramBinary(const std::string &cacheDirectory, uint64_t key, GLuint program);
+
+// Saves the binary of program, which must have been linked with
+// GL_PROGRAM_BINARY_RETRIEVABLE_HINT; errors are printed.
+bool saveProgramBinary(const std::string &cacheDirectory, uint64_t key, GLuint program);
+
+#endif
@@ -0,0 +1,398 @@
+#include "simplify.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+using namespace std;
+
+namespace
+{
+    // a collapse may turn a remaining triangle's normal by at most ~75 degrees
+    const double MIN_NORMAL_COS = 0.25;
+    // on attribute seams, every vertex needs a partner this close in normal
+    const float MIN_SEAM_NORMAL_COS = 0.7f;
+    // share of the triangles one pass may remove before costs are refreshed
+    const size_t PASS_FRACTION = 4;
+
+    // Sum of squared distances to a set of planes, each weighted by the area
+    // of its triangle: a symmetric 4x4 matrix stored as its upper triangle.
+    struct Quadric
+    {
+        double a[10] = {};
+        double area = 0.0;
+
+        void addPlane(const glm::dvec3 &n, double d, double weight)
+        {
+            a[0] += weight * n.x * n.x;
+            a[1] += weight * n.x * n.y;
+            a[2] += weight * n.x * n.z;
+            a[3] += weight * n.x * d;
+            a[4] += weight * n.y * n.y;
+            a[5] += weight * n.y * n.z;
+            a[6] += weight * n.y * d;
+            a[7] += weight * n.z * n.z;
+            a[8] += weight * n.z * d;
+            a[9] += weight * d * d;
+            area += weight;
+        }
+
+        void add(const Quadric &q)
+        {
+            for (int i = 0; i < 10; i++)
+                a[i] += q.a[i];
+            area += q.area;
+        }
+
+        double evaluate(const glm::dvec3 &p) const
+        {
+            return a[0] * p.x * p.x + 2.0 * a[1] * p.x * p.y + 2.0 * a[2] * p.x * p.z + 2.0 * a[3] * p.x +
+                   a[4] * p.y * p.y + 2.0 * a[5] * p.y * p.z + 2.0 * a[6] * p.y +
+                   a[7] * p.z * p.z + 2.0 * a[8] * p.z + a[9];
+        }
+    };
+
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3 &p) const
+        {
+            uint32_t bits[3];
+            memcpy(bits, &p, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t from, to; // positions
+        double cost;
+    };
+
+    // Works on the vertices one triangle list uses. Vertices that share a
+    // position (split only by their normals) are welded into one position,
+    // which is what collapses move; each vertex then follows its position
+    // to the vertex there with the closest normal.
+    class Simplifier
+    {
+    public:
+        Simplifier(const vector<float> &vertices, const unsigned int *indices, size_t numIndices);
+
+        // returns the largest error of any collapse
+        float run(size_t targetTriangles, const atomic<bool> *cancel);
+        void output(vector<unsigned int> &out) const;
+
+    private:
+        bool canCollapse(uint32_t from, uint32_t to) const;
+        uint32_t closestVertex(uint32_t vertex, uint32_t position) const;
+        void buildAdjacency();
+
+        // per vertex (local index)
+        vector<unsigned int> globalIndex;
+        vector<glm::vec3> normals;
+        vector<uint32_t> positionOf;
+        // per position
+        vector<glm::vec3> positions;
+        vector<vector<uint32_t>> verticesAt;
+        vector<Quadric> quadrics;
+        vector<char> locked;
+        // triangles as local vertex indices, and the triangles around each
+        // position: adjacency[adjacencyStart[p], adjacencyStart[p + 1])
+        vector<uint32_t> triangles;
+        vector<uint32_t> adjacencyStart, adjacency;
+    };
+
+    Simplifier::Simplifier(const vector<float> &vertices, const unsigned int *indices, size_t numIndices)
+    {
+        unordered_map<unsigned int, uint32_t> localIndex;
+        unordered_map<glm::vec3, uint32_t, PositionHash> positionIndex;
+        triangles.reserve(numIndices);
+        for (size_t i = 0; i < numIndices; i++)
+        {
+            auto inserted = localIndex.emplace(indices[i], (uint32_t)globalIndex.size());
+            if (inserted.second)
+            {
+                const float *v = &vertices[(size_t)indices[i] * 6];
+                // + 0.0f folds -0 into 0 so both hash alike
+                glm::vec3 p(v[0] + 0.0f, v[1] + 0.0f, v[2] + 0.0f);
+                auto position = positionIndex.emplace(p, (uint32_t)positions.size());
+                if (position.second)
+                {
+                    positions.push_back(p);
+                    verticesAt.push_back(vector<uint32_t>());
+                }
+                globalIndex.push_back(indices[i]);
+                normals.push_back(glm::vec3(v[3], v[4], v[5]));
+                positionOf.push_back(position.first->second);
+                verticesAt[position.first->second].push_back(inserted.first->second);
+            }
+            triangles.push_back(inserted.first->second);
+        }
+
+        // plane quadrics, and edges used by one triangle (borders) or by
+        // more than two (non-manifold), whose vertices must not move
+        quadrics.resize(positions.size());
+        locked.assign(positions.size(), 0);
+        unordered_map<uint64_t, uint32_t> edgeUses;
+        for (size_t t = 0; t < triangles.size(); t += 3)
+        {
+            uint32_t p[3] = {positionOf[triangles[t]], positionOf[triangles[t + 1]], positionOf[triangles[t + 2]]};
+            glm::dvec3 p0(positions[p[0]]), p1(positions[p[1]]), p2(positions[p[2]]);
+            glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(n);
+            if (length > 0.0)
+            {
+                n /= length;
+                for (int k = 0; k < 3; k++)
+                    quadrics[p[k]].addPlane(n, -glm::dot(n, p0), length * 0.5);
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t a = min(p[k], p[(k + 1) % 3]), b = max(p[k], p[(k + 1) % 3]);
+                edgeUses[(uint64_t)a << 32 | b]++;
+            }
+        }
+        for (const auto &edge : edgeUses)
+        {
+            if (edge.second != 2)
+            {
+                locked[(uint32_t)(edge.first >> 32)] = 1;
+                locked[(uint32_t)edge.first] = 1;
+            }
+        }
+    }
+
+    void Simplifier::buildAdjacency()
+    {
+        adjacencyStart.assign(positions.size() + 1, 0);
+        for (uint32_t vertex : triangles)
+            adjacencyStart[positionOf[vertex] + 1]++;
+        for (size_t p = 0; p < positions.size(); p++)
+            adjacencyStart[p + 1] += adjacencyStart[p];
+        adjacency.resize(triangles.size());
+        vector<uint32_t> next(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (size_t i = 0; i < triangles.size(); i++)
+            adjacency[next[positionOf[triangles[i]]]++] = (uint32_t)(i / 3);
+    }
+
+    uint32_t Simplifier::closestVertex(uint32_t vertex, uint32_t position) const
+    {
+        uint32_t best = verticesAt[position][0];
+        float bestCos = -2.0f;
+        for (uint32_t candidate : verticesAt[position])
+        {
+            float c = glm::dot(normals[vertex], normals[candidate]);
+            if (c > bestCos)
+            {
+                bestCos = c;
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    bool Simplifier::canCollapse(uint32_t from, uint32_t to) const
+    {
+        // a seam may only collapse where every side finds a matching normal
+        if (verticesAt[from].size() > 1 || verticesAt[to].size() > 1)
+        {
+            for (uint32_t vertex : verticesAt[from])
+            {
+                if (glm::dot(normals[vertex], normals[closestVertex(vertex, to)]) < MIN_SEAM_NORMAL_COS)
+                    return false;
+            }
+        }
+
+        // the triangles that survive must not flip or fold over
+        for (uint32_t i = adjacencyStart[from]; i < adjacencyStart[from + 1]; i++)
+        {
+            const uint32_t *t = &triangles[(size_t)adjacency[i] * 3];
+            uint32_t p[3] = {positionOf[t[0]], positionOf[t[1]], positionOf[t[2]]};
+            if (p[0] == to || p[1] == to || p[2] == to)
+                continue;
+            glm::dvec3 before[3], after[3];
+            for (int k = 0; k < 3; k++)
+            {
+                before[k] = glm::dvec3(positions[p[k]]);
+                after[k] = p[k] == from ? glm::dvec3(positions[to]) : before[k];
+            }
+            glm::dvec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::dvec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(n0, n1) < MIN_NORMAL_COS * glm::length(n0) * glm::length(n1) || glm::length(n1) == 0.0)
+                return false;
+        }
+        return true;
+    }
+
+    float Simplifier::run(size_t targetTriangles, const atomic<bool> *cancel)
+    {
+        float maxError = 0.0f;
+        vector<uint32_t> remap(globalIndex.size());
+        for (size_t i = 0; i < remap.size(); i++)
+            remap[i] = (uint32_t)i;
+
+        while (triangles.size() / 3 > targetTriangles && (cancel == nullptr || !*cancel))
+        {
+            buildAdjacency();
+            size_t numTriangles = triangles.size() / 3;
+
+            // both directions of every edge, cheapest first
+            vector<Collapse> collapses;
+            collapses.reserve(triangles.size() * 2);
+            for (size_t t = 0; t < triangles.size(); t += 3)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    uint32_t a = positionOf[triangles[t + k]], b = positionOf[triangles[t + (k + 1) % 3]];
+                    Quadric q = quadrics[a];
+                    q.add(quadrics[b]);
+                    if (!locked[a])
+                        collapses.push_back(Collapse{a, b, q.evaluate(glm::dvec3(positions[b]))});
+                    if (!locked[b])
+                        collapses.push_back(Collapse{b, a, q.evaluate(glm::dvec3(positions[a]))});
+                }
+            }
+            sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+            // Take collapses in order while they do not touch a neighbourhood
+            // changed earlier in this pass; the flip test above relies on it.
+            size_t budget = min(numTriangles - targetTriangles, max<size_t>(numTriangles / PASS_FRACTION, 1));
+            size_t removed = 0;
+            vector<char> touched(positions.size(), 0);
+            for (const Collapse &collapse : collapses)
+            {
+                if (removed >= budget)
+                    break;
+                if (touched[collapse.from] || touched[collapse.to] || !canCollapse(collapse.from, collapse.to))
+                    continue;
+
+                for (uint32_t vertex : verticesAt[collapse.from])
+                    remap[vertex] = closestVertex(vertex, collapse.to);
+                verticesAt[collapse.from].clear();
+                double area = quadrics[collapse.from].area + quadrics[collapse.to].area;
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                if (area > 0.0)
+                    maxError = max(maxError, (float)sqrt(max(collapse.cost, 0.0) / area));
+
+                for (uint32_t i = adjacencyStart[collapse.from]; i < adjacencyStart[collapse.from + 1]; i++)
+                {
+                    const uint32_t *t = &triangles[(size_t)adjacency[i] * 3];
+                    bool degenerate = false;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        touched[positionOf[t[k]]] = 1;
+                        degenerate = degenerate || positionOf[t[k]] == collapse.to;
+                    }
+                    removed += degenerate;
+                }
+                touched[collapse.to] = 1;
+            }
+            if (removed == 0)
+                break;
+
+            // move the corners over and drop the triangles that collapsed
+            size_t kept = 0;
+            for (size_t t = 0; t < triangles.size(); t += 3)
+            {
+                uint32_t v[3] = {remap[triangles[t]], remap[triangles[t + 1]], remap[triangles[t + 2]]};
+                if (positionOf[v[0]] == positionOf[v[1]] || positionOf[v[1]] == positionOf[v[2]] || positionOf[v[0]] == positionOf[v[2]])
+                    continue;
+                for (int k = 0; k < 3; k++)
+                    triangles[kept++] = v[k];
+            }
+            triangles.resize(kept);
+        }
+        return maxError;
+    }
+
+    void Simplifier::output(vector<unsigned int> &out) const
+    {
+        out.resize(triangles.size());
+        for (size_t i = 0; i < triangles.size(); i++)
+            out[i] = globalIndex[triangles[i]];
+    }
+}
+
+vector<unsigned int> simplifyTriangles(const vector<float> &vertices, const unsigned int *indices, size_t numIndices,
+                                       size_t targetTriangles, float &error, const atomic<bool> *cancel)
+{
+    vector<unsigned int> out;
+    error = 0.0f;
+    if (numIndices / 3 <= targetTriangles)
+    {
+        out.assign(indices, indices + numIndices);
+        return out;
+    }
+    Simplifier simplifier(vertices, indices, numIndices);
+    error = simplifier.run(targetTriangles, cancel);
+    simplifier.output(out);
+    return out;
+}
+
+void generateLods(Mesh &mesh, const LodOptions &options)
+{
+    auto startTime = chrono::steady_clock::now();
+    mesh.lods.clear();
+    ThreadPool pool(options.numThreads);
+
+    const vector<SubMesh> *previous = &mesh.submeshes;
+    size_t previousTriangles = mesh.numTriangles();
+    float previousError = 0.0f;
+    for (unsigned int level = 1; level <= options.maxLevels; level++)
+    {
+        if (previousTriangles * options.reduction < options.minTriangles)
+            break;
+
+        // submeshes are independent: their shared borders never move
+        size_t numSubmeshes = previous->size();
+        vector<vector<unsigned int>> results(numSubmeshes);
+        vector<float> errors(numSubmeshes, 0.0f);
+        pool.parallelFor(numSubmeshes, [&](size_t i) {
+            if (options.cancel != nullptr && *options.cancel)
+                return;
+            const SubMesh &submesh = (*previous)[i];
+            size_t target = (size_t)ceil(submesh.count / 3 * options.reduction);
+            results[i] = simplifyTriangles(mesh.vertices, &mesh.indices[submesh.first], submesh.count, target, errors[i], options.cancel);
+        });
+        if (options.cancel != nullptr && *options.cancel)
+            return;
+
+        MeshLod lod;
+        lod.submeshes = *previous;
+        lod.error = previousError;
+        size_t firstIndex = mesh.indices.size();
+        for (size_t i = 0; i < numSubmeshes; i++)
+        {
+            lod.submeshes[i].first = (unsigned int)mesh.indices.size();
+            lod.submeshes[i].count = (unsigned int)results[i].size();
+            mesh.indices.insert(mesh.indices.end(), results[i].begin(), results[i].end());
+            lod.error = max(lod.error, previousError + errors[i]);
+        }
+        size_t triangles = (mesh.indices.size() - firstIndex) / 3;
+        if (triangles > previousTriangles * 0.8)
+        {
+            mesh.indices.resize(firstIndex);
+            break;
+        }
+
+        mesh.lods.push_back(lod);
+        previous = &mesh.lods.back().submeshes;
+        previousTriangles = triangles;
+        previousError = lod.error;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << "lod: " << mesh.lods.size() << " levels in " << seconds * 1000.0 << " ms:";
+    for (const MeshLod &lod : mesh.lods)
+    {
+        size_t triangles = 0;
+        for (const SubMesh &submesh : lod.submeshes)
+            triangles += submesh.count / 3;
+        cout << " " << triangles << " (error " << lod.error << ")";
+    }
+    cout << endl;
+}
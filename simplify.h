@@ -0,0 +1,38 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "objloader.h"
+
+struct LodOptions
+{
+    unsigned int maxLevels = 4;
+    float reduction = 0.25f;  // triangles kept from one level to the next
+    size_t minTriangles = 64; // no level below this
+    unsigned int numThreads = 0;
+    // checked between passes of collapses; once it is true the levels
+    // built so far are kept and the rest abandoned
+    const std::atomic<bool> *cancel = nullptr;
+};
+
+// Simplifies a triangle list over interleaved position/normal vertices by
+// quadric error edge collapse (Garland and Heckbert). Every collapse moves
+// one vertex onto a neighbour, so the result indexes the same vertices and
+// needs no new vertex data. Vertices on open borders stay in place, which
+// keeps the seams between submeshes closed at every level. Stops at
+// targetTriangles or when no collapse is left that does not flip a
+// triangle. error receives the largest RMS distance, in object units, that
+// a collapse moved the surface by. Once cancel turns true it stops after
+// the pass of collapses under way.
+std::vector<unsigned int> simplifyTriangles(const std::vector<float> &vertices, const unsigned int *indices, size_t numIndices,
+                                            size_t targetTriangles, float &error, const std::atomic<bool> *cancel = nullptr);
+
+// Builds mesh.lods: each level simplifies every submesh of the one before
+// by options.reduction, with its indices appended to mesh.indices. Stops
+// early when a level no longer gets meaningfully smaller.
+void generateLods(Mesh &mesh, const LodOptions &options = LodOptions());
+
+#endif
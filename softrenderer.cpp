@@ -0,0 +1,458 @@
+#include "softrenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    typedef SoftwareRenderer::ShadedVertex ShadedVertex;
+    typedef SoftwareRenderer::TriangleSetup TriangleSetup;
+    typedef SoftwareRenderer::TileTriangle TileTriangle;
+
+    const int TILE_SIZE = SoftwareRenderer::TILE_SIZE;
+    const uint32_t NO_TRIANGLE = 0xFFFFFFFF;
+    // vertex references with this bit set index the chunk's clipped vertices
+    const uint32_t CLIPPED_VERTEX = 0x80000000;
+
+    const size_t VERTEX_BLOCK = 16384;
+    const size_t MIN_CHUNK_TRIANGLES = 4096;
+
+    inline uint32_t readIndex(const MeshBuffers &mesh, size_t i)
+    {
+        if (mesh.shortIndices())
+            return ((const unsigned short *)mesh.indices())[i];
+        return ((const unsigned int *)mesh.indices())[i];
+    }
+
+    // all three vertices outside the same clip plane
+    bool trivialReject(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c)
+    {
+        return (a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+               (a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+               (a.z > a.w && b.z > b.w && c.z > c.w) || (a.z < -a.w && b.z < -b.w && c.z < -c.w);
+    }
+
+    ShadedVertex lerpVertex(const ShadedVertex &a, const ShadedVertex &b, float t)
+    {
+        ShadedVertex v;
+        v.clip = a.clip + (b.clip - a.clip) * t;
+        v.world = a.world + (b.world - a.world) * t;
+        v.normal = a.normal + (b.normal - a.normal) * t;
+        return v;
+    }
+
+    // Writes depth and triangle id for the pixels of tile (x0, y0) the
+    // triangle covers and that pass GL_LESS against the tile depth buffer.
+    // Returns how many did.
+    size_t rasterTriangle(const TriangleSetup &t, uint32_t id, int x0, int y0, float *depth, uint32_t *triangle)
+    {
+        size_t passed = 0;
+        int xs = max((int)t.minX, x0), xe = min((int)t.maxX, x0 + TILE_SIZE - 1);
+        int ys = max((int)t.minY, y0), ye = min((int)t.maxY, y0 + TILE_SIZE - 1);
+        if (xs > xe || ys > ye)
+            return passed;
+        // start on a 4-pixel group of the tile
+        xs = x0 + ((xs - x0) & ~3);
+
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 lastX = _mm_set1_ps((float)xe);
+        const __m128 idVector = _mm_castsi128_ps(_mm_set1_epi32((int)id));
+        __m128 a[3], tie[3];
+        for (int i = 0; i < 3; i++)
+        {
+            a[i] = _mm_set1_ps(t.edgeA[i]);
+            tie[i] = _mm_castsi128_ps(_mm_set1_epi32(t.tieMask & (1 << i) ? -1 : 0));
+        }
+        const __m128 zA = _mm_set1_ps(t.zA);
+
+        for (int y = ys; y <= ye; y++)
+        {
+            float fy = (float)y;
+            __m128 row[3];
+            for (int i = 0; i < 3; i++)
+                row[i] = _mm_set1_ps(t.edgeB[i] * fy + t.edgeC[i]);
+            __m128 zRow = _mm_set1_ps(t.zB * fy + t.zC);
+            float *depthRow = depth + (y - y0) * TILE_SIZE - x0;
+            uint32_t *triangleRow = triangle + (y - y0) * TILE_SIZE - x0;
+
+            for (int x = xs; x <= xe; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+                __m128 mask = _mm_cmple_ps(px, lastX);
+                for (int i = 0; i < 3; i++)
+                {
+                    __m128 e = _mm_add_ps(_mm_mul_ps(a[i], px), row[i]);
+                    __m128 inside = _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), tie[i]));
+                    mask = _mm_and_ps(mask, inside);
+                }
+                if (_mm_movemask_ps(mask) == 0)
+                    continue;
+
+                __m128 z = _mm_add_ps(_mm_mul_ps(zA, px), zRow);
+                __m128 d = _mm_load_ps(depthRow + x);
+                mask = _mm_and_ps(mask, _mm_cmplt_ps(z, d));
+                int written = _mm_movemask_ps(mask);
+                if (written == 0)
+                    continue;
+                passed += (written & 1) + (written >> 1 & 1) + (written >> 2 & 1) + (written >> 3);
+
+                _mm_store_ps(depthRow + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, d)));
+                __m128 ids = _mm_load_ps((const float *)(triangleRow + x));
+                _mm_store_ps((float *)(triangleRow + x), _mm_or_ps(_mm_and_ps(mask, idVector), _mm_andnot_ps(mask, ids)));
+            }
+        }
+#else
+        for (int y = ys; y <= ye; y++)
+        {
+            float fy = (float)y;
+            float *depthRow = depth + (y - y0) * TILE_SIZE - x0;
+            uint32_t *triangleRow = triangle + (y - y0) * TILE_SIZE - x0;
+            for (int x = xs; x <= xe; x++)
+            {
+                float fx = (float)x;
+                bool inside = true;
+                for (int i = 0; i < 3 && inside; i++)
+                {
+                    float e = t.edgeA[i] * fx + (t.edgeB[i] * fy + t.edgeC[i]);
+                    inside = e > 0.0f || (e == 0.0f && (t.tieMask & (1 << i)));
+                }
+                float z = t.zA * fx + (t.zB * fy + t.zC);
+                if (inside && z < depthRow[x])
+                {
+                    depthRow[x] = z;
+                    triangleRow[x] = id;
+                    passed++;
+                }
+            }
+        }
+#endif
+        return passed;
+    }
+
+    inline unsigned char toUnorm8(float v)
+    {
+        return (unsigned char)(min(max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+SoftwareRenderer::SoftwareRenderer(unsigned int numThreads)
+    : pool(numThreads)
+{
+}
+
+void SoftwareRenderer::resize(int width, int height)
+{
+    frameWidth = width;
+    frameHeight = height;
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    color.assign((size_t)width * height * 3, 0);
+    tileTriangles.resize((size_t)tilesX * tilesY);
+    tileFragments.resize(tileTriangles.size());
+}
+
+void SoftwareRenderer::transformVertices(const MeshBuffers &mesh, const glm::mat4 &mvp, const glm::mat4 &model)
+{
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    size_t count = mesh.numVertices();
+    vertices.resize(count);
+    pool.parallelFor((count + VERTEX_BLOCK - 1) / VERTEX_BLOCK, [&](size_t block) {
+        size_t end = min(count, (block + 1) * VERTEX_BLOCK);
+        for (size_t i = block * VERTEX_BLOCK; i < end; i++)
+        {
+            const float *src = mesh.vertices() + i * 6;
+            glm::vec4 position(src[0], src[1], src[2], 1.0f);
+            ShadedVertex &v = vertices[i];
+            v.clip = mvp * position;
+            v.world = glm::vec3(model * position);
+            v.normal = normalMatrix * glm::vec3(src[3], src[4], src[5]);
+        }
+    });
+}
+
+void SoftwareRenderer::setupChunk(size_t chunkIndex, const MeshBuffers &mesh)
+{
+    Chunk &chunk = chunks[chunkIndex];
+    chunk.setups.clear();
+    chunk.clipped.clear();
+    size_t numTiles = tileTriangles.size();
+    vector<uint32_t> *chunkBins = &bins[chunkIndex * numTiles];
+    for (size_t i = 0; i < numTiles; i++)
+        chunkBins[i].clear();
+
+    const float width = (float)frameWidth, height = (float)frameHeight;
+    auto fetch = [&](uint32_t ref) -> const ShadedVertex & {
+        return ref & CLIPPED_VERTEX ? chunk.clipped[ref & ~CLIPPED_VERTEX] : vertices[ref];
+    };
+
+    // screen-space setup and binning of a triangle entirely in front of the near plane
+    auto emitTriangle = [&](const uint32_t refs[3], uint32_t material) {
+        float sx[3], sy[3], sz[3], invW[3];
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4 &clip = fetch(refs[i]).clip;
+            invW[i] = 1.0f / clip.w;
+            sx[i] = (clip.x * invW[i] * 0.5f + 0.5f) * width;
+            sy[i] = (clip.y * invW[i] * 0.5f + 0.5f) * height;
+            sz[i] = clip.z * invW[i];
+        }
+
+        // covered pixel centers, clamped to the screen
+        float minX = ceilf(min(sx[0], min(sx[1], sx[2])) - 0.5f);
+        float maxX = floorf(max(sx[0], max(sx[1], sx[2])) - 0.5f);
+        float minY = ceilf(min(sy[0], min(sy[1], sy[2])) - 0.5f);
+        float maxY = floorf(max(sy[0], max(sy[1], sy[2])) - 0.5f);
+        minX = max(minX, 0.0f);
+        minY = max(minY, 0.0f);
+        maxX = min(maxX, width - 1.0f);
+        maxY = min(maxY, height - 1.0f);
+        if (!(minX <= maxX && minY <= maxY))
+            return;
+
+        TriangleSetup t;
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3, k = (i + 2) % 3;
+            t.edgeA[i] = sy[j] - sy[k];
+            t.edgeB[i] = sx[k] - sx[j];
+            t.edgeC[i] = sx[j] * sy[k] - sx[k] * sy[j];
+        }
+        float area = t.edgeA[0] * sx[0] + t.edgeB[0] * sy[0] + t.edgeC[0];
+        if (area == 0.0f || !isfinite(area))
+            return;
+        // both windings are drawn, as culling is off in the GL path
+        if (area < 0.0f)
+        {
+            area = -area;
+            for (int i = 0; i < 3; i++)
+            {
+                t.edgeA[i] = -t.edgeA[i];
+                t.edgeB[i] = -t.edgeB[i];
+                t.edgeC[i] = -t.edgeC[i];
+            }
+        }
+
+        // Depth gradients from differences to vertex 0 (the edge a and b
+        // coefficients each sum to zero). Building the plane from the edge
+        // constants instead would cancel away most of the depth precision.
+        double zA = 0.0, zB = 0.0;
+        for (int i = 1; i < 3; i++)
+        {
+            zA += (double)t.edgeA[i] * (sz[i] - sz[0]);
+            zB += (double)t.edgeB[i] * (sz[i] - sz[0]);
+        }
+        zA /= area;
+        zB /= area;
+        t.zA = (float)zA;
+        t.zB = (float)zB;
+        t.zC = (float)(sz[0] + zA * (0.5 - sx[0]) + zB * (0.5 - sy[0]));
+
+        t.tieMask = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            // sample at pixel centers
+            t.edgeC[i] += 0.5f * t.edgeA[i] + 0.5f * t.edgeB[i];
+            // top-left style tie breaking: a shared edge has opposite
+            // coefficients in its two triangles, so exactly one takes it
+            if (t.edgeA[i] > 0.0f || (t.edgeA[i] == 0.0f && t.edgeB[i] > 0.0f))
+                t.tieMask |= 1 << i;
+            t.invW[i] = invW[i];
+            t.vertex[i] = refs[i];
+        }
+        t.material = material;
+        t.minX = (uint16_t)minX;
+        t.minY = (uint16_t)minY;
+        t.maxX = (uint16_t)maxX;
+        t.maxY = (uint16_t)maxY;
+
+        uint32_t index = (uint32_t)chunk.setups.size();
+        chunk.setups.push_back(t);
+        for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ty++)
+        {
+            for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; tx++)
+                chunkBins[ty * tilesX + tx].push_back(index);
+        }
+    };
+
+    // first submesh the chunk overlaps
+    size_t submesh = upper_bound(submeshStarts.begin(), submeshStarts.end(), chunk.first) - submeshStarts.begin() - 1;
+    for (size_t n = chunk.first; n < chunk.first + chunk.count; n++)
+    {
+        while (n >= submeshStarts[submesh + 1])
+            submesh++;
+        const SubMesh &range = mesh.submeshes[submesh];
+        size_t firstIndex = range.first + (n - submeshStarts[submesh]) * 3;
+        uint32_t refs[3] = {readIndex(mesh, firstIndex), readIndex(mesh, firstIndex + 1), readIndex(mesh, firstIndex + 2)};
+        const ShadedVertex *v[3] = {&vertices[refs[0]], &vertices[refs[1]], &vertices[refs[2]]};
+        if (trivialReject(v[0]->clip, v[1]->clip, v[2]->clip))
+            continue;
+
+        // distance to the near plane, z = -w
+        float d[3];
+        int numInside = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            d[i] = v[i]->clip.z + v[i]->clip.w;
+            numInside += d[i] >= 0.0f;
+        }
+        if (numInside == 3)
+        {
+            emitTriangle(refs, range.materialIndex);
+            continue;
+        }
+
+        // clip into a polygon of up to four vertices and fan it out
+        uint32_t polygon[4];
+        int numPolygon = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3;
+            if (d[i] >= 0.0f)
+                polygon[numPolygon++] = refs[i];
+            if ((d[i] >= 0.0f) != (d[j] >= 0.0f))
+            {
+                chunk.clipped.push_back(lerpVertex(*v[i], *v[j], d[i] / (d[i] - d[j])));
+                polygon[numPolygon++] = CLIPPED_VERTEX | (uint32_t)(chunk.clipped.size() - 1);
+            }
+        }
+        for (int i = 2; i < numPolygon; i++)
+        {
+            uint32_t fan[3] = {polygon[0], polygon[i - 1], polygon[i]};
+            emitTriangle(fan, range.materialIndex);
+        }
+    }
+}
+
+void SoftwareRenderer::renderTile(size_t tile, const Light &light, const glm::vec3 &viewPos)
+{
+    int x0 = (int)(tile % tilesX) * TILE_SIZE;
+    int y0 = (int)(tile / tilesX) * TILE_SIZE;
+    int tileWidth = min(TILE_SIZE, frameWidth - x0);
+    int tileHeight = min(TILE_SIZE, frameHeight - y0);
+
+    // gather the tile's triangles from every chunk, in submission order
+    vector<TileTriangle> &triangles = tileTriangles[tile];
+    triangles.clear();
+    size_t numTiles = tileTriangles.size();
+    for (size_t c = 0; c < chunks.size(); c++)
+    {
+        for (uint32_t index : bins[c * numTiles + tile])
+            triangles.push_back({&chunks[c].setups[index], chunks[c].clipped.data()});
+    }
+
+    alignas(16) float depth[TILE_SIZE * TILE_SIZE];
+    alignas(16) uint32_t visible[TILE_SIZE * TILE_SIZE];
+    fill(depth, depth + TILE_SIZE * TILE_SIZE, 1.0f);
+    fill(visible, visible + TILE_SIZE * TILE_SIZE, NO_TRIANGLE);
+    FragmentStats &fragments = tileFragments[tile];
+    fragments.rasterized = fragments.shaded = 0;
+    for (size_t i = 0; i < triangles.size(); i++)
+        fragments.rasterized += rasterTriangle(*triangles[i].setup, (uint32_t)i, x0, y0, depth, visible);
+
+    // shade each visible pixel once, with phong.fs's lighting
+    glm::vec3 lightColor = light.color * light.intensity;
+    const unsigned char clear[3] = {toUnorm8(CLEAR_COLOR.r), toUnorm8(CLEAR_COLOR.g), toUnorm8(CLEAR_COLOR.b)};
+    for (int y = 0; y < tileHeight; y++)
+    {
+        // the framebuffer is stored top row first, GL window y points up
+        unsigned char *out = color.data() + ((size_t)(frameHeight - 1 - (y0 + y)) * frameWidth + x0) * 3;
+        for (int x = 0; x < tileWidth; x++, out += 3)
+        {
+            uint32_t id = visible[y * TILE_SIZE + x];
+            if (id == NO_TRIANGLE)
+            {
+                memcpy(out, clear, 3);
+                continue;
+            }
+            const TileTriangle &triangle = triangles[id];
+            const TriangleSetup &t = *triangle.setup;
+            fragments.shaded++;
+
+            // perspective-correct barycentrics
+            float fx = (float)(x0 + x), fy = (float)(y0 + y);
+            float weight[3], sum = 0.0f;
+            for (int i = 0; i < 3; i++)
+            {
+                weight[i] = (t.edgeA[i] * fx + t.edgeB[i] * fy + t.edgeC[i]) * t.invW[i];
+                sum += weight[i];
+            }
+            glm::vec3 fragPos(0.0f), normal(0.0f);
+            for (int i = 0; i < 3; i++)
+            {
+                uint32_t ref = t.vertex[i];
+                const ShadedVertex &v = ref & CLIPPED_VERTEX ? triangle.clipped[ref & ~CLIPPED_VERTEX] : vertices[ref];
+                fragPos += v.world * (weight[i] / sum);
+                normal += v.normal * (weight[i] / sum);
+            }
+
+            uint32_t material = min<uint32_t>(t.material, (uint32_t)materialColors.size() - 1);
+            const glm::vec4 &k = materialCoefficients[material]; // ka, kd, ks, ns
+
+            glm::vec3 ambient = k.x * lightColor;
+            glm::vec3 norm = glm::normalize(normal);
+            glm::vec3 lightDir = glm::normalize(light.position - fragPos);
+            float diff = max(glm::dot(norm, lightDir), 0.0f);
+            glm::vec3 diffuse = k.y * diff * lightColor;
+            glm::vec3 viewDir = glm::normalize(viewPos - fragPos);
+            glm::vec3 reflectDir = -lightDir - 2.0f * glm::dot(norm, -lightDir) * norm;
+            float spec = powf(max(glm::dot(viewDir, reflectDir), 0.0f), k.w);
+            glm::vec3 specular = k.z * spec * lightColor;
+
+            glm::vec3 result = (ambient + diffuse + specular) * materialColors[material];
+            out[0] = toUnorm8(result.r);
+            out[1] = toUnorm8(result.g);
+            out[2] = toUnorm8(result.b);
+        }
+    }
+}
+
+void SoftwareRenderer::draw(const MeshBuffers &mesh, const ViewParams &view, const Light &light)
+{
+    // like the Materials block, a missing material shades black
+    size_t numMaterials = max<size_t>(mesh.materials.size(), 1);
+    materialColors.assign(numMaterials, glm::vec3(0.0f));
+    materialCoefficients.assign(numMaterials, glm::vec4(0.0f));
+    for (size_t i = 0; i < mesh.materials.size(); i++)
+    {
+        const Material &mat = mesh.materials[i];
+        materialColors[i] = mat.color;
+        materialCoefficients[i] = glm::vec4(mat.ka, mat.kd, mat.ks, mat.ns);
+    }
+
+    glm::mat4 model = modelMatrix(view);
+    transformVertices(mesh, view.projection * viewMatrix(view) * model, model);
+
+    // triangles are numbered across submeshes in draw order
+    submeshStarts.assign(1, 0);
+    for (const SubMesh &submesh : mesh.submeshes)
+        submeshStarts.push_back(submeshStarts.back() + submesh.count / 3);
+    size_t numTriangles = submeshStarts.back();
+    size_t chunkSize = max(MIN_CHUNK_TRIANGLES, (numTriangles + pool.size() * 4 - 1) / (pool.size() * 4));
+    size_t numChunks = (numTriangles + chunkSize - 1) / chunkSize;
+    chunks.resize(numChunks);
+    for (size_t c = 0; c < numChunks; c++)
+    {
+        chunks[c].first = c * chunkSize;
+        chunks[c].count = min(chunkSize, numTriangles - chunks[c].first);
+    }
+    bins.resize(numChunks * tileTriangles.size());
+    pool.parallelFor(numChunks, [&](size_t c) { setupChunk(c, mesh); });
+
+    pool.parallelFor(tileTriangles.size(), [&](size_t tile) { renderTile(tile, light, view.cameraPos); });
+    totalFragments.frames++;
+    for (const FragmentStats &fragments : tileFragments)
+    {
+        totalFragments.rasterized += fragments.rasterized;
+        totalFragments.shaded += fragments.shaded;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef SOFTRENDERER_H
+#define SOFTRENDERER_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "meshcache.h"
+#include "renderer.h"
+#include "threadpool.h"
+
+// CPU rasterizer that draws a MeshBuffers with the same matrices and the same
+// Phong lighting as phong.fs, for machines without a GPU. A frame runs in
+// three parallel passes:
+//  - vertices are transformed to clip space, world space and world normals
+//  - triangles are clipped against the near plane, set up as edge functions
+//    and binned into TILE_SIZE x TILE_SIZE screen tiles
+//  - each tile rasterizes its bin four pixels at a time into a tile-local
+//    depth and triangle buffer, then shades every visible pixel once
+// The result matches the GL path's conventions (pixel centers, GL_LESS
+// depth, clear color), so images from both can be compared directly.
+class SoftwareRenderer
+{
+public:
+    static const int TILE_SIZE = 64;
+
+    // numThreads == 0 uses one thread per hardware thread
+    explicit SoftwareRenderer(unsigned int numThreads = 0);
+
+    SoftwareRenderer(const SoftwareRenderer &) = delete;
+    SoftwareRenderer &operator=(const SoftwareRenderer &) = delete;
+
+    void resize(int width, int height);
+    void draw(const MeshBuffers &mesh, const ViewParams &view, const Light &light);
+
+    int width() const { return frameWidth; }
+    int height() const { return frameHeight; }
+    unsigned int numThreads() const { return pool.size(); }
+    // RGB, top row first, the layout writePpm takes
+    const std::vector<unsigned char> &pixels() const { return color; }
+    // Over every frame drawn: fragments that won the depth test as their
+    // triangle was rasterized, and pixels shaded, each exactly once. The
+    // difference is the overdraw that shading after visibility avoids.
+    const FragmentStats &fragmentStats() const { return totalFragments; }
+
+    // Vertex after the vertex stage; clipping interpolates all of it.
+    struct ShadedVertex
+    {
+        glm::vec4 clip;
+        glm::vec3 world;
+        glm::vec3 normal;
+    };
+
+    // Edge functions E(x, y) = a * x + b * y + c at integer pixel coordinates
+    // (the pixel center offset is folded into c), positive inside. Edge i is
+    // opposite vertex i, so E_i / (E_0 + E_1 + E_2) is the screen-space
+    // barycentric weight of vertex i.
+    struct TriangleSetup
+    {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float zA, zB, zC; // NDC depth as a plane over the screen
+        float invW[3];    // for perspective-correct attributes
+        uint32_t vertex[3];
+        uint32_t material;
+        uint16_t minX, minY, maxX, maxY; // covered pixels, inclusive
+        uint32_t tieMask; // bit i: pixels exactly on edge i belong to this triangle
+    };
+
+    // a contiguous run of triangles set up and binned by one task
+    struct Chunk
+    {
+        size_t first, count; // in submesh order
+        std::vector<TriangleSetup> setups;
+        std::vector<ShadedVertex> clipped; // vertices created by near clipping
+    };
+
+    // tile-local reference to a binned triangle
+    struct TileTriangle
+    {
+        const TriangleSetup *setup;
+        const ShadedVertex *clipped;
+    };
+
+private:
+    void transformVertices(const MeshBuffers &mesh, const glm::mat4 &mvp, const glm::mat4 &model);
+    void setupChunk(size_t chunkIndex, const MeshBuffers &mesh);
+    void renderTile(size_t tile, const Light &light, const glm::vec3 &viewPos);
+
+    ThreadPool pool;
+    int frameWidth = 0, frameHeight = 0;
+    int tilesX = 0, tilesY = 0;
+
+    std::vector<ShadedVertex> vertices;
+    std::vector<size_t> submeshStarts; // first triangle of each submesh, plus the total
+    std::vector<Chunk> chunks;
+    // bins[chunk * numTiles + tile]: setup indices in submission order
+    std::vector<std::vector<uint32_t>> bins;
+    std::vector<std::vector<TileTriangle>> tileTriangles;
+    std::vector<FragmentStats> tileFragments; // last frame, per tile
+    FragmentStats totalFragments;
+    std::vector<glm::vec3> materialColors;
+    std::vector<glm::vec4> materialCoefficients; // ka, kd, ks, ns
+    std::vector<unsigned char> color;
+};
+
+#endif
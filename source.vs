@@ -1,30 +1,66 @@
 #version 330 core
 
-// vec4 aPos for CPU, vec3 aPos for GPU
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// positions transformed on the CPU are drawn with cpu.vs instead
+layout (location = 0) in vec3 aPos;    // or 0..1 across the mesh bounds when quantized
+layout (location = 1) in vec3 aNormal; // or an octahedron point in xy when quantized
+// per instance; a single identity instance when instancing is off
+layout (location = 2) in mat4 aInstanceModel;  // locations 2-5
+layout (location = 6) in mat3 aInstanceNormal; // locations 6-8
+layout (location = 9) in vec4 aInstanceTint;
+// per instance of a multi-draw command, otherwise constant per draw
+layout (location = 10) in int aMaterialIndex;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec3 LightPos;
 out vec3 ViewPos;
 out vec3 vertexColor;
+out vec4 Tint;
+flat out int MaterialIndex;
+// the depth pre-pass and the shaded pass must agree on every depth
+invariant gl_Position;
 
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPosition;
+    vec4 lightColor; // rgb, w = intensity
+    vec4 viewPosition;
+};
+
+// constant across a draw, so computed once on the CPU
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat4 mvp;          // projection * view * model
+uniform mat3 normalMatrix; // transpose(inverse(mat3(model)))
+// vertex decoding, set once at load; scale 1, offset 0 and false for floats
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform bool octNormals;
+
+// point in [-1, 1]^2 -> unit vector; matches octDecode in quantize.cpp
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 
 void main()
 {
-    // Uncomment for GPU-side
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    LightPos = vec3(view * vec4(3.0f, -1.0f, 10.0f, 1.0f)); // Light position in view space
-    ViewPos = vec3(inverse(view)[3]); // Camera position in world space
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-
-    // Uncomment for CPU-side
-    // gl_Position = aPos;
+    vec3 position = aPos * positionScale + positionOffset;
+    vec3 normal = octNormals ? octDecode(aNormal.xy) : aNormal;
+
+    // the instance places the copy, model then moves the whole scene
+    vec4 instancePos = aInstanceModel * vec4(position, 1.0);
+    FragPos = vec3(model * instancePos);
+    Normal = normalMatrix * (aInstanceNormal * normal);
+    LightPos = lightPosition.xyz; // Light position in world space
+    ViewPos = viewPosition.xyz; // Camera position in world space
+    Tint = aInstanceTint;
+    MaterialIndex = aMaterialIndex;
+    gl_Position = mvp * instancePos;
 
     //Uncomment for zbuffer
     // vec3 zBuff = vec3(1) * ((gl_Position.z - 5.0) / gl_Position.w);
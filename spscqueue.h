@@ -0,0 +1,53 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded queue between exactly one producer thread and one consumer thread.
+// Neither side locks or waits: each owns one index and only reads the
+// other's. A release store publishes a slot after it is written and an
+// acquire load sees it complete, so the element itself needs no atomics.
+template <typename T>
+class SpscQueue
+{
+public:
+    // one slot stays empty to tell a full ring from an empty one
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // producer only; false, leaving value alone, when the queue is full
+    bool push(T &value)
+    {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        size_t next = tail + 1 == slots.size() ? 0 : tail + 1;
+        if (next == headIndex.load(std::memory_order_acquire))
+            return false;
+        slots[tail] = std::move(value);
+        tailIndex.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only; false when the queue is empty
+    bool pop(T &value)
+    {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire))
+            return false;
+        value = std::move(slots[head]);
+        headIndex.store(head + 1 == slots.size() ? 0 : head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    // on separate cache lines, so the two threads do not false-share
+    alignas(64) std::atomic<size_t> headIndex{0}; // next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tailIndex{0}; // next slot to push, written by the producer
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread
+// takes part in every loop, so a pool of size 1 runs everything inline.
+class ThreadPool
+{
+public:
+    // numThreads == 0 uses one thread per hardware thread
+    explicit ThreadPool(unsigned int numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned int size() const { return (unsigned int)workers.size() + 1; }
+
+    // Calls fn(i) for every i in [0, count) and returns once all calls are done.
+    void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+
+private:
+    void workerLoop();
+    void runJob();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::mutex jobMutex;
+
+    const std::function<void(size_t)> *job = nullptr;
+    size_t jobCount = 0;
+    std::atomic<size_t> nextIndex{0};
+    unsigned long generation = 0;
+    unsigned int busyWorkers = 0;
+    bool stopping = false;
+};
+
+#endif
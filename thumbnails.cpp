@@ -0,0 +1,261 @@
+#include "thumbnails.h"
+#include "boundedqueue.h"
+#include "imagewriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+namespace
+{
+    // a parsed model on its way from a loader thread to the GL thread
+    struct LoadedAsset
+    {
+        size_t index = 0;
+        MeshBuffers mesh;
+    };
+
+    bool hasObjExtension(const string &filename)
+    {
+        if (filename.size() < 4)
+            return false;
+        string extension = filename.substr(filename.size() - 4);
+        transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+        return extension == ".obj";
+    }
+
+    // "assets/chairs/a.obj" under "assets" -> "thumbnails/chairs_a.png"
+    string thumbnailFilename(const string &objFilename, const string &root, const string &outputDirectory)
+    {
+        string name = objFilename;
+        string prefix = root.empty() || root.back() == '/' ? root : root + "/";
+        if (!prefix.empty() && name.compare(0, prefix.size(), prefix) == 0)
+            name = name.substr(prefix.size());
+        while (name.compare(0, 2, "./") == 0)
+            name = name.substr(2);
+        if (hasObjExtension(name))
+            name.resize(name.size() - 4);
+        replace(name.begin(), name.end(), '/', '_');
+        return outputDirectory + "/" + name + ".png";
+    }
+
+    double secondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    double percent(double busy, double seconds, unsigned int threads)
+    {
+        return seconds > 0.0 ? 100.0 * busy / (seconds * threads) : 0.0;
+    }
+}
+
+bool listAssets(const string &source, vector<string> &objFilenames)
+{
+    objFilenames.clear();
+    error_code error;
+    if (filesystem::is_directory(source, error))
+    {
+        filesystem::recursive_directory_iterator it(source, filesystem::directory_options::follow_directory_symlink, error);
+        for (; !error && it != filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if (it->is_regular_file(error) && hasObjExtension(it->path().string()))
+                objFilenames.push_back(it->path().string());
+        }
+        if (error)
+        {
+            cerr << "thumbnails: cannot list " << source << ": " << error.message() << endl;
+            return false;
+        }
+        sort(objFilenames.begin(), objFilenames.end());
+        return true;
+    }
+
+    ifstream in(source);
+    if (!in.is_open())
+    {
+        cerr << "thumbnails: " << source << " is neither a directory nor a readable list of OBJs" << endl;
+        return false;
+    }
+    string line;
+    while (getline(in, line))
+    {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '#')
+            continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        objFilenames.push_back(line.substr(first, last - first + 1));
+    }
+    return true;
+}
+
+bool renderThumbnails(HeadlessContext &context, const vector<string> &objFilenames, const string &root,
+                      const ThumbnailSettings &settings)
+{
+    error_code error;
+    filesystem::create_directories(settings.outputDirectory, error);
+    if (error)
+    {
+        cerr << "thumbnails: cannot create " << settings.outputDirectory << ": " << error.message() << endl;
+        return false;
+    }
+    unsigned int numLoaders = settings.numLoaders;
+    if (numLoaders == 0)
+        numLoaders = max(thread::hardware_concurrency(), 1u);
+    BoundedQueue<LoadedAsset> loaded(settings.queueSize > 0 ? settings.queueSize : numLoaders * 2);
+    ImageWriter writer(settings.numEncoders);
+    cout << "thumbnails: " << objFilenames.size() << " OBJs at " << context.width() << "x" << context.height() << ", "
+         << numLoaders << " loader threads, " << writer.numThreads() << " encoder threads" << endl;
+    auto start = chrono::steady_clock::now();
+
+    // Stage 1: each loader takes the next OBJ and parses it on its own
+    // thread only, so the loaders work on different assets side by side.
+    // The last one to finish closes the queue.
+    atomic<size_t> nextAsset{0};
+    atomic<unsigned int> runningLoaders{numLoaders};
+    atomic<size_t> failedLoads{0};
+    vector<double> loaderSeconds(numLoaders, 0.0);
+    vector<thread> loaders;
+    for (unsigned int t = 0; t < numLoaders; t++)
+    {
+        loaders.emplace_back([&, t] {
+            // Only what a thumbnail needs: no LODs or reordering, which
+            // would count as parse time and bring thread pools of their
+            // own, and no .meshbin left beside assets that may not be ours
+            // to write to. An existing cache is still used.
+            MeshLoadOptions loadOptions;
+            loadOptions.obj.numThreads = 1;
+            loadOptions.obj.quiet = true;
+            loadOptions.lods = false;
+            loadOptions.optimize = false;
+            loadOptions.writeCache = false;
+            for (size_t i = nextAsset++; i < objFilenames.size(); i = nextAsset++)
+            {
+                auto loadStart = chrono::steady_clock::now();
+                LoadedAsset asset;
+                asset.index = i;
+                bool ok = loadMesh(objFilenames[i], asset.mesh, loadOptions);
+                loaderSeconds[t] += secondsSince(loadStart);
+                if (!ok)
+                {
+                    cerr << "thumbnails: skipping " << objFilenames[i] << endl;
+                    failedLoads++;
+                }
+                else if (!loaded.push(asset))
+                    break;
+            }
+            if (--runningLoaders == 0)
+                loaded.close();
+        });
+    }
+
+    // Stage 2, on this thread: upload, draw and start the readback of one
+    // asset after the other. Finished readbacks go to the encoders (stage
+    // 3) in the order they were started.
+    Renderer renderer;
+    renderer.setShaderCache(settings.shaderCache);
+    deque<string> pendingNames;
+    vector<unsigned char> pixels;
+    double readbackWait = 0.0;
+    size_t failedRenders = 0, rendered = 0;
+    auto collectImage = [&](bool wait) {
+        auto waitStart = chrono::steady_clock::now();
+        if (!context.finishReadback(pixels, wait))
+            return false;
+        if (wait)
+            readbackWait += secondsSince(waitStart);
+        writer.submit(pendingNames.front(), context.width(), context.height(), pixels);
+        pendingNames.pop_front();
+        return true;
+    };
+    float aspect = (float)context.width() / (float)context.height();
+    float halfFov = glm::radians(45.0f) * 0.5f;
+    glm::vec3 viewDirection = glm::length(settings.viewDirection) > 0.0f ? glm::normalize(settings.viewDirection) : glm::vec3(0.0f, 0.0f, 1.0f);
+    for (;;)
+    {
+        // with readbacks in flight, finish one rather than wait for a mesh
+        LoadedAsset asset;
+        bool haveAsset = context.pendingReadbacks() > 0 ? loaded.tryPop(asset) : loaded.pop(asset);
+        if (!haveAsset)
+        {
+            if (context.pendingReadbacks() > 0)
+            {
+                collectImage(true);
+                continue;
+            }
+            break;
+        }
+        if (!renderer.load(std::move(asset.mesh), settings.vertexFilename, settings.fragmentFilename))
+        {
+            cerr << "thumbnails: cannot draw " << objFilenames[asset.index] << endl;
+            failedRenders++;
+            continue;
+        }
+
+        // fit the bounding sphere into the narrower side of the frame
+        glm::vec3 boundsMin, boundsMax;
+        renderer.sceneBounds(boundsMin, boundsMax);
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        float radius = max(glm::length(boundsMax - boundsMin) * 0.5f, 1e-6f);
+        float distance = radius / sin(min(halfFov, atan(tan(halfFov) * aspect)));
+        ViewParams view;
+        view.cameraTarget = center;
+        view.cameraPos = center + viewDirection * distance;
+        view.projection = glm::perspective(2.0f * halfFov, aspect, (distance - radius) * 0.99f, (distance + radius) * 1.01f);
+        // the light keeps its place relative to the camera, as for a model
+        // the default camera, 10 units away, frames the same way
+        Light light = settings.light;
+        light.position = center + settings.light.position * (distance / 10.0f);
+        renderer.upload(view, light);
+        renderer.draw();
+
+        if (context.readbackRingFull())
+            collectImage(true);
+        context.startReadback();
+        pendingNames.push_back(thumbnailFilename(objFilenames[asset.index], root, settings.outputDirectory));
+        rendered++;
+        while (collectImage(false))
+            ;
+    }
+    loaded.close();
+    for (thread &loader : loaders)
+        loader.join();
+    bool ok = writer.finish() && failedLoads == 0 && failedRenders == 0;
+    double seconds = secondsSince(start);
+    renderer.release();
+
+    // The GL thread runs throughout, so what it did not spend waiting on a
+    // neighbor it spent on its own work.
+    double loadBusy = 0.0;
+    for (double s : loaderSeconds)
+        loadBusy += s;
+    double glWaits = loaded.popWaitSeconds() + readbackWait + writer.blockedSeconds();
+    double utilization[3] = {
+        percent(loadBusy, seconds, numLoaders),
+        percent(max(seconds - glWaits, 0.0), seconds, 1),
+        percent(writer.busySeconds(), seconds, writer.numThreads())};
+    const char *stages[3] = {"parse", "render", "encode"};
+    int bottleneck = (int)(max_element(utilization, utilization + 3) - utilization);
+    cout << "thumbnails: " << writer.written() << " of " << objFilenames.size() << " assets in " << seconds << " s, "
+         << (seconds > 0.0 ? writer.written() / seconds : 0.0) << " assets per second; "
+         << failedLoads << " failed to load, " << failedRenders << " to draw, " << rendered - writer.written()
+         << " to write" << endl;
+    cout << "  parse:  " << numLoaders << " threads " << utilization[0] << "% busy, waited "
+         << loaded.pushWaitSeconds() * 1000.0 << " ms for the GL thread" << endl;
+    cout << "  render: 1 thread " << utilization[1] << "% busy, waited " << loaded.popWaitSeconds() * 1000.0
+         << " ms for meshes, " << readbackWait * 1000.0 << " ms for readback, "
+         << writer.blockedSeconds() * 1000.0 << " ms for encoders" << endl;
+    cout << "  encode: " << writer.numThreads() << " threads " << utilization[2] << "% busy" << endl;
+    cout << "  bottleneck: " << stages[bottleneck] << endl;
+    return ok && rendered == writer.written();
+}
@@ -0,0 +1,42 @@
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "headless.h"
+#include "renderer.h"
+
+// The OBJs of a directory and everything below it, or of a text file that
+// lists one path per line ('#' starts a comment), in a stable order.
+bool listAssets(const std::string &source, std::vector<std::string> &objFilenames);
+
+struct ThumbnailSettings
+{
+    std::string vertexFilename = "source.vs";
+    std::string fragmentFilename = "source.fs";
+    std::string shaderCache; // "" = compile every time
+    std::string outputDirectory = "thumbnails";
+    // the camera looks at each model's center from this side, far enough
+    // away that its bounding sphere fills the frame
+    glm::vec3 viewDirection = glm::vec3(0.0f, 0.0f, 1.0f);
+    Light light = Light(glm::vec3(3.0f, -1.0f, 3.0f), glm::vec3(1.0f), 1.0f);
+    unsigned int numLoaders = 0;  // 0 = one per hardware thread
+    unsigned int numEncoders = 0; // 0 = one per hardware thread
+    size_t queueSize = 0;         // loaded meshes waiting for the GL thread, 0 = two per loader
+};
+
+// Renders one PNG per OBJ with the context's framebuffer, as
+// outputDirectory/<path with '/' turned into '_'>.png, the path taken
+// relative to root when it lies below it. Three stages overlap, with
+// bounded queues between them: loader threads parse the OBJs (or map a
+// current .meshbin, but never write one), this thread uploads and draws
+// each one and reads it back through the context's readback ring, and
+// encoder threads write the images. Nothing is printed per asset; assets
+// per second and each stage's utilization are printed at the end. False if
+// any asset failed.
+bool renderThumbnails(HeadlessContext &context, const std::vector<std::string> &objFilenames, const std::string &root,
+                      const ThumbnailSettings &settings);
+
+#endif